@@ -11,7 +11,7 @@
 *								dates and owner-group permissions.
 */
 
-#define _XOPEN_SOURCE 500			//incorporating POSIX 1995
+#define _GNU_SOURCE					//POSIX 2008 plus openat/fstatat and the other linux extensions
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,172 +19,5346 @@
 #include <sys/stat.h>
 #include <pwd.h>
 #include <time.h>
-#include <utime.h>
 #include <grp.h>
 #include <unistd.h>
 #include <errno.h>
 #include <limits.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <fnmatch.h>
+#include <getopt.h>
+#include <stdatomic.h>
+#include "idcache.h"
+#include "header.h"
+#include "crc32c.h"
+#include "filter.h"
+#include <zlib.h>
+#include <openssl/evp.h>
 
 /*	Global Variables
 * Named gl_<name> to try and prevent name collisions and indicate that I'm using a global variable.
 *
 * gl_startDate		time_t		used in 'backup' function as date cut off for file selection
-* gl_now			time_t		used in 'backup' function to exclude the archive file from file walk
+* gl_now			time_t		when the backup started, for whiteouts and the default archive name
 * gl_pathOffset 	int			used in 'backup' function to cut out all the unnecessary parent directory info
-* archive			FILE		holds the open file for archiving the selected content			
+* gl_threads		int			number of threads the directory walk, or the restore, uses. Set with -j
 */
 time_t 	gl_startDate;
 time_t 	gl_now;
 int 	gl_pathOffset;
-FILE    *archive;
+int		gl_threads;
 
-/*	Struct TarHeader  -typedef-  Header
-* Contains all the information to store about each entry in our tar archive in a neat 512 byte block.
+#define BLOCK_SIZE		512				//tar blocks, and the alignment of every buffer in the pipeline
+#define CHUNK_SIZE		(1 << 20)		//largest single read-ahead buffer
+#define WRITE_BUFFER	(1 << 20)		//size of the archive writer's own buffer
+#define PIPE_MEMBERS	4096			//most members that can be queued ahead of the writer
+#define WALK_NODES		(64 << 10)		//most entries the walk reads ahead of the archive before it waits
+#define DIRECT_SIZE		(4 << 20)		//files this big are copied by the kernel instead of read ahead
+#define COPY_BUFFER		(1 << 20)		//buffer for copies the kernel can't do for us
+#define FRAME_HEADER	24				//gzip header of a -z frame, including its 'TF' extra field
+#define CDC_MIN			(16 << 10)		//smallest -d chunk, no boundary is looked for before this
+#define CDC_MAX			(256 << 10)		//largest -d chunk, a boundary is forced here
+#define CDC_MASK		(0xffffULL << 48)	//boundary when these hash bits are zero, about every 64KiB
+#define PHASE_WALK		0				//reading directories
+#define PHASE_STAT		1				//stat of everything the walk finds
+#define PHASE_OPEN		2				//opening files to read or to restore
+#define PHASE_READ		3				//read() of file data in backup, of the archive in restore
+#define PHASE_WRITE		4				//write() and kernel copies, to the archive or to restored files
+#define PHASE_HEADER	5				//building or parsing tar headers
+#define PHASE_META		6				//owner, mode and times applied by restore
+#define PHASE_HASH		7				//CRC32C of member data, for -c, --verify and --compare
+#define PHASES			8
+#define SLOW_FILES		8				//slowest files named in the --stats report
+#define LATENCY_BUCKETS	32				//per-file latency histogram, bucket i is [2^i, 2^(i+1)) microseconds
+#define CHUNK_LINE		80				//room for one "{sha256 hex} {length}\n" line of a chunk list
+#define PAX_MAX			(1 << 20)		//biggest pax extended header restore reads, bigger ones are skipped
+#define DIRECT_ALIGN	4096			//O_DIRECT buffers, offsets and lengths are multiples of this
+#define DROP_BEHIND		(8 << 20)		//-n drops a buffered archive from the page cache this much at a time
+#define STREAM_BUFFER	(1 << 20)		//read-ahead of an archive restore can't map, such as a pipe
+#define SPLIT_SIZE		(64 << 20)		//files this big are read, hashed and restored by several threads at once
+#define SPLIT_RANGE		(16 << 20)		//the piece of such a file each thread takes, a multiple of CHUNK_SIZE
+#define JOURNAL_SLOT	4096			//each of the two records in a backup's journal
+#define JOURNAL_EVERY	5				//seconds between journal checkpoints
+
+/*	Struct ArchiveWriter  -typedef-  Writer
+* Buffered output to the archive file descriptor. Headers and padding are collected in 'buffer', large blocks
+* of file data are written straight from the read-ahead buffers they arrived in. Each archive, or each shard
+* with -s, has its own writer thread working through its own list of members, and its own -z frames, -n
+* staging and index.
+*/
+typedef struct ArchiveWriter{
+	int fd;
+	const char *path;				//the archive's file name, its index goes next to it
+	char *buffer;					//WRITE_BUFFER bytes, aligned for O_DIRECT
+	size_t used;					//bytes waiting in buffer
+	off_t offset;					//total bytes written to the archive so far, including buffered ones
+	off_t assigned;					//bytes of file data queued for this archive, to share out members
+	size_t members;					//members written, for the shard manifest
+	struct PipeMember *head;		//oldest member queued for this archive, the one being written
+	struct PipeMember *tail;		//newest
+	pthread_t thread;
+	pthread_cond_t ready;			//signalled when the head may have something new to write
+	struct CompressFrame *frames;	//-z, ring of frames in flight
+	size_t frameSlots;
+	size_t frameSubmitted;			//frames handed over by the writer
+	size_t frameClaimed;			//frames taken by a compression thread
+	size_t frameWritten;			//frames written to the archive
+	int direct;						//-n, the archive is open with O_DIRECT
+	char *stage;					//-n, WRITE_BUFFER bytes, collects the archive into whole aligned blocks
+	size_t staged;					//bytes waiting in stage
+	off_t written;					//-n, bytes of archive handed to the kernel so far
+	off_t flushed;					//-n, bytes whose writeback has been started
+	off_t dropped;					//-n, bytes already written back and dropped from the page cache
+	struct IndexRecord *records;	//index of the members written, in archive order
+	size_t nrecords;
+	size_t recordsCapacity;
+	char *names;					//name table the records point into
+	size_t namesSize;
+	size_t namesCapacity;
+}
+Writer;
+
+/*	Struct DataChunk  -typedef-  Chunk
+* A piece of a member's data read ahead of the writer. 'length' is always a multiple of 512, the reader
+* zero fills the tail of the last chunk so the tar padding is already in place.
+*/
+typedef struct DataChunk{
+	struct DataChunk *next;
+	size_t length;
+	char *data;						//512 byte aligned
+	off_t at;						//where the data goes in a split member, whose chunks can arrive out of order
+}
+Chunk;
+
+/*	Struct PipeMember  -typedef-  Member
+* One entry on its way into the archive. Members are queued in walk order by 'backup', claimed in that order
+* by the reader threads and written strictly in that order by their archive's writer thread.
+*/
+typedef struct PipeMember{
+	Header header;
+	char *path;
+	off_t size;						//st_size when the file was stat'd, exactly this much data is archived
+	mode_t mode;
+	time_t mtime;
+	int headerOnly;					//a directory, a whiteout or a hard link, there is no data to read
+	int done;						//the reader has queued all of the data
+	int failed;						//the file couldn't be opened, nothing is written for it
+	int direct;						//big file, the writer copies it with copyData() instead of the readers
+	int sparse;						//fewer blocks allocated than st_size needs, look for holes
+	off_t sparseSize;				//st_size once it is archived sparse, 'size' is then the map and data
+	int written;					//the writer has written the header
+	int whiteout;					//-g, queued for a deleted file after the walk, not part of it
+	int linked;						//a file with more than one link, 'dev' and 'ino' find it in gl_links
+	dev_t dev;
+	ino_t ino;
+	uint32_t crc;					//-c, CRC32C of the data as archived, set before the first chunk is queued
+	int split;						//big file read a SPLIT_RANGE at a time by several readers at once
+	int fd;							//split, the file, opened by the walk and shared by the readers
+	int hashing;					//split with -c, the ranges are being hashed before any are read
+	off_t claimed;					//split, bytes of the file handed out to readers in the current pass
+	size_t rangesLeft;				//split, ranges of the current pass not finished yet
+	uint32_t *crcs;					//split with -c, CRC32C of each range, combined into 'crc'
+	off_t taken;					//split, bytes of data the writer has taken, the next chunk it needs
+	uint64_t started;				//split, when the first range was claimed, for --stats
+	Chunk *chunks;					//data read but not yet written
+	Chunk *last;
+	Writer *out;					//archive the member goes in
+	struct PipeMember *next;		//next member for the same archive
+	struct PipeMember *nextClaim;	//next member with data for the readers, in walk order
+}
+Member;
+
+/*	Pipeline Globals
+* gl_out			Writer		the archive being written, or every shard of it with -s
+* gl_nout			int			number of writers in gl_out
+* gl_manifest		char		set by -s, file listing the shards, NULL when writing one archive
+* gl_budget			size_t		most bytes of read-ahead buffers allowed at once, set with -m
+* gl_inUse			size_t		bytes of read-ahead buffers currently allocated
+* gl_pipeClaim		Member		next member with no reader yet
+* gl_claimTail		Member		newest member queued for the readers, NULL once they have claimed them all
+* gl_pipeCount		size_t		number of queued members
+* gl_pipeClosed		int			set once the walk has finished queueing members
+* gl_pipeThreads	pthread_t	the reader threads
+* gl_pipeReaders	int			number of reader threads
+* gl_failed			char		paths below the root of members that couldn't be read, for the -g catalog
+* gl_nfailed		size_t		number of them
+* gl_pipeLock		mutex		protects all of the above, and each writer's list of members and 'assigned'
+* gl_pipeClaimable	cond		signalled when a member is queued for the readers
+* gl_pipeSpace		cond		signalled when buffer budget, a queue slot or a new head becomes available
+*/
+Writer			*gl_out;
+int				gl_nout = 1;
+char			*gl_manifest;
+size_t			gl_budget = 64 << 20;
+size_t			gl_inUse;
+Member			*gl_pipeClaim;
+Member			*gl_claimTail;
+size_t			gl_pipeCount;
+int				gl_pipeClosed;
+pthread_t		*gl_pipeThreads;
+int				gl_pipeReaders;
+char			**gl_failed;
+size_t			gl_nfailed;
+pthread_mutex_t	gl_pipeLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t	gl_pipeClaimable = PTHREAD_COND_INITIALIZER;
+pthread_cond_t	gl_pipeSpace = PTHREAD_COND_INITIALIZER;
+
+/*	Struct SlowFile  -typedef-  SlowFile
+* One of the files that took longest to archive or restore, from open to done.
+*/
+typedef struct SlowFile{
+	uint64_t nanos;
+	char *path;
+}
+SlowFile;
+
+/*	Stats Globals
+* Counters are updated by every thread without a lock, timers are summed over all threads so a phase can add
+* up to more than the wall clock time.
+*
+* gl_quiet			int			set by -q, no line for each file
+* gl_progress		int			set by -P, a progress line on stderr every second
+* gl_statsPath		char		set by --stats, file the JSON summary is written to, "-" for stderr
+* gl_statsStart		uint64_t	monotonic time the work started, in nanoseconds
+* gl_phaseCalls		uint64_t	calls timed in each phase
+* gl_phaseNanos		uint64_t	nanoseconds spent in each phase
+* gl_statFiles		uint64_t	regular files archived or restored
+* gl_statDirs		uint64_t	directories archived or restored
+* gl_statLinks		uint64_t	hard links archived or restored
+* gl_statSkipped	uint64_t	files left out by -t, -g, -a, -e or -x
+* gl_statFailed		uint64_t	files that couldn't be read
+* gl_dataBytes		uint64_t	bytes of file data archived or restored
+* gl_totalBytes		uint64_t	bytes of file data known about so far, for the ETA
+* gl_archiveBytes	uint64_t	size of the archive written or read
+* gl_latency		uint64_t	histogram of per-file latency
+* gl_slow			SlowFile	slowest files, slowest first
+* gl_slowLock		mutex		protects gl_slow
+* gl_progressThread	pthread_t	thread printing the progress line
+* gl_progressStop	int			tells the progress thread to finish
+* gl_progressLock	mutex		protects gl_progressStop
+* gl_progressWake	cond		signalled to stop the progress thread without waiting out its second
+*/
+int					gl_quiet;
+int					gl_progress;
+char				*gl_statsPath;
+uint64_t			gl_statsStart;
+_Atomic uint64_t	gl_phaseCalls[PHASES];
+_Atomic uint64_t	gl_phaseNanos[PHASES];
+_Atomic uint64_t	gl_statFiles;
+_Atomic uint64_t	gl_statDirs;
+_Atomic uint64_t	gl_statLinks;
+_Atomic uint64_t	gl_statSkipped;
+_Atomic uint64_t	gl_statFailed;
+_Atomic uint64_t	gl_dataBytes;
+_Atomic uint64_t	gl_totalBytes;
+_Atomic uint64_t	gl_archiveBytes;
+_Atomic uint64_t	gl_latency[LATENCY_BUCKETS];
+SlowFile			gl_slow[SLOW_FILES];
+pthread_mutex_t		gl_slowLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_t			gl_progressThread;
+int					gl_progressStop;
+pthread_mutex_t		gl_progressLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t		gl_progressWake = PTHREAD_COND_INITIALIZER;
+
+/*	statsClock  -  returns uint64_t
+* Monotonic time in nanoseconds.
+*/
+uint64_t statsClock(){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*	statsTimer  -  returns uint64_t
+* Start time of a call to be passed to statsAdd() or statsFile(). Only --stats reports the phase times and
+* latencies, without it this is 0 and no clock is read.
+*/
+uint64_t statsTimer(){
+	return gl_statsPath ? statsClock() : 0;
+}
+
+/*	statsAdd  -  returns void
+* Counts one call in 'phase' that started at 'start'. Does nothing without --stats.
+*/
+void statsAdd(int phase, uint64_t start){
+	if (!gl_statsPath){
+		return;
+	}
+	gl_phaseCalls[phase]++;
+	gl_phaseNanos[phase] += statsClock() - start;
+}
+
+/*	statsFile  -  returns void
+* Records how long one file took, from 'start' until now, in the latency histogram and, if it is one of the
+* slowest so far, in 'gl_slow'. Does nothing without --stats.
+*/
+void statsFile(const char *path, uint64_t start){
+	if (!gl_statsPath){
+		return;
+	}
+	uint64_t nanos = statsClock() - start;
+	uint64_t micros = nanos / 1000;
+	int bucket = micros ? 63 - __builtin_clzll(micros) : 0;
+	gl_latency[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1]++;
+
+	if (nanos <= gl_slow[SLOW_FILES - 1].nanos){				//racy first look, most files stop here
+		return;
+	}
+	pthread_mutex_lock(&gl_slowLock);
+	int i = SLOW_FILES - 1;
+	if (nanos > gl_slow[i].nanos){
+		free(gl_slow[i].path);
+		for (; i > 0 && nanos > gl_slow[i - 1].nanos; i--){
+			gl_slow[i] = gl_slow[i - 1];
+		}
+		gl_slow[i].nanos = nanos;
+		gl_slow[i].path = strdup(path);
+	}
+	pthread_mutex_unlock(&gl_slowLock);
+}
+
+/*	progressWorker  -  returns void*
+* Progress thread body, rewrites one line on stderr every second with files done, throughput and, once there
+* is a total to go by, an estimate of the time left.
+*/
+void *progressWorker(void *arg){
+	pthread_mutex_lock(&gl_progressLock);
+	for (;;){
+		struct timespec wake;
+		clock_gettime(CLOCK_REALTIME, &wake);
+		wake.tv_sec++;
+		while (!gl_progressStop && pthread_cond_timedwait(&gl_progressWake, &gl_progressLock, &wake) == 0);
+		if (gl_progressStop){
+			break;
+		}
+		double seconds = (statsClock() - gl_statsStart) / 1e9;
+		double done = gl_dataBytes, total = gl_totalBytes;
+		double rate = done / seconds;
+		fprintf(stderr, "\r  %llu files  %llu dirs  %.1f MiB  %.1f MiB/s",
+			(unsigned long long)gl_statFiles, (unsigned long long)gl_statDirs, done / (1 << 20), rate / (1 << 20));
+		if (total > done && rate > 0){
+			int left = (total - done) / rate;
+			fprintf(stderr, "  ETA %d:%02d:%02d  ", left / 3600, left / 60 % 60, left % 60);
+		}
+		else {
+			fprintf(stderr, "                ");
+		}
+	}
+	pthread_mutex_unlock(&gl_progressLock);
+	fprintf(stderr, "\n");
+	return NULL;
+}
+
+/*	statsStart  -  returns void
+* Starts the clock, and the progress line if -P was given.
+*/
+void statsStart(){
+	gl_statsStart = statsClock();
+	if (gl_progress && pthread_create(&gl_progressThread, NULL, progressWorker, NULL) != 0){
+		perror("pthread_create");
+		gl_progress = 0;
+	}
+}
+
+/*	jsonString  -  returns void
+* Writes 's' as a quoted JSON string.
+*/
+void jsonString(FILE *out, const char *s){
+	fputc('"', out);
+	for (; *s; s++){
+		if (*s == '"' || *s == '\\'){
+			fprintf(out, "\\%c", *s);
+		}
+		else if ((unsigned char)*s < 0x20){
+			fprintf(out, "\\u%04x", *s);
+		}
+		else {
+			fputc(*s, out);
+		}
+	}
+	fputc('"', out);
+}
+
+/*	statsFinish  -  returns void
+* Stops the progress line and, with --stats, writes the JSON summary of the run.
+*
+* mode		char		"backup" or "restore"
+*/
+void statsFinish(const char *mode){
+	if (gl_progress){
+		pthread_mutex_lock(&gl_progressLock);
+		gl_progressStop = 1;
+		pthread_cond_signal(&gl_progressWake);
+		pthread_mutex_unlock(&gl_progressLock);
+		pthread_join(gl_progressThread, NULL);
+	}
+	if (!gl_statsPath){
+		return;
+	}
+	FILE *out = strcmp(gl_statsPath, "-") == 0 ? stderr : fopen(gl_statsPath, "w");
+	if (!out){
+		perror("fopen --stats");
+		printf("%s\n", gl_statsPath);
+		return;
+	}
+	static const char *phaseNames[PHASES] = { "walk", "stat", "open", "read", "write", "header", "metadata",
+		"hash" };
+	fprintf(out, "{\"mode\": \"%s\", \"seconds\": %.6f, ", mode, (statsClock() - gl_statsStart) / 1e9);
+	fprintf(out, "\"files\": %llu, \"directories\": %llu, \"links\": %llu, \"skipped\": %llu, \"failed\": %llu, ",
+		(unsigned long long)gl_statFiles, (unsigned long long)gl_statDirs, (unsigned long long)gl_statLinks,
+		(unsigned long long)gl_statSkipped, (unsigned long long)gl_statFailed);
+	fprintf(out, "\"data_bytes\": %llu, \"archive_bytes\": %llu, \"phases\": {",
+		(unsigned long long)gl_dataBytes, (unsigned long long)gl_archiveBytes);
+	for (int i = 0; i < PHASES; i++){
+		fprintf(out, "%s\"%s\": {\"calls\": %llu, \"seconds\": %.6f}", i ? ", " : "", phaseNames[i],
+			(unsigned long long)gl_phaseCalls[i], gl_phaseNanos[i] / 1e9);
+	}
+	fprintf(out, "}, \"latency_log2_us\": [");
+	for (int i = 0; i < LATENCY_BUCKETS; i++){
+		fprintf(out, "%s%llu", i ? ", " : "", (unsigned long long)gl_latency[i]);
+	}
+	fprintf(out, "], \"slowest\": [");
+	for (int i = 0; i < SLOW_FILES && gl_slow[i].path; i++){
+		fprintf(out, "%s{\"path\": ", i ? ", " : "");
+		jsonString(out, gl_slow[i].path);
+		fprintf(out, ", \"seconds\": %.6f}", gl_slow[i].nanos / 1e9);
+	}
+	fprintf(out, "]}\n");
+	if (out != stderr){
+		fclose(out);
+	}
+}
+
+/*	writeAll  -  returns void
+* write() that keeps going after partial writes and interrupts. Any other failure is fatal, the archive would
+* be missing data.
+*/
+void writeAll(int fd, const char *data, size_t length){
+	uint64_t start = statsTimer();
+	while (length > 0){
+		ssize_t done = write(fd, data, length);
+		if (done == -1){
+			if (errno == EINTR){
+				continue;
+			}
+			perror("write");
+			exit(EXIT_FAILURE);
+		}
+		data += done;
+		length -= done;
+	}
+	statsAdd(PHASE_WRITE, start);
+}
+
+/*	Cache Globals
+* With -n the archive is written with O_DIRECT, through a staging buffer so every write is whole aligned
+* blocks, and files are dropped from the page cache once they have been read or restored. Where the archive
+* can't take O_DIRECT (tmpfs, a pipe) it is written normally and dropped behind as it goes instead. The
+* staging and drop-behind state is kept in each Writer.
+*
+* gl_noCache		int			set by -n
+*/
+int		gl_noCache;
+
+/*	archiveStart  -  returns void
+* Sets up -n for an archive. O_DIRECT is only kept if the file system accepts it, and isn't tried on a pipe,
+* where it would turn on packet mode instead.
+*/
+void archiveStart(Writer *w){
+	void *stage;
+	if (posix_memalign(&stage, DIRECT_ALIGN, WRITE_BUFFER) != 0){
+		perror("posix_memalign");
+		exit(EXIT_FAILURE);
+	}
+	w->stage = stage;
+	struct stat sb;
+	int flags = fcntl(w->fd, F_GETFL);
+	w->direct = flags != -1 && fstat(w->fd, &sb) == 0 && S_ISREG(sb.st_mode) &&
+		fcntl(w->fd, F_SETFL, flags | O_DIRECT) == 0;
+}
+
+/*	directOff  -  returns void
+* Goes back to ordinary writes for the rest of the archive.
+*/
+void directOff(Writer *w){
+	int flags = fcntl(w->fd, F_GETFL);
+	if (flags != -1){
+		fcntl(w->fd, F_SETFL, flags & ~O_DIRECT);
+	}
+	w->direct = 0;
+}
+
+/*	dropBehind  -  returns void
+* Starts writeback of what has been written since the last call and drops the part before that, whose
+* writeback had a whole DROP_BEHIND to finish, from the page cache. Errors are ignored, on a pipe or a tape
+* there is nothing to drop.
+*/
+void dropBehind(Writer *w){
+	sync_file_range(w->fd, w->flushed, w->written - w->flushed, SYNC_FILE_RANGE_WRITE);
+	if (w->flushed > w->dropped){
+		sync_file_range(w->fd, w->dropped, w->flushed - w->dropped,
+			SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+		posix_fadvise(w->fd, w->dropped, w->flushed - w->dropped, POSIX_FADV_DONTNEED);
+		w->dropped = w->flushed;
+	}
+	w->flushed = w->written;
+}
+
+/*	directWrite  -  returns void
+* One O_DIRECT write of whole aligned blocks. If the file system turns it down after all the archive goes
+* back to ordinary writes, starting with these bytes.
+*/
+void directWrite(Writer *w, const char *data, size_t length){
+	uint64_t start = statsTimer();
+	ssize_t done;
+	while ((done = write(w->fd, data, length)) == -1 && errno == EINTR){
+	}
+	if (done == (ssize_t)length){
+		statsAdd(PHASE_WRITE, start);
+		return;
+	}
+	if (done == -1 && errno != EINVAL){
+		perror("write");
+		exit(EXIT_FAILURE);
+	}
+	if (done > 0){
+		data += done;
+		length -= done;
+	}
+	directOff(w);
+	writeAll(w->fd, data, length);
+}
+
+/*	archiveWrite  -  returns void
+* Every write to an archive goes through here. Without -n it is just writeAll(). With O_DIRECT, aligned
+* data with nothing staged ahead of it is written where it is and everything else is copied into the stage
+* until there is a full buffer of it. Otherwise the archive is dropped from the page cache behind the writes.
+*/
+void archiveWrite(Writer *w, const char *data, size_t length){
+	if (!gl_noCache){
+		writeAll(w->fd, data, length);
+		return;
+	}
+	w->written += length;
+	while (length > 0 && w->direct){
+		if (w->staged == 0 && (uintptr_t)data % DIRECT_ALIGN == 0 && length >= DIRECT_ALIGN){
+			size_t whole = length & ~(size_t)(DIRECT_ALIGN - 1);
+			directWrite(w, data, whole);
+			data += whole;
+			length -= whole;
+			continue;
+		}
+		size_t part = length < WRITE_BUFFER - w->staged ? length : WRITE_BUFFER - w->staged;
+		memcpy(w->stage + w->staged, data, part);
+		w->staged += part;
+		data += part;
+		length -= part;
+		if (w->staged == WRITE_BUFFER){
+			w->staged = 0;
+			directWrite(w, w->stage, WRITE_BUFFER);
+		}
+	}
+	if (length > 0){
+		if (w->staged > 0){									//O_DIRECT was just given up on
+			writeAll(w->fd, w->stage, w->staged);
+			w->staged = 0;
+		}
+		writeAll(w->fd, data, length);
+	}
+	if (!w->direct && w->written - w->flushed >= DROP_BEHIND){
+		dropBehind(w);
+	}
+}
+
+/*	archiveFinish  -  returns void
+* Writes whatever is still staged, which isn't a whole block so can't go out with O_DIRECT, makes sure the
+* archive is on disk and drops the last of it from the page cache.
+*/
+void archiveFinish(Writer *w){
+	if (!gl_noCache){
+		return;
+	}
+	if (w->direct){
+		directOff(w);
+	}
+	writeAll(w->fd, w->stage, w->staged);
+	w->staged = 0;
+	if (fdatasync(w->fd) == 0){
+		posix_fadvise(w->fd, 0, 0, POSIX_FADV_DONTNEED);
+	}
+	free(w->stage);
+}
+
+/*	dropFile  -  returns void
+* With -n, drops a file that has just been read or restored from the page cache. A file that was written
+* has to be written back first, or its dirty pages would stay.
+*
+* fd		int			the file
+* written	int			set if the file was written to
+*/
+void dropFile(int fd, int written){
+	if (!gl_noCache){
+		return;
+	}
+	if (written){
+		sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+			SYNC_FILE_RANGE_WAIT_AFTER);
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+/*	Struct CompressFrame  -typedef-  Frame
+* One FRAME_SIZE piece of the tar stream on its way through the compression threads. Each frame becomes a
+* complete gzip member on its own, so the archive is still an ordinary .tar.gz, and its header carries a 'TF'
+* extra field holding the compressed and uncompressed sizes so restore can hop from frame to frame.
+*/
+typedef struct CompressFrame{
+	char *data;						//uncompressed, owned by the frame once submitted
+	size_t length;
+	char *out;						//the finished gzip member
+	size_t outLength;
+	int ready;
+}
+Frame;
+
+/*	Compression Globals
+* Each writer has its own ring of frames in flight, the compression threads serve all of them.
+*
+* gl_compress		int			set by -z, compress the archive in frames
+* gl_frameThreads	pthread_t	the compression threads
+* gl_frameLock		mutex		protects every writer's frame counters and each frame's 'ready' flag
+* gl_frameWork		cond		signalled when a frame is submitted or compression is finishing
+* gl_frameDone		cond		signalled when a frame has been compressed
+* gl_frameStop		int			set when there will be no more frames
+*/
+int				gl_compress;
+pthread_t		*gl_frameThreads;
+pthread_mutex_t	gl_frameLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t	gl_frameWork = PTHREAD_COND_INITIALIZER;
+pthread_cond_t	gl_frameDone = PTHREAD_COND_INITIALIZER;
+int				gl_frameStop;
+
+/*	putLE32  -  returns void
+* Stores 'value' little endian, the byte order gzip uses for every field.
+*/
+void putLE32(unsigned char *at, uint32_t value){
+	at[0] = value;
+	at[1] = value >> 8;
+	at[2] = value >> 16;
+	at[3] = value >> 24;
+}
+
+/*	compressFrame  -  returns void
+* Turns a frame's data into a gzip member with the 'TF' extra field filled in.
+*/
+void compressFrame(Frame *frame){
+	z_stream zs;
+	memset(&zs, 0, sizeof(z_stream));
+	if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK){
+		printf("deflateInit2: %s\n", zs.msg ? zs.msg : "failed");
+		exit(EXIT_FAILURE);
+	}
+	size_t bound = FRAME_HEADER + deflateBound(&zs, frame->length) + 8;
+	unsigned char *out;
+	if (!(out = malloc(bound))){
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	static const unsigned char header[FRAME_HEADER - 8] = {
+		0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 3,			//gzip, deflate, FEXTRA, no mtime, unix
+		12, 0, 'T', 'F', 8, 0						//12 bytes of extras, subfield 'TF' of 8 bytes
+	};
+	memcpy(out, header, sizeof(header));
+
+	zs.next_in = (unsigned char *)frame->data;
+	zs.avail_in = frame->length;
+	zs.next_out = out + FRAME_HEADER;
+	zs.avail_out = bound - FRAME_HEADER - 8;
+	if (deflate(&zs, Z_FINISH) != Z_STREAM_END){
+		printf("deflate: %s\n", zs.msg ? zs.msg : "failed");
+		exit(EXIT_FAILURE);
+	}
+	size_t length = FRAME_HEADER + zs.total_out + 8;
+	deflateEnd(&zs);
+
+	putLE32(out + FRAME_HEADER - 8, length);						//TF: size of this gzip member
+	putLE32(out + FRAME_HEADER - 4, frame->length);					//TF: size of the data in it
+	putLE32(out + length - 8, crc32(0, (unsigned char *)frame->data, frame->length));
+	putLE32(out + length - 4, frame->length);
+	frame->out = (char *)out;
+	frame->outLength = length;
+}
+
+/*	frameClaimable  -  returns Writer*
+* The first writer with a submitted frame no compression thread has taken yet, or NULL. Must be called with
+* 'gl_frameLock' held.
+*/
+Writer *frameClaimable(){
+	for (int i = 0; i < gl_nout; i++){
+		if (gl_out[i].frameClaimed < gl_out[i].frameSubmitted){
+			return &gl_out[i];
+		}
+	}
+	return NULL;
+}
+
+/*	frameWorker  -  returns void*
+* Compression thread body, compresses submitted frames in whatever order they can be claimed.
+*/
+void *frameWorker(void *arg){
+	Writer *w;
+	pthread_mutex_lock(&gl_frameLock);
+	for (;;){
+		while (!(w = frameClaimable()) && !gl_frameStop){
+			pthread_cond_wait(&gl_frameWork, &gl_frameLock);
+		}
+		if (!w){
+			break;
+		}
+		Frame *frame = &w->frames[w->frameClaimed++ % w->frameSlots];
+		pthread_mutex_unlock(&gl_frameLock);
+		compressFrame(frame);
+		pthread_mutex_lock(&gl_frameLock);
+		frame->ready = 1;
+		pthread_cond_broadcast(&gl_frameDone);
+	}
+	pthread_mutex_unlock(&gl_frameLock);
+	return NULL;
+}
+
+/*	frameWrite  -  returns void
+* Writes compressed frames to the archive in order. Must be called with 'gl_frameLock' held. Writes every
+* frame that is ready at the front of the ring, and when 'wait' is set also waits for the frames that
+* aren't, until 'wait' frames or fewer are still in flight.
+*
+* w			Writer		the archive
+* wait		size_t		most frames to leave in flight, or SIZE_MAX to only write what's ready
+*/
+void frameWrite(Writer *w, size_t wait){
+	while (w->frameWritten < w->frameSubmitted){
+		Frame *frame = &w->frames[w->frameWritten % w->frameSlots];
+		if (!frame->ready){
+			if (wait == SIZE_MAX || w->frameSubmitted - w->frameWritten <= wait){
+				return;
+			}
+			pthread_cond_wait(&gl_frameDone, &gl_frameLock);
+			continue;
+		}
+		pthread_mutex_unlock(&gl_frameLock);
+		archiveWrite(w, frame->out, frame->outLength);
+		free(frame->out);
+		free(frame->data);
+		pthread_mutex_lock(&gl_frameLock);
+		frame->ready = 0;
+		w->frameWritten++;
+	}
+}
+
+/*	frameSubmit  -  returns void
+* Hands the writer's full buffer to the compression threads and gives the writer a fresh one. Waits if
+* every slot in the ring is in use.
+*/
+void frameSubmit(Writer *w){
+	pthread_mutex_lock(&gl_frameLock);
+	frameWrite(w, w->frameSlots - 1);							//make room for this frame
+	Frame *frame = &w->frames[w->frameSubmitted % w->frameSlots];
+	frame->data = w->buffer;
+	frame->length = w->used;
+	w->frameSubmitted++;
+	pthread_cond_signal(&gl_frameWork);
+	frameWrite(w, SIZE_MAX);									//and write out anything finished
+	pthread_mutex_unlock(&gl_frameLock);
+
+	void *buffer;
+	if (posix_memalign(&buffer, DIRECT_ALIGN, WRITE_BUFFER) != 0){
+		perror("posix_memalign");
+		exit(EXIT_FAILURE);
+	}
+	w->buffer = buffer;
+	w->used = 0;
+}
+
+/*	frameStart  -  returns void
+* Gives every writer its ring of frames and starts 'threads' compression threads.
+*/
+void frameStart(int threads){
+	for (int i = 0; i < gl_nout; i++){
+		gl_out[i].frameSlots = 2 * threads + 2;
+		if (!(gl_out[i].frames = calloc(gl_out[i].frameSlots, sizeof(Frame)))){
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (!(gl_frameThreads = malloc(threads * sizeof(pthread_t)))){
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < threads; i++){
+		if (pthread_create(&gl_frameThreads[i], NULL, frameWorker, NULL) != 0){
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+/*	frameDrain  -  returns void
+* Writes out every frame of 'w's still in flight.
+*/
+void frameDrain(Writer *w){
+	pthread_mutex_lock(&gl_frameLock);
+	frameWrite(w, 0);
+	pthread_mutex_unlock(&gl_frameLock);
+	free(w->frames);
+}
+
+/*	frameFinish  -  returns void
+* Stops the compression threads, once every writer has drained its frames.
+*/
+void frameFinish(int threads){
+	pthread_mutex_lock(&gl_frameLock);
+	gl_frameStop = 1;
+	pthread_cond_broadcast(&gl_frameWork);
+	pthread_mutex_unlock(&gl_frameLock);
+	for (int i = 0; i < threads; i++){
+		pthread_join(gl_frameThreads[i], NULL);
+	}
+	free(gl_frameThreads);
+}
+
+/*	writerFlush  -  returns void
+* Writes out anything waiting in the writer's buffer, or with -z passes it on to be compressed as a frame.
+*/
+void writerFlush(Writer *w){
+	if (gl_compress){
+		if (w->used > 0){
+			frameSubmit(w);
+		}
+		return;
+	}
+	archiveWrite(w, w->buffer, w->used);
+	w->used = 0;
+}
+
+/*	writerPut  -  returns void
+* Adds 'length' bytes to the archive. Small writes are buffered, big ones go straight to the file. With -z
+* everything is buffered, a full buffer is one frame.
+*
+* w			Writer		archive to write to
+* data		void		bytes to write
+* length	size_t		number of bytes
+*/
+void writerPut(Writer *w, const void *data, size_t length){
+	w->offset += length;
+	if (length >= WRITE_BUFFER / 2 && !gl_compress){
+		writerFlush(w);
+		archiveWrite(w, data, length);
+		return;
+	}
+	while (length > 0){
+		size_t part = length < WRITE_BUFFER - w->used ? length : WRITE_BUFFER - w->used;
+		memcpy(w->buffer + w->used, data, part);
+		w->used += part;
+		data = (const char *)data + part;
+		length -= part;
+		if (w->used == WRITE_BUFFER){
+			writerFlush(w);
+		}
+	}
+}
+
+/*	copyData  -  returns off_t
+* Copies up to 'length' bytes from 'in' to 'out' without bringing them into user space where the kernel
+* allows it: copy_file_range() between two regular files, splice() when either end is a pipe, sendfile()
+* otherwise. If the kernel refuses (old kernel, different filesystems, unsupported file types) it falls back
+* to read()/write() through a large buffer. Returns the number of bytes copied, which is short if 'in'
+* ended early or a read failed. Write failures are fatal.
+*
+* in		int			descriptor to copy from
+* inOffset	off_t		position to read 'in' from, updated as data is copied. NULL to use the file offset
+* out		int			descriptor to copy to, always at its current file offset
+* length	off_t		number of bytes to copy
+*/
+off_t copyData(int in, off_t *inOffset, int out, off_t length){
+	struct stat inStat, outStat;
+	if (fstat(in, &inStat) == -1 || fstat(out, &outStat) == -1){
+		perror("fstat");
+		exit(EXIT_FAILURE);
+	}
+	int method;											//0 copy_file_range, 1 splice, 2 sendfile
+	if (S_ISREG(inStat.st_mode) && S_ISREG(outStat.st_mode)){
+		method = 0;
+	}
+	else if (S_ISFIFO(inStat.st_mode) || S_ISFIFO(outStat.st_mode)){
+		method = 1;
+	}
+	else {
+		method = 2;
+	}
+	if (S_ISFIFO(inStat.st_mode) && inOffset){			//pipes can't be read at an offset
+		method = 3;
+	}
+
+	off_t total = 0;
+	while (total < length && method < 3){
+		size_t want = length - total > (1 << 30) ? (1 << 30) : length - total;
+		ssize_t done;
+		uint64_t start = statsTimer();
+		if (method == 0){
+			done = copy_file_range(in, inOffset, out, NULL, want, 0);
+		}
+		else if (method == 1){
+			done = splice(in, S_ISFIFO(inStat.st_mode) ? NULL : inOffset, out, NULL, want, SPLICE_F_MOVE);
+		}
+		else {
+			done = sendfile(out, in, inOffset, want);
+		}
+		statsAdd(PHASE_WRITE, start);
+		if (done == -1 && errno == EINTR){
+			continue;
+		}
+		if (done == -1 && total == 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS ||
+										 errno == EOPNOTSUPP || errno == EBADF)){
+			method++;										//this method isn't supported here,
+			continue;										//try the next one
+		}
+		if (done == -1){
+			perror("copyData");
+			exit(EXIT_FAILURE);
+		}
+		if (done == 0){
+			return total;									//'in' ended early
+		}
+		total += done;
+	}
+
+	char *buffer = NULL;
+	if (total < length && !(buffer = malloc(COPY_BUFFER))){
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	while (total < length){
+		size_t want = length - total > COPY_BUFFER ? COPY_BUFFER : length - total;
+		uint64_t start = statsTimer();
+		ssize_t got = inOffset ? pread(in, buffer, want, *inOffset) : read(in, buffer, want);
+		statsAdd(PHASE_READ, start);
+		if (got == -1 && errno == EINTR){
+			continue;
+		}
+		if (got <= 0){
+			if (got == -1){
+				perror("read");
+			}
+			break;
+		}
+		writeAll(out, buffer, got);
+		if (inOffset){
+			*inOffset += got;
+		}
+		total += got;
+	}
+	free(buffer);
+	return total;
+}
+
+/*	writerPad  -  returns void
+* Pads the archive by 'amount' with null chars. Used for the two empty blocks that end a tar file.
+*/
+void writerPad(Writer *w, size_t amount){
+	static const char zeros[BLOCK_SIZE];
+	while (amount > 0){
+		size_t length = amount < BLOCK_SIZE ? amount : BLOCK_SIZE;
+		writerPut(w, zeros, length);
+		amount -= length;
+	}
+}
+
+/*	Checksum Globals
+* With -c every member with data gets a CRC32C of its data as archived, in a pax extended header just before
+* its own header and in the index. The header has to go out before the data, so a file bigger than one chunk
+* is hashed in a pass of its own before it is read for the archive, the second read mostly coming from the
+* page cache.
+*
+* gl_checksum		int			set by -c
+*/
+int		gl_checksum;
+
+/*	Struct IndexHead  -typedef-  IndexHead
+* Start of the '<archive>.idx' file that backup writes next to every archive. It is followed by 'count'
+* Records sorted by name and then the table of names they point into. 'archiveSize' lets restore notice an
+* index that doesn't belong to the archive next to it.
+*/
+typedef struct IndexHead{
+	char magic[8];					//"TARIDX1"
+	uint64_t count;
+	uint64_t archiveSize;
+	uint64_t namesSize;
+}
+IndexHead;
+
+/*	Struct IndexRecord  -typedef-  Record
+* One member in the index.
+*/
+typedef struct IndexRecord{
+	uint64_t offset;				//archive offset of the member's header
+	uint64_t size;
+	int64_t mtime;
+	uint32_t mode;
+	uint32_t name;					//offset of the name in the name table
+	uint16_t nameLength;			//not including a terminating null, which is stored as well
+	char type;
+	char hashed;					//'crc' was recorded, archives written with -c
+	uint32_t crc;					//CRC32C of the member's data, in what used to be padding
+}
+Record;
+
+/*	indexAdd  -  returns void
+* Records a member the writer has just written the header for. Only ever called by that archive's writer
+* thread.
+*
+* w			Writer		the archive
+* member	Member		the member, its header and the size, mode and time it was archived with
+* offset	off_t		archive offset the header was written at
+*/
+void indexAdd(Writer *w, const Member *member, off_t offset){
+	const Header *header = &member->header;
+	const char *name = member->sparseSize ? member->path + gl_pathOffset : header->name;	//not the
+	size_t length = strnlen(name, sizeof(header->name));								//GNUSparseFile one
+	if (w->nrecords == w->recordsCapacity){
+		w->recordsCapacity = w->recordsCapacity ? w->recordsCapacity * 2 : 1024;
+		if (!(w->records = realloc(w->records, w->recordsCapacity * sizeof(Record)))){
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+	while (w->namesSize + length + 1 > w->namesCapacity){
+		w->namesCapacity = w->namesCapacity ? w->namesCapacity * 2 : 65536;
+		if (!(w->names = realloc(w->names, w->namesCapacity))){
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	Record *record = &w->records[w->nrecords++];
+	memset(record, 0, sizeof(Record));
+	record->offset = offset;
+	record->size = member->size;
+	record->mtime = member->mtime;
+	record->mode = member->mode;
+	record->type = member->whiteout ? 'W' : member->sparseSize ? 'S' : header->type[0];
+	record->hashed = gl_checksum && !member->headerOnly;
+	record->crc = member->crc;
+	record->name = w->namesSize;
+	record->nameLength = length;
+	memcpy(w->names + w->namesSize, name, length);
+	w->names[w->namesSize + length] = '\0';
+	w->namesSize += length + 1;
+}
+
+/*	compareRecords  -  returns int
+* qsort_r comparator, orders index records by name and a name archived more than once by offset. 'names' is
+* the name table they point into.
+*/
+int compareRecords(const void *a, const void *b, void *names){
+	const Record *x = a, *y = b;
+	int order = strcmp((const char *)names + x->name, (const char *)names + y->name);
+	return order ? order : (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+/*	dropRecords  -  returns void
+* Keeps only the last record of each name in the sorted records, an archive appended to with -a can hold
+* earlier copies of a name that are no longer current. The name table is rebuilt if anything was dropped.
+*/
+void dropRecords(Writer *w){
+	size_t kept = 0;
+	for (size_t i = 0; i < w->nrecords; i++){
+		if (i + 1 < w->nrecords && strcmp(w->names + w->records[i].name, w->names + w->records[i + 1].name) == 0){
+			continue;										//a later copy follows
+		}
+		w->records[kept++] = w->records[i];
+	}
+	if (kept == w->nrecords){
+		return;
+	}
+	w->nrecords = kept;
+	char *names;
+	if (!(names = malloc(w->namesCapacity))){
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	w->namesSize = 0;
+	for (size_t i = 0; i < kept; i++){
+		Record *record = &w->records[i];
+		memcpy(names + w->namesSize, w->names + record->name, record->nameLength + 1);
+		record->name = w->namesSize;
+		w->namesSize += record->nameLength + 1;
+	}
+	free(w->names);
+	w->names = names;
+}
+
+/*	indexWrite  -  returns int
+* Sorts the collected records by name and writes them to '<archive>.idx', through a temporary file so that
+* a short write or a crash never leaves a partial index where restore would trust it. Returns 0 on success,
+* -1 if the index couldn't be written, which leaves the archive usable but without an index.
+*
+* w				Writer		the archive the index belongs to
+* archiveSize	off_t		final size of the archive
+*/
+int indexWrite(Writer *w, off_t archiveSize){
+	char path[PATH_MAX], temp[PATH_MAX];
+	if (snprintf(path, PATH_MAX, "%s.idx", w->path) >= PATH_MAX ||
+		snprintf(temp, PATH_MAX, "%s.idx.tmp", w->path) >= PATH_MAX){
+		return -1;
+	}
+	qsort_r(w->records, w->nrecords, sizeof(Record), compareRecords, w->names);
+	dropRecords(w);
+
+	IndexHead head;
+	memset(&head, 0, sizeof(IndexHead));
+	memcpy(head.magic, "TARIDX1", 8);
+	head.count = w->nrecords;
+	head.archiveSize = archiveSize;
+	head.namesSize = w->namesSize;
+
+	FILE *file;
+	if (!(file = fopen(temp, "wb"))){
+		perror("fopen index");
+		return -1;
+	}
+	int failed = fwrite(&head, sizeof(IndexHead), 1, file) != 1 ||
+		fwrite(w->records, sizeof(Record), w->nrecords, file) != w->nrecords ||
+		fwrite(w->names, 1, w->namesSize, file) != w->namesSize;
+	if (fclose(file) == EOF || failed || rename(temp, path) == -1){
+		perror("index");
+		remove(temp);
+		return -1;
+	}
+	return 0;
+}
+
+/*	Append Globals
+* With -a the archive isn't rewritten. What it already holds is read from its index, or from its headers if it
+* has none, new and changed files are written over the end blocks and a new end and index follow them, so the
+* archive is only read and written in proportion to what has changed.
+*
+* gl_append			int			set by -a
+* gl_appendIndex	IndexHead	the members already in the archive, records sorted by name as in an index
+* 								file, NULL when there is nothing to append to
+* gl_appendEnd		off_t		offset of the end blocks the new members are written over
+*/
+int				gl_append;
+const IndexHead	*gl_appendIndex;
+off_t			gl_appendEnd;
+
+/*	appendSeed  -  returns void
+* Starts a writer off at the end of the archive being appended to, with the existing members already in its
+* index.
+*/
+void appendSeed(Writer *w){
+	const Record *records = (const Record *)(gl_appendIndex + 1);
+	w->offset = w->written = w->flushed = w->dropped = gl_appendEnd;
+	w->nrecords = w->recordsCapacity = gl_appendIndex->count;
+	w->namesSize = w->namesCapacity = gl_appendIndex->namesSize;
+	if (!(w->records = malloc((w->recordsCapacity ? w->recordsCapacity : 1) * sizeof(Record))) ||
+		!(w->names = malloc(w->namesCapacity ? w->namesCapacity : 1))){
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(w->records, records, w->nrecords * sizeof(Record));
+	memcpy(w->names, records + w->nrecords, w->namesSize);
+}
+
+/*	appendFind  -  returns const Record*
+* Binary search of the members already in the archive for 'name'. Returns NULL if it isn't there.
+*/
+const Record *appendFind(const char *name){
+	const Record *records = (const Record *)(gl_appendIndex + 1);
+	const char *names = (const char *)(records + gl_appendIndex->count);
+	size_t low = 0, high = gl_appendIndex->count;
+	while (low < high){
+		size_t middle = low + (high - low) / 2;
+		int order = strcmp(names + records[middle].name, name);
+		if (order == 0){
+			return &records[middle];
+		}
+		if (order < 0){
+			low = middle + 1;
+		}
+		else {
+			high = middle;
+		}
+	}
+	return NULL;
+}
+
+/*	appendChanged  -  returns int
+* Returns 1 if 'name' isn't in the archive yet or has changed since it was archived. Only what the header
+* holds can be compared: type, mode, time to the second and size. Chunk lists and sparse files are archived
+* at another size than the file's, for them the time has to do.
+*/
+int appendChanged(const char *name, const struct stat *sb){
+	char member[PATH_MAX + 1];
+	snprintf(member, sizeof(member), S_ISDIR(sb->st_mode) ? "%s/" : "%s", name);	//as named in the archive
+	const Record *old = appendFind(member);
+	if (!old || old->mtime != sb->st_mtime || (old->mode & 07777) != (sb->st_mode & 07777)){
+		return 1;
+	}
+	switch (old->type){
+		case '5':
+			return !S_ISDIR(sb->st_mode);
+		case '1':
+			return sb->st_nlink < 2;						//still linked, to a name just as unchanged
+		case 'C':
+		case 'S':
+			return 0;
+		case '0':
+			return !S_ISREG(sb->st_mode) || old->size != sb->st_size;
+		default:
+			return 1;
+	}
+}
+
+/*	Struct JournalRecord  -typedef-  JournalRecord
+* One checkpoint of a backup in progress. The journal holds two of them, written in turn, so a crash part way
+* through writing one still leaves the one before it. The valid record with the higher sequence is the latest.
+*/
+typedef struct JournalRecord{
+	char magic[8];					//"TARJNL1"
+	uint64_t sequence;
+	uint64_t offset;				//end of the last complete member, the archive is on disk up to here
+	uint32_t crc;					//CRC32C of the record with this field zero
+	uint32_t positionLength;
+	char position[JOURNAL_SLOT - 32];	//that member's name in the archive, without a trailing '/'
+}
+JournalRecord;
+
+/*	Journal Globals
+* A backup to one archive file keeps '<archive>.journal' as it goes, so one that is killed or crashes can be
+* carried on with -r instead of started again. Every JOURNAL_EVERY seconds, once a member is complete, the
+* archive is synced and a record of where that member ends and its name is written. The walk goes in name
+* order, so the name also gives every directory that is finished: the ones that sort before it and aren't
+* above it. The journal is removed once the archive is.
+*
+* gl_journalFd		int				the journal, -1 when there isn't one
+* gl_journalPath	char			its file name
+* gl_journalSequence	uint64_t	sequence of the latest record written
+* gl_journalLast	uint64_t		monotonic time of the last checkpoint
+* gl_journalPending	JournalRecord	-n, a checkpoint whose member is still partly staged for O_DIRECT, written
+* 									at the next checkpoint once it is on disk. 'offset' 0 when there is none
+* gl_resume			int				set by -r
+* gl_resumeAfter	char			-r, name in the record resumed from, NULL otherwise
+*/
+int				gl_journalFd = -1;
+char			gl_journalPath[PATH_MAX];
+uint64_t		gl_journalSequence;
+uint64_t		gl_journalLast;
+JournalRecord	gl_journalPending;
+int				gl_resume;
+char			*gl_resumeAfter;
+
+/*	journalLoad  -  returns int
+* Reads the latest valid record of the journal of the archive 'path' into 'record'. Returns 0 on success, -1
+* if there is no journal or neither record in it is valid.
+*/
+int journalLoad(const char *path, JournalRecord *record){
+	char journal[PATH_MAX];
+	int fd;
+	if (snprintf(journal, PATH_MAX, "%s.journal", path) >= PATH_MAX ||
+		(fd = open(journal, O_RDONLY | O_CLOEXEC)) == -1){
+		return -1;
+	}
+	int found = -1;
+	JournalRecord slot;
+	for (int i = 0; i < 2; i++){
+		if (pread(fd, &slot, sizeof(slot), i * sizeof(slot)) != sizeof(slot)){
+			continue;
+		}
+		uint32_t crc = slot.crc;
+		slot.crc = 0;
+		if (memcmp(slot.magic, "TARJNL1", 8) != 0 || crc32c(0, &slot, sizeof(slot)) != crc ||
+			slot.positionLength >= sizeof(slot.position) || (found == 0 && slot.sequence < record->sequence)){
+			continue;
+		}
+		*record = slot;
+		found = 0;
+	}
+	close(fd);
+	return found;
+}
+
+/*	journalStart  -  returns void
+* Opens the journal of the archive 'path'. A new backup starts it empty, -r keeps the record it is resuming
+* from until there is a newer one. It's dated now so that the walk passes over it, as it does the archive.
+*/
+void journalStart(const char *path){
+	if (snprintf(gl_journalPath, PATH_MAX, "%s.journal", path) >= PATH_MAX ||
+		(gl_journalFd = open(gl_journalPath, O_WRONLY | O_CREAT | O_CLOEXEC | (gl_resume ? 0 : O_TRUNC), 0666)) == -1){
+		perror("open journal");
+		printf("The backup can't be resumed if it's interrupted: %s\n", path);
+		gl_journalFd = -1;
+		return;
+	}
+	futimens(gl_journalFd, NULL);
+	gl_journalLast = statsClock();
+}
+
+/*	journalWrite  -  returns void
+* Syncs the archive up to the record's offset, then writes the record over the older of the two and syncs
+* the journal. If the journal can't be written the backup goes on without it.
+*/
+void journalWrite(Writer *w, JournalRecord *record){
+	if (fdatasync(w->fd) == -1 && errno != EINVAL){				//EINVAL, nothing to sync on this file
+		perror("fdatasync");
+		return;
+	}
+	memcpy(record->magic, "TARJNL1", 8);
+	record->sequence = ++gl_journalSequence;
+	record->crc = 0;
+	record->crc = crc32c(0, record, sizeof(JournalRecord));
+	if (pwrite(gl_journalFd, record, sizeof(JournalRecord), (record->sequence & 1) * sizeof(JournalRecord)) !=
+		sizeof(JournalRecord) || fdatasync(gl_journalFd) == -1){
+		perror("write journal");
+		printf("The backup can't be resumed past this point: %s\n", gl_journalPath);
+		close(gl_journalFd);
+		gl_journalFd = -1;
+	}
+	record->offset = 0;
+}
+
+/*	journalCheckpoint  -  returns void
+* Called by the writer after each complete member, checkpoints it if JOURNAL_EVERY seconds have passed since
+* the last checkpoint. With O_DIRECT the end of the member may still be in the stage, then it's only recorded
+* once a later checkpoint finds it written.
+*
+* w			Writer		the archive
+* member	Member		the member just written
+*/
+void journalCheckpoint(Writer *w, const Member *member){
+	uint64_t now = statsClock();
+	if (now - gl_journalLast < JOURNAL_EVERY * 1000000000ULL){
+		return;
+	}
+	gl_journalLast = now;
+	writerFlush(w);
+	off_t durable = w->offset - w->staged;
+	if (gl_journalPending.offset > 0 && gl_journalPending.offset <= durable){
+		journalWrite(w, &gl_journalPending);
+	}
+	const char *name = member->path + gl_pathOffset;
+	size_t length = strlen(name);
+	if (gl_journalFd == -1 || length >= sizeof(gl_journalPending.position)){
+		return;
+	}
+	memset(&gl_journalPending, 0, sizeof(JournalRecord));
+	gl_journalPending.offset = w->offset;
+	gl_journalPending.positionLength = length;
+	memcpy(gl_journalPending.position, name, length);
+	if (w->offset <= durable){
+		journalWrite(w, &gl_journalPending);
+	}
+}
+
+/*	journalFinish  -  returns void
+* Removes the journal of an archive that is finished, or that failed and has been removed.
+*/
+void journalFinish(){
+	if (gl_journalFd != -1){
+		close(gl_journalFd);
+		remove(gl_journalPath);
+		gl_journalFd = -1;
+	}
+}
+
+/*	resumeOpen  -  returns void
+* Gets ready for -r to carry on with the archive 'path', open on 'fd', from the last record in its journal.
+* Everything after the member the record names is cut off and end blocks are put after it, then the archive is
+* appended to as with -a, which passes over every file already in it. Its index, if there is one, is from an
+* earlier backup to the same file and is removed. Anything that stops it resuming is fatal.
+*/
+void resumeOpen(const char *path, int fd){
+	JournalRecord record;
+	if (journalLoad(path, &record) == -1){
+		printf("No checkpoint to resume from, start the backup again without -r: %s.journal\n", path);
+		exit(EXIT_FAILURE);
+	}
+	struct stat sb;
+	if (fstat(fd, &sb) == -1){
+		perror("fstat -r");
+		exit(EXIT_FAILURE);
+	}
+	if ((uint64_t)sb.st_size < record.offset){
+		printf("The archive is shorter than its journal says, can't resume: %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+	static const char zeros[1024];
+	char index[PATH_MAX];
+	if (ftruncate(fd, record.offset) == -1 || pwrite(fd, zeros, sizeof(zeros), record.offset) != sizeof(zeros)){
+		perror("resume -r");
+		exit(EXIT_FAILURE);
+	}
+	if (snprintf(index, PATH_MAX, "%s.idx", path) < PATH_MAX){
+		remove(index);
+	}
+	gl_journalSequence = record.sequence;
+	if (!(gl_resumeAfter = strndup(record.position, record.positionLength))){
+		perror("strndup");
+		exit(EXIT_FAILURE);
+	}
+	printf("Resuming after %s\n", gl_resumeAfter);
+}
+
+/*	pipeQueue  -  returns void
+* Adds a member to the end of the pipeline, waiting if the writers have fallen PIPE_MEMBERS entries behind.
+* A member that hasn't been given an archive goes to the one with the least data queued so far. Members with
+* data to read are also queued for the readers, in the same order.
+*/
+void pipeQueue(Member *member){
+	pthread_mutex_lock(&gl_pipeLock);
+	while (gl_pipeCount >= PIPE_MEMBERS){
+		pthread_cond_wait(&gl_pipeSpace, &gl_pipeLock);
+	}
+	Writer *w = member->out;
+	if (!w){
+		w = &gl_out[0];
+		for (int i = 1; i < gl_nout; i++){
+			if (gl_out[i].assigned < w->assigned){
+				w = &gl_out[i];
+			}
+		}
+	}
+	member->out = w;
+	w->assigned += member->size;
+	if (w->tail){
+		w->tail->next = member;
+	}
+	else {
+		w->head = member;
+	}
+	w->tail = member;
+	if (!member->headerOnly && !member->direct){
+		if (gl_claimTail){
+			gl_claimTail->nextClaim = member;
+		}
+		else {
+			gl_pipeClaim = member;
+		}
+		gl_claimTail = member;
+		if (member->split){
+			pthread_cond_broadcast(&gl_pipeClaimable);		//a reader for each range
+		}
+		else {
+			pthread_cond_signal(&gl_pipeClaimable);
+		}
+	}
+	gl_pipeCount++;
+	pthread_cond_signal(&w->ready);
+	pthread_mutex_unlock(&gl_pipeLock);
+}
+
+/*	pipeAcquire  -  returns char*
+* Allocates a 512 byte aligned read-ahead buffer once it fits in the memory budget. Only a member at the
+* head of its archive's list may use the last CHUNK_SIZE bytes of the budget, otherwise readers working
+* ahead could take every buffer while the writers wait for their heads' data. Of a split member only the
+* chunk the writer needs next may, the other readers of it are working ahead as well.
+*
+* member	Member		member the buffer is for
+* at		off_t		where the buffer's data goes in the member's data
+* length	size_t		size of the buffer, a multiple of 512 no bigger than CHUNK_SIZE
+*/
+char *pipeAcquire(Member *member, off_t at, size_t length){
+	pthread_mutex_lock(&gl_pipeLock);
+	while (gl_inUse + length > gl_budget -
+		   (member == member->out->head && (!member->split || at == member->taken) ? 0 : CHUNK_SIZE)){
+		pthread_cond_wait(&gl_pipeSpace, &gl_pipeLock);
+	}
+	gl_inUse += length;
+	pthread_mutex_unlock(&gl_pipeLock);
+
+	void *data;
+	if (posix_memalign(&data, BLOCK_SIZE, length) != 0){
+		perror("posix_memalign");
+		exit(EXIT_FAILURE);
+	}
+	return data;
+}
+
+/*	readFull  -  returns size_t
+* read() until 'length' bytes have been read or the file ends. Returns the number of bytes read.
+*/
+size_t readFull(int fd, char *data, size_t length){
+	uint64_t start = statsTimer();
+	size_t total = 0;
+	while (total < length){
+		ssize_t got = read(fd, data + total, length - total);
+		if (got == -1 && errno == EINTR){
+			continue;
+		}
+		if (got <= 0){
+			if (got == -1){
+				perror("read");
+			}
+			break;
+		}
+		total += got;
+	}
+	statsAdd(PHASE_READ, start);
+	return total;
+}
+
+/*	readAt  -  returns size_t
+* readFull() from 'offset' with pread(), for a descriptor several threads read at once. Returns the number
+* of bytes read.
+*/
+size_t readAt(int fd, char *data, size_t length, off_t offset){
+	uint64_t start = statsTimer();
+	size_t total = 0;
+	while (total < length){
+		ssize_t got = pread(fd, data + total, length - total, offset + total);
+		if (got == -1 && errno == EINTR){
+			continue;
+		}
+		if (got <= 0){
+			if (got == -1){
+				perror("read");
+			}
+			break;
+		}
+		total += got;
+	}
+	statsAdd(PHASE_READ, start);
+	return total;
+}
+
+/*	headerOwner  -  returns void
+* Fills in the owner and group of a header, by number and by name, and marks it as a ustar header since the
+* names are ustar fields. Names come from the shared id cache so each id costs one NSS lookup at most.
+*/
+void headerOwner(Header *header, uid_t uid, gid_t gid){
+	numberPut(header->owner, sizeof(header->owner), uid);
+	numberPut(header->group, sizeof(header->group), gid);
+	memcpy(header->magic, "ustar", 6);
+	memcpy(header->version, "00", 2);
+	strncpy(header->ownerName, uidName(uid), sizeof(header->ownerName) - 1);
+	strncpy(header->groupName, gidName(gid), sizeof(header->groupName) - 1);
+}
+
+/*	hashRange  -  returns uint32_t
+* Continues 'crc' over 'length' bytes of the open file 'fd' from 'offset', counting anything past the end of
+* the file as zeros, which is what the readers archive in its place. Reads with pread() so the readers of a
+* split member can hash their ranges of the one descriptor at once.
+*
+* fd		int			the file
+* offset	off_t		where to start
+* length	off_t		how much to hash
+* crc		uint32_t	CRC so far, 0 to start
+*/
+uint32_t hashRange(int fd, off_t offset, off_t length, uint32_t crc){
+	char *buffer = malloc(CHUNK_SIZE);
+	if (!buffer){
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	int ended = 0;
+	while (length > 0){
+		size_t want = length < CHUNK_SIZE ? length : CHUNK_SIZE;
+		size_t got = ended ? 0 : readAt(fd, buffer, want, offset);
+		ended = got < want;
+		offset += want;
+		memset(buffer + got, 0, want - got);
+		uint64_t start = statsTimer();
+		crc = crc32c(crc, buffer, want);
+		statsAdd(PHASE_HASH, start);
+		length -= want;
+	}
+	free(buffer);
+	return crc;
+}
+
+/*	writePax  -  returns void
+* Writes the pax extended header for the member about to be written, if it needs one, a header block of type
+* 'x' named after the member and one block holding the records: the "BACKUP.crc32c" of -c, "BACKUP.whiteout"
+* for a -g whiteout and the GNU.sparse ones of GNU sparse format 1.0 for a file archived with its holes left
+* out. Tar programs that don't know a keyword skip it.
+*/
+void writePax(Writer *w, const Member *member){
+	char block[BLOCK_SIZE] = { 0 }, value[24];
+	size_t length = 0;
+	if (gl_checksum && !member->headerOnly){
+		snprintf(value, sizeof(value), "%08x", member->crc);
+		length += paxRecord(block + length, sizeof(block) - length, "BACKUP.crc32c", value);
+	}
+	if (member->whiteout){
+		length += paxRecord(block + length, sizeof(block) - length, "BACKUP.whiteout", "1");	//what restore
+	}																							//goes by
+	if (member->sparseSize){
+		snprintf(value, sizeof(value), "%jd", (intmax_t)member->sparseSize);
+		length += paxRecord(block + length, sizeof(block) - length, "GNU.sparse.major", "1");
+		length += paxRecord(block + length, sizeof(block) - length, "GNU.sparse.minor", "0");
+		length += paxRecord(block + length, sizeof(block) - length, "GNU.sparse.name", member->path + gl_pathOffset);
+		length += paxRecord(block + length, sizeof(block) - length, "GNU.sparse.realsize", value);
+	}
+	if (length == 0){
+		return;
+	}
+	Header pax = member->header;
+	memset(pax.name, 0, sizeof(pax.name));
+	snprintf(pax.name, sizeof(pax.name), "PaxHeaders/%.88s", member->header.name);
+	memset(pax.link, 0, sizeof(pax.link));
+	octalPut(pax.size, 11, length);
+	pax.type[0] = 'x';
+	headerChecksum(&pax);
+	writerPut(w, &pax, sizeof(Header));
+	writerPut(w, block, sizeof(block));
+}
+
+/*	pipeAppend  -  returns void
+* Hands a filled chunk of 'member's data to the writer. A split member's chunks are kept in order of 'at',
+* there are never more of them waiting than fit in the budget.
+*/
+void pipeAppend(Member *member, Chunk *chunk){
+	pthread_mutex_lock(&gl_pipeLock);
+	if (member->split && member->last && member->last->at > chunk->at){
+		Chunk **before = &member->chunks;
+		while ((*before)->at < chunk->at){
+			before = &(*before)->next;
+		}
+		chunk->next = *before;
+		*before = chunk;
+	}
+	else if (member->last){
+		member->last->next = chunk;
+		member->last = chunk;
+	}
+	else {
+		member->chunks = chunk;
+		member->last = chunk;
+	}
+	pthread_cond_signal(&member->out->ready);
+	pthread_mutex_unlock(&gl_pipeLock);
+}
+
+/*	queueBuffer  -  returns void
+* Queues 'length' bytes from memory as 'member's data, padded out to a whole number of blocks.
+*/
+void queueBuffer(Member *member, const char *data, size_t length){
+	for (size_t at = 0; at < length; at += CHUNK_SIZE){
+		size_t want = length - at < CHUNK_SIZE ? length - at : CHUNK_SIZE;
+		size_t padded = (want + BLOCK_SIZE - 1) & ~(size_t)(BLOCK_SIZE - 1);
+		Chunk *chunk = malloc(sizeof(Chunk));
+		if (!chunk){
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		chunk->data = pipeAcquire(member, at, padded);
+		chunk->length = padded;
+		chunk->next = NULL;
+		memcpy(chunk->data, data + at, want);
+		memset(chunk->data + want, 0, padded - want);		//tar padding
+		pipeAppend(member, chunk);
+	}
+}
+
+/*	Dedup Globals
+* gl_storePath		char		chunk store directory given with -d, NULL when not deduplicating
+* gl_gear			uint64_t	random value for every byte, the rolling hash that finds chunk boundaries
+*/
+char			*gl_storePath;
+uint64_t		gl_gear[256];
+
+/*	storeStart  -  returns int
+* Fills the gear table and makes sure the chunk store and its 256 fan out directories exist. The table comes
+* from a fixed seed, boundaries have to land in the same places every run or nothing would dedup.
+*/
+int storeStart(){
+	uint64_t seed = 0x9e3779b97f4a7c15ULL;
+	for (int i = 0; i < 256; i++){						//splitmix64
+		uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		gl_gear[i] = z ^ (z >> 31);
+	}
+	if (mkdir(gl_storePath, 0777) == -1 && errno != EEXIST){
+		return -1;
+	}
+	char dir[PATH_MAX];
+	for (int i = 0; i < 256; i++){
+		snprintf(dir, sizeof(dir), "%s/%02x", gl_storePath, i);
+		if (mkdir(dir, 0777) == -1 && errno != EEXIST){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*	chunkCut  -  returns size_t
+* Returns the length of the next content defined chunk at the start of 'data'. The gear hash only depends on
+* the last 64 bytes seen so a change in a file moves the boundaries next to it and no others.
+*
+* data		unsigned char	file data
+* length	size_t			bytes of data available, all of the rest of the file if under CDC_MAX
+*/
+size_t chunkCut(const unsigned char *data, size_t length){
+	if (length <= CDC_MIN){
+		return length;
+	}
+	size_t limit = length < CDC_MAX ? length : CDC_MAX;
+	uint64_t hash = 0;
+	for (size_t i = CDC_MIN; i < limit; i++){
+		hash = (hash << 1) + gl_gear[data[i]];
+		if (!(hash & CDC_MASK)){
+			return i + 1;
+		}
+	}
+	return limit;
+}
+
+/*	chunkPath  -  returns void
+* Writes the store path of the chunk named 'hex' into 'path', '{store}/{first 2 digits}/{the other 62}'.
+*/
+void chunkPath(char *path, size_t size, const char *hex){
+	snprintf(path, size, "%s/%.2s/%s", gl_storePath, hex, hex + 2);
+}
+
+/*	storeChunk  -  returns void
+* Hashes one chunk and adds it to the store unless a chunk with that hash is already there. New chunks are
+* written to a temporary name and renamed so a reader, or another backup, never sees half a chunk.
+*
+* data		unsigned char	the chunk
+* length	size_t			its length
+* hex		char			gets the 64 hex digit SHA-256 that names the chunk
+*/
+void storeChunk(const unsigned char *data, size_t length, char *hex){
+	unsigned char digest[32];
+	if (!EVP_Digest(data, length, digest, NULL, EVP_sha256(), NULL)){
+		printf("SHA-256 failed\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < 32; i++){
+		sprintf(hex + 2 * i, "%02x", digest[i]);
+	}
+
+	char path[PATH_MAX], temp[PATH_MAX + 32];
+	chunkPath(path, sizeof(path), hex);
+	if (access(path, F_OK) == 0){
+		return;												//already stored
+	}
+	snprintf(temp, sizeof(temp), "%s.%ld.tmp", path, (long)gettid());
+	int fd;
+	if ((fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0444)) == -1){
+		perror("open chunk");
+		printf("%s\n", temp);
+		exit(EXIT_FAILURE);
+	}
+	writeAll(fd, (const char *)data, length);
+	close(fd);
+	if (rename(temp, path) == -1){
+		perror("rename chunk");
+		printf("%s\n", path);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/*	dedupMember  -  returns void
+* The -d version of readMember(). Cuts the open file 'fd' into content defined chunks, stores any the store
+* hasn't seen and queues the list of chunks as the member's data instead of the file itself. The header
+* isn't final until the list is, so its size, type 'C' and checksum are filled in before the first chunk of
+* the list is handed to the writer. Whatever the file holds when it's read is archived, even if its size has
+* changed since it was stat'd.
+*/
+void dedupMember(Member *member, int fd){
+	unsigned char *buffer = malloc(2 * CDC_MAX);
+	size_t listSize = 64 * CHUNK_LINE, listLength = 0;
+	char *list = malloc(listSize);
+	if (!buffer || !list){
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	size_t have = 0;
+	int ended = 0;
+	while (have > 0 || !ended){
+		if (!ended && have < CDC_MAX){
+			size_t got = readFull(fd, (char *)buffer + have, 2 * CDC_MAX - have);
+			ended = got < 2 * CDC_MAX - have;
+			have += got;
+			continue;
+		}
+		size_t cut = chunkCut(buffer, have);
+		if (listLength + CHUNK_LINE > listSize){
+			listSize *= 2;
+			if (!(list = realloc(list, listSize))){
+				perror("realloc");
+				exit(EXIT_FAILURE);
+			}
+		}
+		char hex[65];
+		storeChunk(buffer, cut, hex);
+		listLength += sprintf(list + listLength, "%s %zu\n", hex, cut);
+		memmove(buffer, buffer + cut, have - cut);
+		have -= cut;
+	}
+	free(buffer);
+
+	uint32_t crc = gl_checksum ? crc32c(0, list, listLength) : 0;
+	pthread_mutex_lock(&gl_pipeLock);						//the writer reads the header once there's data
+	member->size = listLength;
+	member->crc = crc;
+	octalPut(member->header.size, 11, listLength);
+	member->header.type[0] = 'C';
+	headerChecksum(&member->header);
+	pthread_mutex_unlock(&gl_pipeLock);
+
+	queueBuffer(member, list, listLength);
+	free(list);
+}
+
+/*	sparseMember  -  returns int
+* The version of readMember() for a file with holes. Finds its data extents with SEEK_DATA and SEEK_HOLE and
+* archives it in GNU sparse format 1.0, which GNU tar and bsdtar restore with the holes: a regular member named
+* 'dir/GNUSparseFile.0/name' whose pax header gives the real name and size, with data that starts with a map
+* of decimal lines, the number of extents then the offset and length of each, ending with an empty extent at
+* the file's size, padded to a block and followed by the data of just the extents. The header is finished
+* before the map is queued, as in dedupMember(). Returns 0 without queueing anything if the file turns out to
+* have no holes, or the longer name doesn't fit in the header.
+*/
+int sparseMember(Member *member, int fd){
+	const char *name = member->path + gl_pathOffset, *base = strrchr(name, '/');
+	base = base ? base + 1 : name;
+	char sparseName[sizeof(member->header.name)] = { 0 };
+	if (snprintf(sparseName, sizeof(sparseName), "%.*sGNUSparseFile.0/%s", (int)(base - name), name, base) >=
+		sizeof(sparseName)){
+		return 0;
+	}
+	size_t capacity = 64, count = 0;
+	off_t *extents = malloc(2 * capacity * sizeof(off_t));	//offset, length pairs
+	if (!extents){
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	off_t at = 0, data = 0;
+	while (at < member->size){
+		off_t start = lseek(fd, at, SEEK_DATA);
+		if (start == -1 || start >= member->size){
+			break;											//ENXIO, nothing but hole from here on
+		}
+		off_t end = lseek(fd, start, SEEK_HOLE);
+		if (end == -1 || end > member->size){
+			end = member->size;
+		}
+		if (count == capacity){
+			capacity *= 2;
+			if (!(extents = realloc(extents, 2 * capacity * sizeof(off_t)))){
+				perror("realloc");
+				exit(EXIT_FAILURE);
+			}
+		}
+		extents[2 * count] = start;
+		extents[2 * count + 1] = end - start;
+		count++;
+		data += end - start;
+		at = end;
+	}
+	if (data == member->size){
+		free(extents);										//no holes after all, or no SEEK_HOLE support
+		return 0;
+	}
+
+	size_t mapLength = 0, mapSize = (count + 2) * 2 * 21 + BLOCK_SIZE;
+	char *map = malloc(mapSize);
+	if (!map){
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	mapLength += sprintf(map + mapLength, "%zu\n", count + 1);
+	for (size_t i = 0; i < count; i++){
+		mapLength += sprintf(map + mapLength, "%jd\n%jd\n", (intmax_t)extents[2 * i], (intmax_t)extents[2 * i + 1]);
+	}
+	mapLength += sprintf(map + mapLength, "%jd\n0\n", (intmax_t)member->size);	//trailing hole, the real size
+	size_t mapPadded = (mapLength + BLOCK_SIZE - 1) & ~(size_t)(BLOCK_SIZE - 1);
+	memset(map + mapLength, 0, mapPadded - mapLength);
+
+	uint32_t crc = 0;
+	if (gl_checksum){										//the map and then just the extents, as archived
+		crc = crc32c(0, map, mapPadded);
+		for (size_t i = 0; i < count; i++){
+			crc = hashRange(fd, extents[2 * i], extents[2 * i + 1], crc);
+		}
+	}
+	pthread_mutex_lock(&gl_pipeLock);						//the writer reads the header once there's data
+	member->sparseSize = member->size;
+	member->size = mapPadded + data;
+	member->crc = crc;
+	memcpy(member->header.name, sparseName, sizeof(member->header.name));
+	numberPut(member->header.size, sizeof(member->header.size), member->size);
+	headerChecksum(&member->header);
+	pthread_mutex_unlock(&gl_pipeLock);
+	queueBuffer(member, map, mapPadded);
+	free(map);
+
+	size_t extent = 0;
+	off_t within = 0;										//progress through the current extent
+	int changed = 0;
+	while (data > 0){
+		size_t want = data < CHUNK_SIZE ? data : CHUNK_SIZE;
+		size_t length = (want + BLOCK_SIZE - 1) & ~(size_t)(BLOCK_SIZE - 1);
+		Chunk *chunk = malloc(sizeof(Chunk));
+		if (!chunk){
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		chunk->data = pipeAcquire(member, member->size - data, length);
+		chunk->length = length;
+		chunk->next = NULL;
+
+		size_t filled = 0;
+		while (filled < want){
+			size_t part = extents[2 * extent + 1] - within;
+			if (part > want - filled){
+				part = want - filled;
+			}
+			size_t got = 0;
+			if (lseek(fd, extents[2 * extent] + within, SEEK_SET) != -1){
+				got = readFull(fd, chunk->data + filled, part);
+			}
+			if (got < part && !changed){
+				printf("file changed size while being archived: %s\n", member->path);
+				changed = 1;
+			}
+			memset(chunk->data + filled + got, 0, part - got);
+			filled += part;
+			within += part;
+			if (within == extents[2 * extent + 1]){
+				extent++;
+				within = 0;
+			}
+		}
+		memset(chunk->data + want, 0, length - want);		//tar padding
+		data -= want;
+		pipeAppend(member, chunk);
+	}
+	free(extents);
+	return 1;
+}
+
+/*	readMember  -  returns void
+* Reads a member's data into chunks for the writer. Exactly the size recorded in the header is archived, if
+* the file shrank since it was stat'd the rest is filled with zeros, if it grew the extra is left out.
+*/
+void readMember(Member *member){
+	int fd;
+	uint64_t started = statsTimer();
+	off_t fileSize = member->size;							//the -d and sparse readers change member->size
+	errno = 0;
+	fd = open(member->path, O_RDONLY | O_CLOEXEC);
+	statsAdd(PHASE_OPEN, started);
+	if (fd == -1){
+		perror("open");
+		gl_statFailed++;
+		pthread_mutex_lock(&gl_pipeLock);
+		member->failed = 1;
+		member->done = 1;
+		pthread_cond_signal(&member->out->ready);
+		pthread_mutex_unlock(&gl_pipeLock);
+		return;
+	}
+	posix_fadvise(fd, 0, 0, gl_noCache ? POSIX_FADV_NOREUSE : POSIX_FADV_SEQUENTIAL);
+	if (gl_storePath){
+		dedupMember(member, fd);
+	}
+	off_t remaining = gl_storePath || (member->sparse && sparseMember(member, fd)) ? 0 : member->size;
+	int changed = 0;
+	uint32_t crc = 0;
+	int hashedFirst = gl_checksum && remaining > CHUNK_SIZE;
+	if (hashedFirst){
+		member->crc = hashRange(fd, 0, remaining, 0);		//needed before the header, so before the data
+		lseek(fd, 0, SEEK_SET);
+	}
+	while (remaining > 0){
+		size_t want = remaining < CHUNK_SIZE ? remaining : CHUNK_SIZE;
+		size_t length = (want + BLOCK_SIZE - 1) & ~(size_t)(BLOCK_SIZE - 1);
+
+		Chunk *chunk = malloc(sizeof(Chunk));
+		if (!chunk){
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		chunk->data = pipeAcquire(member, member->size - remaining, length);
+		chunk->length = length;
+		chunk->next = NULL;
+
+		size_t got = readFull(fd, chunk->data, want);
+		if (got < want && !changed){
+			printf("file changed size while being archived: %s\n", member->path);
+			changed = 1;
+		}
+		memset(chunk->data + got, 0, length - got);				//zero fill, includes the tar padding
+		if (gl_checksum){
+			uint64_t start = statsTimer();
+			crc = crc32c(crc, chunk->data, want);
+			statsAdd(PHASE_HASH, start);
+			if (!hashedFirst){
+				member->crc = crc;								//all of it is in this one chunk
+			}
+		}
+		remaining -= want;
+		pipeAppend(member, chunk);
+	}
+	if (hashedFirst && crc != member->crc && !changed){
+		printf("file changed while being archived, its checksum won't match: %s\n", member->path);
+	}
+	dropFile(fd, 0);
+	close(fd);
+	gl_statFiles++;
+	gl_dataBytes += fileSize;
+	statsFile(member->path, started);
+
+	pthread_mutex_lock(&gl_pipeLock);
+	member->done = 1;
+	pthread_cond_signal(&member->out->ready);
+	pthread_mutex_unlock(&gl_pipeLock);
+}
+
+/*	readRange  -  returns void
+* One reader's share of a split member, the SPLIT_RANGE of the file starting at 'at'. In the -c hashing pass
+* the range is only hashed, and whoever hashes the last one combines the CRCs, which lets the writer go ahead
+* with the header, and hands the ranges out again to be read. Read chunks are queued as readMember() does
+* and pipeAppend() puts them in order among the other readers'. Whoever reads the last range closes the file
+* and marks the member done.
+*
+* member	Member		the split member
+* at		off_t		start of the range
+* hashing	int			non-zero in the hashing pass
+*/
+void readRange(Member *member, off_t at, int hashing){
+	off_t length = member->size - at < SPLIT_RANGE ? member->size - at : SPLIT_RANGE;
+	size_t range = at / SPLIT_RANGE;
+	if (hashing){
+		uint32_t crc = hashRange(member->fd, at, length, 0);
+		pthread_mutex_lock(&gl_pipeLock);
+		member->crcs[range] = crc;
+		if (--member->rangesLeft == 0){
+			size_t ranges = (member->size + SPLIT_RANGE - 1) / SPLIT_RANGE;
+			member->crc = member->crcs[0];
+			for (size_t i = 1; i < ranges; i++){
+				off_t part = member->size - (off_t)i * SPLIT_RANGE;
+				member->crc = crc32cCombine(member->crc, member->crcs[i], part < SPLIT_RANGE ? part : SPLIT_RANGE);
+			}
+			member->hashing = 0;
+			member->claimed = 0;
+			member->rangesLeft = ranges;
+			pthread_cond_broadcast(&gl_pipeClaimable);			//the readers waiting for the second pass
+		}
+		pthread_mutex_unlock(&gl_pipeLock);
+		return;
+	}
+
+	uint32_t crc = 0;
+	int changed = 0;
+	for (off_t done = 0; done < length;){
+		size_t want = length - done < CHUNK_SIZE ? length - done : CHUNK_SIZE;
+		size_t padded = (want + BLOCK_SIZE - 1) & ~(size_t)(BLOCK_SIZE - 1);
+		Chunk *chunk = malloc(sizeof(Chunk));
+		if (!chunk){
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		chunk->data = pipeAcquire(member, at + done, padded);
+		chunk->length = padded;
+		chunk->next = NULL;
+		chunk->at = at + done;
+
+		size_t got = readAt(member->fd, chunk->data, want, at + done);
+		if (got < want && !changed){
+			printf("file changed size while being archived: %s\n", member->path);
+			changed = 1;
+		}
+		memset(chunk->data + got, 0, padded - got);				//zero fill, includes the tar padding
+		if (gl_checksum){
+			uint64_t start = statsTimer();
+			crc = crc32c(crc, chunk->data, want);
+			statsAdd(PHASE_HASH, start);
+		}
+		done += want;
+		pipeAppend(member, chunk);
+	}
+	if (gl_checksum && crc != member->crcs[range] && !changed){
+		printf("file changed while being archived, its checksum won't match: %s\n", member->path);
+	}
+
+	pthread_mutex_lock(&gl_pipeLock);
+	int last = --member->rangesLeft == 0;
+	pthread_mutex_unlock(&gl_pipeLock);
+	if (!last){
+		return;
+	}
+	dropFile(member->fd, 0);
+	close(member->fd);
+	free(member->crcs);
+	gl_statFiles++;
+	gl_dataBytes += member->size;
+	statsFile(member->path, member->started);
+	pthread_mutex_lock(&gl_pipeLock);
+	member->done = 1;
+	pthread_cond_signal(&member->out->ready);
+	pthread_mutex_unlock(&gl_pipeLock);
+}
+
+/*	pipeReader  -  returns void*
+* Reader thread body. Claims the oldest member nobody is reading yet and reads it, until the pipeline is
+* closed and every member has been claimed. Directories, whiteouts, hard links and the big files the writers
+* copy themselves are never queued for the readers. A split member stays first in line until every range of
+* it has been claimed, each reader that comes along takes the next one. While its ranges are being hashed
+* nothing behind it is claimed either, its readers are back for the second pass as soon as the last is done.
+*/
+void *pipeReader(void *arg){
+	for (;;){
+		pthread_mutex_lock(&gl_pipeLock);
+		while (gl_pipeClaim ? gl_pipeClaim->hashing && gl_pipeClaim->claimed >= gl_pipeClaim->size :
+			   !gl_pipeClosed){
+			pthread_cond_wait(&gl_pipeClaimable, &gl_pipeLock);
+		}
+		Member *member = gl_pipeClaim;
+		off_t at = 0;
+		int hashing = 0;
+		if (member && member->split){
+			at = member->claimed;
+			hashing = member->hashing;
+			member->claimed += SPLIT_RANGE;
+		}
+		if (member && (!member->split || (member->claimed >= member->size && !member->hashing))){
+			gl_pipeClaim = member->nextClaim;
+			if (!gl_pipeClaim){
+				gl_claimTail = NULL;						//it may be written and freed from here on
+			}
+		}
+		pthread_mutex_unlock(&gl_pipeLock);
+
+		if (!member){
+			return NULL;
+		}
+		if (member->split){
+			readRange(member, at, hashing);
+		}
+		else {
+			readMember(member);
+		}
+	}
+}
+
+/*	Struct LinkRecord  -typedef-  LinkRecord
+* A file with more than one hard link and the name it was first archived under.
+*/
+typedef struct LinkRecord{
+	dev_t dev;
+	ino_t ino;
+	char *name;						//NULL in an empty slot
+	int failed;						//'name' couldn't be read, the next name of the file carries the data
+}
+LinkRecord;
+
+/*	Link Globals
+* gl_links			LinkRecord	open addressed hash table of the hard linked files archived so far
+* gl_linksSize		size_t		number of slots, always a power of 2
+* gl_nlinks			size_t		number of slots in use
+* gl_linkLock		mutex		protects the above, the walk adds to the table while the writers read it
+*/
+LinkRecord		*gl_links;
+size_t			gl_linksSize;
+size_t			gl_nlinks;
+pthread_mutex_t	gl_linkLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*	linkSlot  -  returns LinkRecord*
+* Finds the slot for a device and inode in 'gl_links', either the one holding it or the empty one it goes in.
+*/
+LinkRecord *linkSlot(dev_t dev, ino_t ino){
+	size_t i = ((uint64_t)ino * 0x9e3779b97f4a7c15ULL ^ (uint64_t)dev) & (gl_linksSize - 1);
+	while (gl_links[i].name && (gl_links[i].ino != ino || gl_links[i].dev != dev)){
+		i = (i + 1) & (gl_linksSize - 1);
+	}
+	return &gl_links[i];
+}
+
+/*	linkFirst  -  returns int
+* For a file with more than one link, returns 1 with the name it was already archived under in 'link', or
+* remembers 'name' as that name and returns 0 if this is the first time it has been seen.
+*
+* sb		stat		the file
+* name		char		its name in the archive
+* link		char		the 100 byte link field of its header, or NULL
+*/
+int linkFirst(const struct stat *sb, const char *name, char *link){
+	pthread_mutex_lock(&gl_linkLock);
+	if (gl_nlinks * 2 >= gl_linksSize){						//grow at half full
+		LinkRecord *old = gl_links;
+		size_t oldSize = gl_linksSize;
+		gl_linksSize = oldSize ? oldSize * 2 : 1024;
+		if (!(gl_links = calloc(gl_linksSize, sizeof(LinkRecord)))){
+			perror("calloc");
+			exit(EXIT_FAILURE);
+		}
+		for (size_t i = 0; i < oldSize; i++){
+			if (old[i].name){
+				*linkSlot(old[i].dev, old[i].ino) = old[i];
+			}
+		}
+		free(old);
+	}
+	LinkRecord *slot = linkSlot(sb->st_dev, sb->st_ino);
+	int found = slot->name != NULL;
+	if (found && link){
+		snprintf(link, 100, "%s", slot->name);
+	}
+	else if (!found){
+		if (!(slot->name = strdup(name))){
+			perror("strdup");
+			exit(EXIT_FAILURE);
+		}
+		slot->dev = sb->st_dev;
+		slot->ino = sb->st_ino;
+		gl_nlinks++;
+	}
+	pthread_mutex_unlock(&gl_linkLock);
+	return found;
+}
+
+/*	linkFailed  -  returns void
+* Called by the writer for a hard linked member that couldn't be read. If it is the name the file's later
+* names link to, they can't any more, the next of them is archived with the data instead.
+*/
+void linkFailed(const Member *member){
+	pthread_mutex_lock(&gl_linkLock);
+	LinkRecord *slot = linkSlot(member->dev, member->ino);
+	if (slot->name && strcmp(slot->name, member->path + gl_pathOffset) == 0){
+		slot->failed = 1;
+	}
+	pthread_mutex_unlock(&gl_linkLock);
+}
+
+/*	linkCheck  -  returns int
+* Called by the writer before it writes a type '1' member. Points the member at the name its file is archived
+* under now, which isn't the one it was queued with if that one couldn't be read. Returns 1 if no name of the
+* file has been archived, then this member has to be archived with the data.
+*/
+int linkCheck(Member *member){
+	pthread_mutex_lock(&gl_linkLock);
+	LinkRecord *slot = linkSlot(member->dev, member->ino);
+	int failed = !slot->name || slot->failed;
+	if (!failed && strncmp(member->header.link, slot->name, sizeof(member->header.link)) != 0){
+		memset(member->header.link, 0, sizeof(member->header.link));
+		snprintf(member->header.link, sizeof(member->header.link), "%s", slot->name);
+		headerChecksum(&member->header);
+	}
+	pthread_mutex_unlock(&gl_linkLock);
+	return failed;
+}
+
+/*	linkTake  -  returns void
+* Makes the member the name its file's later names link to, once it has been archived with the data.
+*/
+void linkTake(const Member *member){
+	char *name = strdup(member->path + gl_pathOffset);
+	if (!name){
+		perror("strdup");
+		exit(EXIT_FAILURE);
+	}
+	pthread_mutex_lock(&gl_linkLock);
+	LinkRecord *slot = linkSlot(member->dev, member->ino);
+	free(slot->name);
+	slot->name = name;
+	slot->failed = 0;
+	pthread_mutex_unlock(&gl_linkLock);
+}
+
+/*	writeDirect  -  returns void
+* Writer side handling of a big file. Writes its header and then has the kernel copy the data straight from
+* the file to the archive, padding with zeros if the file shrank since it was stat'd.
+*/
+void writeDirect(Member *member){
+	int fd;
+	uint64_t started = statsTimer();
+	errno = 0;
+	fd = open(member->path, O_RDONLY | O_CLOEXEC);
+	statsAdd(PHASE_OPEN, started);
+	if (fd == -1){
+		perror("open");
+		gl_statFailed++;
+		member->failed = 1;
+		return;
+	}
+	Writer *w = member->out;
+	member->written = 1;
+	indexAdd(w, member, w->offset);
+	writerPut(w, &member->header, sizeof(Header));			//write the header to the archive
+	writerFlush(w);											//the kernel writes at the fd offset
+
+	off_t copied = copyData(fd, NULL, w->fd, member->size);
+	w->offset += copied;
+	if (copied < member->size){
+		printf("file changed size while being archived: %s\n", member->path);
+	}
+	close(fd);
+	writerPad(w, member->size - copied);
+	if (w->offset % BLOCK_SIZE != 0){
+		writerPad(w, BLOCK_SIZE - w->offset % BLOCK_SIZE);	//pad to a multiple of 512
+	}
+	gl_statFiles++;
+	gl_dataBytes += member->size;
+	statsFile(member->path, started);
+}
+
+/*	writeLinked  -  returns void
+* Writer side handling of a later name of a hard linked file when no earlier name of it could be read. It was
+* queued as a type '1' link with nothing for the readers, so the writer turns it back into a regular file and
+* reads the data into the archive itself a CHUNK_SIZE at a time, then later names link to this one instead.
+*/
+void writeLinked(Member *member){
+	int fd;
+	struct stat sb;
+	uint64_t started = statsTimer();
+	errno = 0;
+	fd = open(member->path, O_RDONLY | O_CLOEXEC);
+	statsAdd(PHASE_OPEN, started);
+	if (fd == -1 || fstat(fd, &sb) == -1){
+		perror("open");
+		if (fd != -1){
+			close(fd);
+		}
+		gl_statFailed++;
+		member->failed = 1;
+		return;
+	}
+	char *buffer = malloc(CHUNK_SIZE);
+	if (!buffer){
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	Writer *w = member->out;
+	member->size = sb.st_size;
+	member->headerOnly = 0;
+	member->header.type[0] = '0';
+	memset(member->header.link, 0, sizeof(member->header.link));
+	numberPut(member->header.size, sizeof(member->header.size), member->size);
+	headerChecksum(&member->header);
+	if (gl_checksum){
+		member->crc = hashRange(fd, 0, member->size, 0);	//needed before the header
+	}
+	member->written = 1;
+	writePax(w, member);
+	indexAdd(w, member, w->offset);
+	writerPut(w, &member->header, sizeof(Header));
+
+	int changed = 0;
+	for (off_t remaining = member->size; remaining > 0;){
+		size_t want = remaining < CHUNK_SIZE ? remaining : CHUNK_SIZE;
+		size_t got = readFull(fd, buffer, want);
+		if (got < want && !changed){
+			printf("file changed size while being archived: %s\n", member->path);
+			changed = 1;
+		}
+		memset(buffer + got, 0, want - got);
+		writerPut(w, buffer, want);
+		remaining -= want;
+	}
+	if (w->offset % BLOCK_SIZE != 0){
+		writerPad(w, BLOCK_SIZE - w->offset % BLOCK_SIZE);	//pad to a multiple of 512
+	}
+	free(buffer);
+	close(fd);
+	linkTake(member);
+	gl_statLinks--;
+	gl_statFiles++;
+	gl_dataBytes += member->size;
+	statsFile(member->path, started);
+}
+
+/*	archiveClose  -  returns void
+* Finishes an archive once its last member is written: the two empty blocks that end a tar, the last -z
+* frames, the -n tail and then the index. The descriptor is left open.
+*/
+void archiveClose(Writer *w){
+	writerPad(w, 1024);							//pad the archive with two tar headers worth of empty space
+	writerFlush(w);
+	if (gl_compress){
+		frameDrain(w);							//last frames out of the compression threads
+	}
+	archiveFinish(w);							//-n, the unaligned tail and the last of the page cache
+	if (gl_append && ftruncate(w->fd, w->offset) == -1){	//anything after the old end blocks, such as
+		perror("ftruncate");								//another tar's padding to a whole record
+	}
+	struct stat archiveStat;
+	if (strcmp(w->path, "-") != 0 && fstat(w->fd, &archiveStat) == 0){
+		indexWrite(w, archiveStat.st_size);		//index of members for restore -l and -x
+		gl_archiveBytes += archiveStat.st_size;
+	}
+	else {
+		gl_archiveBytes += w->offset;			//stdout has nowhere to put an index
+	}
+	free(w->buffer);
+}
+
+/*	chunkReady  -  returns int
+* Returns 1 if the member's first chunk is the next one to write, which for a split member may not have
+* been read yet even though later ones have.
+*/
+int chunkReady(const Member *member){
+	return member->chunks && (!member->split || member->chunks->at == member->taken);
+}
+
+/*	pipeWriter  -  returns void*
+* Writer thread body, the only thread that writes to its archive. Takes members from the head of the
+* archive's list in walk order and writes each header followed by its data as the readers deliver it,
+* freeing the buffers as it goes, then closes the archive off once the walk is over.
+*
+* arg		Writer		the archive to write
+*/
+void *pipeWriter(void *arg){
+	Writer *w = arg;
+	pthread_mutex_lock(&gl_pipeLock);
+	for (;;){
+		while (!w->head && !gl_pipeClosed){
+			pthread_cond_wait(&w->ready, &gl_pipeLock);
+		}
+		Member *member = w->head;
+		if (!member){
+			break;
+		}
+		while (!member->headerOnly && !member->direct && !chunkReady(member) && !member->done){
+			pthread_cond_wait(&w->ready, &gl_pipeLock);
+		}
+		if (member->direct && !member->done){
+			pthread_mutex_unlock(&gl_pipeLock);
+			writeDirect(member);
+			pthread_mutex_lock(&gl_pipeLock);
+			member->done = 1;
+			continue;
+		}
+
+		if (member->linked && member->header.type[0] == '1' && !member->failed && !member->written){
+			pthread_mutex_unlock(&gl_pipeLock);
+			if (linkCheck(member)){
+				writeLinked(member);						//the data went with the name it links to
+			}
+			pthread_mutex_lock(&gl_pipeLock);
+			member->done = 1;
+		}
+		if (!member->failed && !member->written){
+			member->written = 1;
+			pthread_mutex_unlock(&gl_pipeLock);
+			writePax(w, member);							//the CRC and such go first
+			indexAdd(w, member, w->offset);
+			writerPut(w, &member->header, sizeof(Header));	//write the header to the archive
+			pthread_mutex_lock(&gl_pipeLock);
+			continue;
+		}
+
+		Chunk *chunk = member->chunks;
+		if (chunkReady(member)){
+			member->chunks = chunk->next;
+			if (!member->chunks){
+				member->last = NULL;
+			}
+			member->taken += chunk->length;
+			pthread_mutex_unlock(&gl_pipeLock);
+			writerPut(w, chunk->data, chunk->length);
+			free(chunk->data);
+			pthread_mutex_lock(&gl_pipeLock);
+			gl_inUse -= chunk->length;
+			free(chunk);
+			pthread_cond_broadcast(&gl_pipeSpace);
+			continue;
+		}
+		if (!member->headerOnly && !member->done){
+			continue;
+		}
+
+		w->head = member->next;									//member finished, the next one is
+		if (!w->head){											//now the head of the list
+			w->tail = NULL;
+		}
+		gl_pipeCount--;
+		pthread_cond_broadcast(&gl_pipeSpace);
+		pthread_mutex_unlock(&gl_pipeLock);
+
+		if (member->failed){
+			printf("file skipped: %s\n", member->path);
+			if (member->linked){
+				linkFailed(member);
+			}
+			pthread_mutex_lock(&gl_pipeLock);
+			if (!(gl_failed = realloc(gl_failed, (gl_nfailed + 1) * sizeof(char *))) ||
+				!(gl_failed[gl_nfailed++] = strdup(member->path + gl_pathOffset))){
+				perror("malloc");
+				exit(EXIT_FAILURE);
+			}
+			pthread_mutex_unlock(&gl_pipeLock);
+		}
+		else {
+			w->members++;
+			if (!gl_quiet){
+				printf("Successfully archived: %s\n", member->path);	//console message
+			}
+			if (gl_journalFd != -1 && !member->whiteout){
+				journalCheckpoint(w, member);
+			}
+		}
+		free(member->path);
+		free(member);
+		pthread_mutex_lock(&gl_pipeLock);
+	}
+	pthread_mutex_unlock(&gl_pipeLock);
+	archiveClose(w);
+	return NULL;
+}
+
+/*	pipeStart  -  returns void
+* Starts a writer thread for each of the 'nout' archives open on 'fds' and 'readers' reader threads.
+*
+* fds		int			the archives, or the shards of one
+* paths		char		their file names
+* nout		int			number of archives
+* readers	int			number of reader threads
+*/
+void pipeStart(const int *fds, char *const *paths, int nout, int readers){
+	gl_nout = nout;
+	if (!(gl_out = calloc(nout, sizeof(Writer)))){
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < nout; i++){
+		void *buffer;
+		if (posix_memalign(&buffer, DIRECT_ALIGN, WRITE_BUFFER) != 0){
+			perror("posix_memalign");
+			exit(EXIT_FAILURE);
+		}
+		gl_out[i].fd = fds[i];
+		gl_out[i].path = paths[i];
+		gl_out[i].buffer = buffer;
+		pthread_cond_init(&gl_out[i].ready, NULL);
+		if (gl_appendIndex){
+			appendSeed(&gl_out[i]);						//-a, carry on from the old end blocks
+		}
+		if (gl_noCache){
+			archiveStart(&gl_out[i]);
+		}
+	}
+
+	if (gl_compress){
+		frameStart(readers);
+	}
+	gl_pipeReaders = readers;
+	if (!(gl_pipeThreads = malloc(readers * sizeof(pthread_t)))){
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < nout; i++){
+		if (pthread_create(&gl_out[i].thread, NULL, pipeWriter, &gl_out[i]) != 0){
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (int i = 0; i < readers; i++){
+		if (pthread_create(&gl_pipeThreads[i], NULL, pipeReader, NULL) != 0){
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+/*	pipeFinish  -  returns void
+* Tells the pipeline no more members are coming and waits for everything queued to be written and every
+* archive to be closed off.
+*/
+void pipeFinish(){
+	pthread_mutex_lock(&gl_pipeLock);
+	gl_pipeClosed = 1;
+	pthread_cond_broadcast(&gl_pipeClaimable);
+	for (int i = 0; i < gl_nout; i++){
+		pthread_cond_broadcast(&gl_out[i].ready);
+	}
+	pthread_mutex_unlock(&gl_pipeLock);
+	for (int i = 0; i < gl_pipeReaders; i++){
+		pthread_join(gl_pipeThreads[i], NULL);
+	}
+	for (int i = 0; i < gl_nout; i++){
+		pthread_join(gl_out[i].thread, NULL);
+	}
+	if (gl_compress){
+		frameFinish(gl_pipeReaders);
+	}
+	free(gl_pipeThreads);
+}
+
+/*	manifestWrite  -  returns int
+* Writes the -s manifest once every shard is complete: a "TARSHARDS1 {shards}" line then a line for each
+* shard with its number of members, its size and its absolute path. Each shard is a complete tar with its
+* own index, the manifest is only needed to restore them all together. Returns 0 on success, -1 on failure.
+*/
+int manifestWrite(const char *path){
+	FILE *file;
+	if (!(file = fopen(path, "w"))){
+		perror("fopen manifest");
+		return -1;
+	}
+	fprintf(file, "TARSHARDS1 %d\n", gl_nout);
+	for (int i = 0; i < gl_nout; i++){
+		char shard[PATH_MAX];
+		struct stat sb;
+		if (!realpath(gl_out[i].path, shard) || fstat(gl_out[i].fd, &sb) == -1){
+			perror("manifest");
+			fclose(file);
+			return -1;
+		}
+		fprintf(file, "%zu %jd %s\n", gl_out[i].members, (intmax_t)sb.st_size, shard);
+	}
+	if (fclose(file) == EOF){
+		perror("fclose manifest");
+		return -1;
+	}
+	return 0;
+}
+
+/*	Struct CatalogHead  -typedef-  CatalogHead
+* Start of a catalog file written by -g. It is followed by 'count' CatalogRecords sorted by path and the table
+* of paths they point into, so the next backup can map it and binary search it in place.
+*/
+typedef struct CatalogHead{
+	char magic[8];					//"TARCAT1"
+	uint64_t count;
+	uint64_t namesSize;
+}
+CatalogHead;
+
+/*	Struct CatalogRecord  -typedef-  CatalogRecord
+* What a file or directory looked like when it was last backed up. Times are in nanoseconds.
+*/
+typedef struct CatalogRecord{
+	uint64_t ino;
+	uint64_t dev;
+	int64_t size;
+	int64_t mtime;
+	int64_t ctime;
+	uint32_t mode;
+	uint32_t name;					//offset of the path in the name table, paths have no trailing '/'
+}
+CatalogRecord;
+
+/*	Catalog Globals
+* gl_catalogPath	char			catalog file given with -g, NULL for a normal backup
+* gl_catalog		CatalogHead		the previous run's catalog mapped into memory, NULL on the first run
+* gl_catalogSize	size_t			size of the mapping
+* gl_seen			CatalogRecord	every entry this run has walked over, for the next catalog
+* gl_nseen			size_t			number of entries seen
+* gl_seenNames		char			name table for gl_seen
+* gl_seenNamesSize	size_t			bytes used in gl_seenNames
+*/
+char				*gl_catalogPath;
+const CatalogHead	*gl_catalog;
+size_t				gl_catalogSize;
+CatalogRecord		*gl_seen;
+size_t				gl_nseen;
+char				*gl_seenNames;
+size_t				gl_seenNamesSize;
+
+/*	catalogLoad  -  returns int
+* Maps the catalog left by the previous run. A missing catalog is fine, that just makes this a full backup.
+* Returns -1 if the file exists but isn't a catalog.
+*/
+int catalogLoad(const char *path){
+	int fd;
+	struct stat sb;
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1){
+		return errno == ENOENT ? 0 : -1;
+	}
+	if (fstat(fd, &sb) == -1 || sb.st_size < sizeof(CatalogHead)){
+		close(fd);
+		return -1;
+	}
+	const CatalogHead *head = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (head == MAP_FAILED){
+		return -1;
+	}
+	if (memcmp(head->magic, "TARCAT1", 8) != 0 ||
+		sizeof(CatalogHead) + head->count * sizeof(CatalogRecord) + head->namesSize != sb.st_size){
+		munmap((void *)head, sb.st_size);
+		return -1;
+	}
+	gl_catalog = head;
+	gl_catalogSize = sb.st_size;
+	return 0;
+}
+
+/*	catalogFind  -  returns const CatalogRecord*
+* Binary search of the previous catalog for 'name'. Returns NULL if it wasn't there last time.
+*/
+const CatalogRecord *catalogFind(const char *name){
+	if (!gl_catalog){
+		return NULL;
+	}
+	const CatalogRecord *records = (const CatalogRecord *)(gl_catalog + 1);
+	const char *names = (const char *)(records + gl_catalog->count);
+	size_t low = 0, high = gl_catalog->count;
+	while (low < high){
+		size_t middle = low + (high - low) / 2;
+		int order = strcmp(names + records[middle].name, name);
+		if (order == 0){
+			return &records[middle];
+		}
+		if (order < 0){
+			low = middle + 1;
+		}
+		else {
+			high = middle;
+		}
+	}
+	return NULL;
+}
+
+/*	catalogRecord  -  returns void
+* Fills in a catalog record from a stat struct.
+*/
+void catalogRecord(CatalogRecord *record, const struct stat *sb){
+	record->ino = sb->st_ino;
+	record->dev = sb->st_dev;
+	record->size = sb->st_size;
+	record->mtime = (int64_t)sb->st_mtim.tv_sec * 1000000000 + sb->st_mtim.tv_nsec;
+	record->ctime = (int64_t)sb->st_ctim.tv_sec * 1000000000 + sb->st_ctim.tv_nsec;
+	record->mode = sb->st_mode;
+}
+
+/*	catalogChanged  -  returns int
+* Returns 1 if 'name' is new or differs in any way from the previous catalog. The ctime catches files
+* that were put back with an old mtime, the inode catches files replaced by a rename.
+*/
+int catalogChanged(const char *name, const struct stat *sb){
+	const CatalogRecord *old = catalogFind(name);
+	if (!old){
+		return 1;
+	}
+	CatalogRecord now;
+	catalogRecord(&now, sb);
+	return old->ino != now.ino || old->dev != now.dev || old->size != now.size ||
+		   old->mtime != now.mtime || old->ctime != now.ctime || old->mode != now.mode;
+}
+
+/*	catalogAdd  -  returns void
+* Remembers an entry seen by this run for the next catalog. Only called from the walk's calling thread.
+*/
+void catalogAdd(const char *name, const struct stat *sb){
+	static size_t capacity, namesCapacity;
+	size_t length = strlen(name);
+	if (gl_nseen == capacity){
+		capacity = capacity ? capacity * 2 : 1024;
+		if (!(gl_seen = realloc(gl_seen, capacity * sizeof(CatalogRecord)))){
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+	while (gl_seenNamesSize + length + 1 > namesCapacity){
+		namesCapacity = namesCapacity ? namesCapacity * 2 : 65536;
+		if (!(gl_seenNames = realloc(gl_seenNames, namesCapacity))){
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+	CatalogRecord *record = &gl_seen[gl_nseen++];
+	catalogRecord(record, sb);
+	record->name = gl_seenNamesSize;
+	memcpy(gl_seenNames + gl_seenNamesSize, name, length + 1);
+	gl_seenNamesSize += length + 1;
+}
+
+/*	compareSeen  -  returns int
+* qsort comparator, orders the records seen this run by path.
+*/
+int compareSeen(const void *a, const void *b){
+	return strcmp(gl_seenNames + ((const CatalogRecord *)a)->name,
+				  gl_seenNames + ((const CatalogRecord *)b)->name);
+}
+
+/*	queueDeletions  -  returns void
+* Compares the previous catalog with what this run saw, both sorted by path, and queues a whiteout member
+* for everything that has gone. Only the top of a deleted directory gets one. Whiteouts use the OCI layer
+* convention, an empty file named '.wh.<name>' in the same directory, so plain tar can still read the archive,
+* and carry a "BACKUP.whiteout" pax record so restore never takes a real file with that name for one.
+* Sorts gl_seen as a side effect, ready for catalogWrite().
+*/
+void queueDeletions(){
+	qsort(gl_seen, gl_nseen, sizeof(CatalogRecord), compareSeen);
+	if (!gl_catalog){
+		return;
+	}
+	const CatalogRecord *records = (const CatalogRecord *)(gl_catalog + 1);
+	const char *names = (const char *)(records + gl_catalog->count);
+	const char *deletedDir = NULL;
+	size_t seen = 0;
+	for (size_t i = 0; i < gl_catalog->count; i++){
+		const char *name = names + records[i].name;
+		int order = 1;
+		while (seen < gl_nseen && (order = strcmp(gl_seenNames + gl_seen[seen].name, name)) < 0){
+			seen++;
+		}
+		if (seen < gl_nseen && order == 0){
+			continue;											//still there
+		}
+		const char *below = strchr(name, '/');
+		if (below && filterActive() && filterBeneath(below + 1, S_ISDIR(records[i].mode))){
+			continue;											//left out by -e, not deleted
+		}
+		size_t dirLength = deletedDir ? strlen(deletedDir) : 0;
+		if (deletedDir && strncmp(name, deletedDir, dirLength) == 0 && name[dirLength] == '/'){
+			continue;											//inside a directory already whited out
+		}
+		if (S_ISDIR(records[i].mode)){
+			deletedDir = name;
+		}
+
+		Member *member;
+		if (!(member = calloc(1, sizeof(Member))) || !(member->path = strdup(name))){
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		member->headerOnly = 1;
+		member->whiteout = 1;
+		member->mtime = gl_now;
+		member->mode = S_IFREG | 0644;
+		const char *base = strrchr(name, '/');
+		base = base ? base + 1 : name;
+		if (snprintf(member->header.name, 100, "%.*s.wh.%s", (int)(base - name), name, base) >= 100){
+			printf("Deleted path too long to record, skipped: %s\n", name);
+			free(member->path);
+			free(member);
+			continue;
+		}
+		octalPut(member->header.mode, 6, 0644);
+		headerOwner(&member->header, 0, 0);
+		octalPut(member->header.size, 11, 0);
+		octalPut(member->header.modified, 11, gl_now);
+		member->header.type[0] = '0';
+		headerChecksum(&member->header);
+		pipeQueue(member);
+		printf("Deleted since last backup: %s\n", name);
+	}
+}
+
+/*	catalogForget  -  returns void
+* Marks the entry for 'name' as not backed up, for a file the walk saw but that couldn't be read. It stays in
+* the catalog so the next run doesn't take it for deleted, with an mtime no file has so that run archives it.
+*/
+void catalogForget(const char *name){
+	size_t low = 0, high = gl_nseen;
+	while (low < high){
+		size_t middle = low + (high - low) / 2;
+		int order = strcmp(gl_seenNames + gl_seen[middle].name, name);
+		if (order == 0){
+			gl_seen[middle].mtime = -1;
+			return;
+		}
+		if (order < 0){
+			low = middle + 1;
+		}
+		else {
+			high = middle;
+		}
+	}
+}
+
+/*	catalogWrite  -  returns int
+* Writes this run's entries as the new catalog, through a temporary file so a failed run leaves the old
+* catalog in place. queueDeletions() must already have sorted them and the archive must be finished, only
+* members that were written count as backed up. Returns 0 on success, -1 on failure.
+*/
+int catalogWrite(const char *path){
+	char temp[PATH_MAX];
+	if (snprintf(temp, PATH_MAX, "%s.tmp", path) >= PATH_MAX){
+		return -1;
+	}
+	CatalogHead head;
+	memset(&head, 0, sizeof(CatalogHead));
+	memcpy(head.magic, "TARCAT1", 8);
+	head.count = gl_nseen;
+	head.namesSize = gl_seenNamesSize;
+
+	for (size_t i = 0; i < gl_nfailed; i++){
+		catalogForget(gl_failed[i]);
+	}
+
+	FILE *file;
+	if (!(file = fopen(temp, "wb"))){
+		perror("fopen catalog");
+		return -1;
+	}
+	int failed = fwrite(&head, sizeof(CatalogHead), 1, file) != 1 ||
+		fwrite(gl_seen, sizeof(CatalogRecord), gl_nseen, file) != gl_nseen ||
+		fwrite(gl_seenNames, 1, gl_seenNamesSize, file) != gl_seenNamesSize;
+	if (fclose(file) == EOF || failed || rename(temp, path) == -1){
+		perror("catalog");
+		remove(temp);
+		return -1;
+	}
+	return 0;
+}
+
+/*	resumeDone  -  returns int
+* Returns 1 if the directory 'name' was finished before the backup -r resumes stopped: it sorts before the
+* name in the journal, a component at a time as the walk goes, and isn't one of its parents. All of it is in
+* the archive already, so the walk can leave it out instead of -a passing over every file in it. Not with -g,
+* whose catalog has to see every file.
+*/
+int resumeDone(const char *name){
+	if (!gl_resumeAfter || gl_catalogPath){
+		return 0;
+	}
+	const char *at = gl_resumeAfter;
+	for (;;){
+		size_t length = strcspn(name, "/"), atLength = strcspn(at, "/");
+		int order = memcmp(name, at, length < atLength ? length : atLength);
+		if (order != 0 || length != atLength){
+			return order < 0 || (order == 0 && length < atLength);
+		}
+		if (name[length] == '\0' || at[atLength] == '\0'){
+			return 0;											//a parent, the journal's member or below it
+		}
+		name += length + 1;
+		at += atLength + 1;
+	}
+}
+
+/*	resumeLinks  -  returns void
+* With -r the files in directories resumeDone() leaves out never reach linkFirst(), so a hard linked file
+* archived under one of their names before the interruption would be archived again in full under a name the
+* walk does reach. The first time the walk comes to a file with more than one link this puts every regular
+* file in the archive from a left out directory in the link table, by stat'ing it. Runs once, and not at all
+* for a tree with no hard links.
+*
+* fpath		char		path of the file from walk(), the part before gl_pathOffset is the root's parent
+*/
+void resumeLinks(const char *fpath){
+	static int seeded;
+	if (seeded || !gl_resumeAfter || !gl_appendIndex){
+		return;
+	}
+	seeded = 1;
+	const Record *records = (const Record *)(gl_appendIndex + 1);
+	const char *names = (const char *)(records + gl_appendIndex->count);
+	char path[PATH_MAX], dir[PATH_MAX];
+	for (size_t i = 0; i < gl_appendIndex->count; i++){
+		const char *name = names + records[i].name;
+		if (records[i].type != '0' && records[i].type != 'S' && records[i].type != 'C'){
+			continue;
+		}
+		int pruned = 0;
+		for (const char *slash = strchr(name, '/'); slash && !pruned; slash = strchr(slash + 1, '/')){
+			snprintf(dir, sizeof(dir), "%.*s", (int)(slash - name), name);
+			pruned = resumeDone(dir);
+		}
+		struct stat sb;
+		if (!pruned || snprintf(path, sizeof(path), "%.*s%s", gl_pathOffset, fpath, name) >= sizeof(path) ||
+			lstat(path, &sb) == -1 || !S_ISREG(sb.st_mode) || sb.st_nlink < 2){
+			continue;
+		}
+		linkFirst(&sb, name, NULL);
+	}
+}
+
+/*	backup  -  return int
+* For every file passed to it, this function will create an appropriate .tar header and queue it to be added
+* to the archive along with the file contents, with tar formatting (padding to multiples of 512, and 1024 0
+* bytes to end). The reading and writing is done by the pipeline threads so the walk never waits on file data.
+* The second and later names of a hard linked file are archived as type '1' links to the first, and files
+* with fewer blocks than their size needs are marked for the readers to archive sparse.
+*
+* Code is modified from the top answer at:
+* https://stackoverflow.com/questions/29641965/creating-my-own-archive-tool-in-c 
+*
+* fpath		char		path of current file from walk()
+* sb		stat		stat struct of the current file from walk()
+* tflag		int			holds additional info about the current file
+* ftwbuf	FTW			holds the offset of file's filename in fpath so that you can print just the name
+*/
+int backup(const char *fpath, const struct stat *sb,
+								int tflag, struct FTW *ftwbuf){
+	/*	These first if statements skip the entire process of adding to the archive for a given file and move
+	* onto the next one in the recursion. The archive file itself never gets here, the walk leaves out this
+	* run's own files by device and inode. First, with -g it skips files that haven't changed since the
+	* catalog was written, after adding every file to the new catalog so none is taken for deleted next time.
+	* Secondly, and most commonly with -t, the last modified time of the file falls outside of the date
+	* provided by the -t switch (<= startDate). With -a, files the archive being appended to already has as
+	* they are now are skipped as well.
+	*/
+	if (sb->st_nlink > 1 && !S_ISDIR(sb->st_mode)){
+		resumeLinks(fpath);								//-r, names archived before the interruption
+	}
+	if (gl_catalogPath){								//with -g only new or changed files are archived,
+		int changed = catalogChanged(fpath + gl_pathOffset, sb);	//directories always are so that restore
+		catalogAdd(fpath + gl_pathOffset, sb);						//can put changed files back in them
+		if (!changed && !S_ISDIR(sb->st_mode)){
+			gl_statSkipped++;
+			return 0;
+		}
+	}
+	if (difftime(sb->st_mtime, gl_startDate) < 0){
+		gl_statSkipped++;
+		return 0;										//continue to next file
+	}
+	if (gl_appendIndex && !appendChanged(fpath + gl_pathOffset, sb)){	//with -a only what the archive
+		if (sb->st_nlink > 1 && !S_ISDIR(sb->st_mode)){					//doesn't have yet, a name that's
+			linkFirst(sb, fpath + gl_pathOffset, NULL);					//already there stays the one
+		}																//later names link to
+		gl_statSkipped++;
+		return 0;
+	}
+	uint64_t start = statsTimer();
+
+	Member *member;
+	if (!(member = calloc(1, sizeof(Member))) || !(member->path = strdup(fpath))){
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	member->size = S_ISDIR(sb->st_mode) ? 0 : sb->st_size;
+	member->headerOnly = S_ISDIR(sb->st_mode);
+	member->mode = sb->st_mode;
+	member->mtime = sb->st_mtime;
+	member->sparse = S_ISREG(sb->st_mode) && (off_t)sb->st_blocks * 512 < sb->st_size;
+	member->direct = member->size >= DIRECT_SIZE && !gl_compress && !gl_storePath && !member->sparse && !gl_noCache &&
+		!gl_checksum;
+	member->split = member->size >= SPLIT_SIZE && !member->direct && !gl_storePath && !member->sparse &&
+		gl_pipeReaders > 1;
+	
+	Header *header = &member->header;						//Creation of the tar header, calloc has
+	octalPut(header->mode, 6, sb->st_mode);				//already zeroed all 512 bytes
+	headerOwner(header, sb->st_uid, sb->st_gid);
+	numberPut(header->size, sizeof(header->size), member->size);
+	octalPut(header->modified, 11, sb->st_mtime);
+	if (S_ISDIR(sb->st_mode)){													//If DIR add trailing '/'
+		if (snprintf(header->name, 100, "%s/", fpath + gl_pathOffset) >= 100){	//If path truncated
+			printf("File path length doesn't fit in tar format, try archiving from a deeper root directory\n");
+			printf("%s\n", fpath + gl_pathOffset);
+			free(member->path);
+			free(member);
+			return 1;														//exits walk for post cleanup
+		}
+		header->type[0] = '5';												//type '5' indicates directory
+	}
+	else {																	//no trailing '/'
+		if (snprintf(header->name, 100, "%s", fpath + gl_pathOffset) >= 100){	
+			printf("File path length doesn't fit in tar format, try archiving from a deeper root directory\n");
+			printf("%s\n", fpath + gl_pathOffset);
+			free(member->path);
+			free(member);
+			return 1;														//exits walk for post cleanup
+		}
+		header->type[0] = '0';												//type '0' indicates regular file
+		if (sb->st_nlink > 1){
+			member->linked = 1;
+			member->dev = sb->st_dev;
+			member->ino = sb->st_ino;
+		}
+		if (member->linked && linkFirst(sb, fpath + gl_pathOffset, header->link)){	//already archived under
+			header->type[0] = '1';											//another name, type '1'
+			octalPut(header->size, 11, 0);									//is a hard link to it
+			member->size = 0;
+			member->headerOnly = 1;
+			member->direct = member->sparse = member->split = 0;
+		}
+		if (sb->st_nlink > 1 && gl_nout > 1){								//every name of an inode goes to
+			member->out = &gl_out[(sb->st_dev * 31 + sb->st_ino) % gl_nout];	//the same shard
+		}
+	}
+	
+	headerChecksum(header);
+	statsAdd(PHASE_HEADER, start);
+	if (S_ISDIR(sb->st_mode)){
+		gl_statDirs++;
+	}
+	else if (header->type[0] == '1'){
+		gl_statLinks++;
+	}
+	else {
+		gl_totalBytes += member->size;					//files are counted as the readers finish them
+	}
+	if (member->split){									//opened once for all of its readers, if it can't
+		member->started = statsTimer();					//be readMember() reports it
+		if ((member->fd = open(fpath, O_RDONLY | O_CLOEXEC)) == -1 ||
+			!(member->crcs = malloc((member->size / SPLIT_RANGE + 1) * sizeof(uint32_t)))){
+			if (member->fd != -1){
+				close(member->fd);
+			}
+			member->split = 0;
+		}
+		else {
+			posix_fadvise(member->fd, 0, 0, gl_noCache ? POSIX_FADV_NOREUSE : POSIX_FADV_NORMAL);
+			member->hashing = gl_checksum;
+			member->rangesLeft = (member->size + SPLIT_RANGE - 1) / SPLIT_RANGE;
+		}
+	}
+
+	pipeQueue(member);									//hand over to the readers and writer
+	return 0;											//continue to next file
+}
+
+/*	Struct WalkNode  -typedef-  Node
+* One file or directory found by the parallel walk. Directories keep their children sorted by name so that
+* the archive order doesn't depend on which thread happened to read which directory first.
+*/
+typedef struct WalkNode{
+	char *path;						//full path, as nftw() would have passed it
+	int base;						//offset of the file name within path
+	int level;						//depth below the start directory
+	struct stat sb;					//stat of the entry (symlinks followed, like nftw() without FTW_PHYS)
+	struct WalkNode *parent;
+	struct WalkNode **children;		//sorted by name once 'scanned' is set
+	size_t nchildren;
+	int scanned;					//set once a worker has finished reading this directory
+	int claimed;					//set once a thread has started reading it, so only one does
+	int queued;						//sitting in a deque
+	int released;					//handed over while still queued, whoever takes it off the deque frees it
+}
+Node;
+
+/*	Struct WorkDeque  -typedef-  Deque
+* Per-thread queue of directories waiting to be read. The owning thread pushes and pops at the tail so it
+* works depth first through its own subtree, idle threads steal from the head which holds the oldest and
+* usually largest pieces of work.
+*/
+typedef struct WorkDeque{
+	pthread_mutex_t lock;
+	Node **tasks;
+	size_t head;
+	size_t tail;
+	size_t capacity;
+}
+Deque;
+
+/*	Walker Globals
+* gl_deques			Deque		one deque per walk thread
+* gl_walkLock		mutex		protects gl_queued, gl_walkNodes, gl_walkStop and every Node's 'scanned' and
+* 								'claimed' flags
+* gl_walkWork		cond		signalled when a directory is queued, when gl_walkNodes drops below
+* 								WALK_NODES or when the walk is stopped
+* gl_walkScanned	cond		signalled when a directory has been read, the writer waits on this
+* gl_queued			size_t		number of directories sitting in the deques
+* gl_walkNodes		size_t		entries read but not yet handed to 'fn', the workers wait at WALK_NODES
+* gl_walkStop		int			set by the writer when it no longer needs the workers
+* gl_walkRoot		size_t		length of the start path plus its '/', the -e and -i rules see what follows
+*/
+Deque			*gl_deques;
+pthread_mutex_t	gl_walkLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t	gl_walkWork = PTHREAD_COND_INITIALIZER;
+pthread_cond_t	gl_walkScanned = PTHREAD_COND_INITIALIZER;
+size_t			gl_queued;
+size_t			gl_walkNodes;
+int				gl_walkStop;
+size_t			gl_walkRoot;
+
+/*	dequePush  -  returns void
+* Adds a directory to the tail of the given deque and wakes a sleeping worker to go and steal it.
+*
+* dq		Deque		deque of the thread that found the directory
+* node		Node		directory to be read
+*/
+void dequePush(Deque *dq, Node *node){
+	node->queued = 1;										//no other thread can see it yet
+	pthread_mutex_lock(&dq->lock);
+	if (dq->tail == dq->capacity){
+		if (dq->head > 0){									//slide the live tasks back to the start
+			memmove(dq->tasks, dq->tasks + dq->head, (dq->tail - dq->head) * sizeof(Node *));
+			dq->tail -= dq->head;
+			dq->head = 0;
+		}
+		else {												//or grow the array
+			dq->capacity = dq->capacity ? dq->capacity * 2 : 64;
+			if (!(dq->tasks = realloc(dq->tasks, dq->capacity * sizeof(Node *)))){
+				perror("realloc");
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+	dq->tasks[dq->tail++] = node;
+	pthread_mutex_unlock(&dq->lock);
+
+	pthread_mutex_lock(&gl_walkLock);
+	gl_queued++;
+	pthread_cond_signal(&gl_walkWork);
+	pthread_mutex_unlock(&gl_walkLock);
+}
+
+/*	dequeTake  -  returns Node
+* Takes a directory from the tail (owner) or the head (thief) of a deque and claims it for the calling thread
+* to read. Returns NULL if it is empty, or if the directory it took has already been read by emitNode(), in
+* which case it is freed here if emitNode() is done with it.
+*
+* dq		Deque		deque to take from
+* steal		int			non-zero when the calling thread doesn't own the deque
+*/
+Node *dequeTake(Deque *dq, int steal){
+	Node *node = NULL;
+	pthread_mutex_lock(&dq->lock);
+	if (dq->head < dq->tail){
+		node = steal ? dq->tasks[dq->head++] : dq->tasks[--dq->tail];
+		if (dq->head == dq->tail){
+			dq->head = dq->tail = 0;
+		}
+	}
+	pthread_mutex_unlock(&dq->lock);
+
+	if (node){
+		pthread_mutex_lock(&gl_walkLock);
+		gl_queued--;
+		node->queued = 0;
+		int released = node->released, claimed = node->claimed;
+		node->claimed = 1;
+		pthread_mutex_unlock(&gl_walkLock);
+		if (released){
+			free(node);
+		}
+		if (claimed){
+			return NULL;
+		}
+	}
+	return node;
+}
+
+/*	compareNodes  -  returns int
+* qsort comparator, orders the children of a directory by name.
+*/
+int compareNodes(const void *a, const void *b){
+	const Node *x = *(const Node **)a;
+	const Node *y = *(const Node **)b;
+	return strcmp(x->path + x->base, y->path + y->base);
+}
+
+/*	isCycle  -  returns int
+* Returns 1 if the directory 'node' is the same directory as one of its ancestors, which can only happen
+* through a symlink. nftw() doesn't descend into these either.
+*/
+int isCycle(Node *node){
+	for (Node *up = node->parent; up; up = up->parent){
+		if (up->sb.st_ino == node->sb.st_ino && up->sb.st_dev == node->sb.st_dev){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*	Struct OwnFile  -typedef-  OwnFile
+* A file this run writes to, the walk leaves it out wherever it turns up in the tree.
+*/
+typedef struct OwnFile{
+	dev_t dev;
+	ino_t ino;
+}
+OwnFile;
+
+/*	Own File Globals
+* gl_own			OwnFile		the archives, the journal and the -d store
+* gl_nown			int			number of them
+*/
+OwnFile			*gl_own;
+int				gl_nown;
+
+/*	ownAdd  -  returns void
+* Remembers the file open on 'fd' as one of this run's own. Called before the walk starts.
+*/
+void ownAdd(int fd){
+	struct stat sb;
+	if (fstat(fd, &sb) == -1){
+		return;
+	}
+	if (!(gl_own = realloc(gl_own, (gl_nown + 1) * sizeof(OwnFile)))){
+		perror("realloc");
+		exit(EXIT_FAILURE);
+	}
+	gl_own[gl_nown].dev = sb.st_dev;
+	gl_own[gl_nown++].ino = sb.st_ino;
+}
+
+/*	ownFile  -  returns int
+* Returns 1 if 'sb' is one of the files this run writes to.
+*/
+int ownFile(const struct stat *sb){
+	for (int i = 0; i < gl_nown; i++){
+		if (gl_own[i].ino == sb->st_ino && gl_own[i].dev == sb->st_dev){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*	scanDirectory  -  returns void
+* Reads one directory and fills in its children. Each entry is stat'd relative to the open directory with
+* fstatat() so the kernel doesn't resolve the whole path again for every file. d_type lets us drop fifos,
+* sockets and devices without a stat at all - backup can't archive them and fopen() blocks on a fifo - and
+* apply the -e and -i rules before the stat, so an excluded directory is never even opened. Sub-directories
+* are pushed onto this thread's deque for any thread to read.
+*
+* node		Node		directory to read
+* dq		Deque		deque of the calling thread
+*/
+void scanDirectory(Node *node, Deque *dq){
+	size_t capacity = 0;
+	int fd;
+	DIR *dir = NULL;
+
+	errno = 0;
+	if ((fd = open(node->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1 || !(dir = fdopendir(fd))){
+		perror("opendir");											//archive the directory itself but
+		printf("directory not read: %s\n", node->path);				//none of its contents
+		if (fd != -1){
+			close(fd);
+		}
+	}
+
+	struct dirent *entry;
+	for (;;){
+		uint64_t start = statsTimer();
+		entry = dir ? readdir(dir) : NULL;
+		statsAdd(PHASE_WALK, start);
+		if (!entry){
+			break;
+		}
+		const char *name = entry->d_name;
+		if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))){
+			continue;
+		}
+		if (entry->d_type == DT_FIFO || entry->d_type == DT_SOCK ||
+			entry->d_type == DT_CHR || entry->d_type == DT_BLK){
+			continue;												//not archivable, skip without a stat
+		}
+
+		Node *child = calloc(1, sizeof(Node));
+		size_t length = strlen(node->path);
+		if (!child || !(child->path = malloc(length + strlen(name) + 2))){
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		sprintf(child->path, "%s/%s", node->path, name);
+		child->base = length + 1;
+		child->level = node->level + 1;
+		child->parent = node;
+		int typed = entry->d_type == DT_DIR || entry->d_type == DT_REG;		//else only the stat can tell
+		if (entry->d_type == DT_DIR && resumeDone(child->path + gl_pathOffset)){
+			free(child->path);
+			free(child);
+			continue;
+		}
+		if (typed && filterActive() &&
+			filterExcluded(child->path + gl_walkRoot, child->base - gl_walkRoot, entry->d_type == DT_DIR)){
+			gl_statSkipped++;
+			free(child->path);
+			free(child);
+			continue;
+		}
+
+		errno = 0;
+		start = statsTimer();
+		int failed = fstatat(fd, name, &child->sb, 0) == -1;
+		statsAdd(PHASE_STAT, start);
+		if (!failed && !typed && filterActive() &&
+			filterExcluded(child->path + gl_walkRoot, child->base - gl_walkRoot, S_ISDIR(child->sb.st_mode))){
+			gl_statSkipped++;
+			free(child->path);
+			free(child);
+			continue;
+		}
+		if (!failed && !typed && S_ISDIR(child->sb.st_mode) && resumeDone(child->path + gl_pathOffset)){
+			free(child->path);
+			free(child);
+			continue;
+		}
+		if (!failed && ownFile(&child->sb)){
+			free(child->path);										//the archive, its journal or the
+			free(child);											//store, not part of the backup
+			continue;
+		}
+		if (failed || !(S_ISREG(child->sb.st_mode) || S_ISDIR(child->sb.st_mode))){
+			if (errno){
+				perror("fstatat");
+			}
+			printf("file skipped: %s\n", child->path);
+			free(child->path);
+			free(child);
+			errno = 0;
+			continue;
+		}
+		if (S_ISDIR(child->sb.st_mode) && isCycle(child)){
+			child->scanned = 1;										//archived, but not descended into
+		}
+
+		if (node->nchildren == capacity){
+			capacity = capacity ? capacity * 2 : 16;
+			if (!(node->children = realloc(node->children, capacity * sizeof(Node *)))){
+				perror("realloc");
+				exit(EXIT_FAILURE);
+			}
+		}
+		node->children[node->nchildren++] = child;
+	}
+	if (dir){
+		closedir(dir);
+	}
+
+	qsort(node->children, node->nchildren, sizeof(Node *), compareNodes);
+	for (size_t i = node->nchildren; i-- > 0;){					//pushed in reverse so that this thread
+		Node *child = node->children[i];							//pops them back in archive order
+		if (S_ISDIR(child->sb.st_mode) && !child->scanned){
+			dequePush(dq, child);
+		}
+	}
+
+	pthread_mutex_lock(&gl_walkLock);
+	node->scanned = 1;
+	gl_walkNodes += node->nchildren;
+	pthread_cond_broadcast(&gl_walkScanned);
+	pthread_mutex_unlock(&gl_walkLock);
+}
+
+/*	walkClaim  -  returns int
+* Returns 1 if no worker has taken the directory 'node' to read yet, emitNode() then reads it itself.
+*/
+int walkClaim(Node *node){
+	pthread_mutex_lock(&gl_walkLock);
+	int first = !node->claimed && !node->scanned;
+	node->claimed = 1;
+	pthread_mutex_unlock(&gl_walkLock);
+	return first;
+}
+
+/*	walkWorker  -  returns void*
+* Thread body. Works through its own deque and steals from the others when it runs dry, sleeping when
+* there is nothing queued anywhere until either more work turns up or the walk is stopped. It also sleeps
+* while WALK_NODES entries are waiting to be archived, so the walk can't run away from a slow archive with
+* the whole tree in memory.
+*
+* arg		long		index of this thread's deque
+*/
+void *walkWorker(void *arg){
+	long id = (long)arg;
+	for (;;){
+		pthread_mutex_lock(&gl_walkLock);
+		while (gl_walkNodes >= WALK_NODES && !gl_walkStop){
+			pthread_cond_wait(&gl_walkWork, &gl_walkLock);
+		}
+		pthread_mutex_unlock(&gl_walkLock);
+
+		Node *node = dequeTake(&gl_deques[id], 0);
+		for (int i = 1; !node && i < gl_threads; i++){
+			node = dequeTake(&gl_deques[(id + i) % gl_threads], 1);
+		}
+		if (node){
+			scanDirectory(node, &gl_deques[id]);
+			continue;
+		}
+
+		pthread_mutex_lock(&gl_walkLock);
+		while (gl_queued == 0 && !gl_walkStop){
+			pthread_cond_wait(&gl_walkWork, &gl_walkLock);
+		}
+		int stop = gl_walkStop;
+		pthread_mutex_unlock(&gl_walkLock);
+		if (stop){
+			return NULL;
+		}
+	}
+}
+
+/*	emitNode  -  returns int
+* Passes 'node' and then everything beneath it to 'fn' in depth first, name sorted order, so each directory
+* is always archived before its contents. A directory no worker has started on yet is read here, which
+* also keeps things moving while the workers wait for gl_walkNodes to go down, otherwise this waits for the
+* worker reading it. Each child is freed once it has been handed over. Returns the first non-zero value
+* from 'fn', like nftw().
+*
+* node		Node		entry to emit
+* fn		function	nftw() style callback, 'backup' in this program
+*/
+int emitNode(Node *node, int (*fn)(const char *, const struct stat *, int, struct FTW *)){
+	struct FTW ftwbuf = { node->base, node->level };
+	int isDir = S_ISDIR(node->sb.st_mode);
+	int ret = fn(node->path, &node->sb, isDir ? FTW_D : FTW_F, &ftwbuf);
+	if (ret != 0 || !isDir){
+		return ret;
+	}
+
+	if (walkClaim(node)){
+		scanDirectory(node, &gl_deques[0]);
+	}
+	pthread_mutex_lock(&gl_walkLock);
+	while (!node->scanned){
+		pthread_cond_wait(&gl_walkScanned, &gl_walkLock);
+	}
+	pthread_mutex_unlock(&gl_walkLock);
+
+	for (size_t i = 0; i < node->nchildren; i++){
+		Node *child = node->children[i];
+		if (ret == 0){
+			ret = emitNode(child, fn);
+		}
+		if (ret == 0){												//on failure the workers may still be
+			free(child->children);									//reading beneath this child
+			free(child->path);
+			pthread_mutex_lock(&gl_walkLock);
+			int queued = child->queued;								//read here, but still in a deque
+			child->released = 1;
+			if (gl_walkNodes-- == WALK_NODES){
+				pthread_cond_broadcast(&gl_walkWork);				//room to read ahead again
+			}
+			pthread_mutex_unlock(&gl_walkLock);
+			if (!queued){
+				free(child);
+			}
+		}
+	}
+	if (ret == 0){
+		free(node->children);
+		node->children = NULL;
+	}
+	return ret;
+}
+
+/*	walk  -  returns int
+* Drop in replacement for nftw(path, fn, ...) that reads directories on 'gl_threads' threads. The calling
+* thread is the only one that runs 'fn', in a deterministic order. Returns 0 on success, -1 if the start path
+* couldn't be stat'd, or the first non-zero return of 'fn'.
+*
+* path		char		directory to start from
+* fn		function	callback run for every file and directory
+*/
+int walk(const char *path, int (*fn)(const char *, const struct stat *, int, struct FTW *)){
+	Node root;
+	memset(&root, 0, sizeof(Node));
+	if (stat(path, &root.sb) == -1){
+		return -1;
+	}
+	if (!(root.path = strdup(path))){
+		return -1;
+	}
+	const char *slash = strrchr(path, '/');
+	root.base = slash && slash[1] ? slash - path + 1 : 0;
+	gl_walkRoot = strlen(path) + 1;
+
+	if (gl_threads < 1){
+		gl_threads = 1;
+	}
+	pthread_t threads[gl_threads];
+	if (!(gl_deques = calloc(gl_threads, sizeof(Deque)))){
+		return -1;
+	}
+	for (int i = 0; i < gl_threads; i++){
+		pthread_mutex_init(&gl_deques[i].lock, NULL);
+	}
+	gl_walkStop = 0;
+	gl_walkNodes = 0;
+	if (S_ISDIR(root.sb.st_mode)){
+		dequePush(&gl_deques[0], &root);
+	}
+	else {
+		root.scanned = 1;
+	}
+	for (long i = 0; i < gl_threads; i++){
+		if (pthread_create(&threads[i], NULL, walkWorker, (void *)i) != 0){
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	int ret = emitNode(&root, fn);
+
+	pthread_mutex_lock(&gl_walkLock);
+	gl_walkStop = 1;
+	pthread_cond_broadcast(&gl_walkWork);
+	pthread_mutex_unlock(&gl_walkLock);
+	for (int i = 0; i < gl_threads; i++){
+		pthread_join(threads[i], NULL);
+	}
+	for (int i = 0; i < gl_threads; i++){						//every thread may take from every deque
+		pthread_mutex_destroy(&gl_deques[i].lock);
+		free(gl_deques[i].tasks);
+	}
+	free(gl_deques);
+	free(root.path);
+	return ret;
+}
+
+/*	Struct ArchiveReader  -typedef-  Reader
+* The archive restore reads from. A regular file is mapped into memory whole so headers are decoded where
+* they lie without any system calls, anything else (a pipe, a fifo, a tape) is read as a stream from 'fd'.
+* An archive written with -z is mapped as well and its frames are decompressed on demand, by whichever
+* thread needs them. Offsets and 'size' are always positions in the uncompressed tar data.
+*/
+typedef struct ArchiveReader{
+	int fd;
+	uint64_t id;					//different for every archive opened, to tell cached frames apart
+	char *path;						//as given to readerOpen()
+	const char *map;				//the whole archive, NULL when streaming
+	off_t size;						//size of the tar data in the archive
+	int compressed;					//the map holds -z frames
+	off_t *frames;					//compressed offset of each frame, plus one for the end of the last
+	off_t *frameStarts;				//tar offset of each frame's data, plus one for the end of the data
+	size_t nframes;
+	char *stream;					//STREAM_BUFFER read ahead of a streamed archive
+	size_t streamAt;				//next byte of 'stream' restore hasn't used
+	size_t streamEnd;				//end of what has been read into 'stream'
+}
+Reader;
+
+/*	Struct InflateJob  -typedef-  Inflater
+* A compressed stream being decompressed into a pipe by its own thread, so that the rest of restore can
+* treat it like any other stream.
+*/
+typedef struct InflateJob{
+	int in;
+	int out;
+	char first[BLOCK_SIZE];			//bytes already read from 'in'
+	size_t firstLength;
+}
+Inflater;
+
+/*	inflateWorker  -  returns void*
+* Thread body that decompresses a gzip stream, any number of members long, into a pipe. It closes the pipe
+* at the end of the stream, or early on an error which restore then reports as a short archive.
+*/
+void *inflateWorker(void *arg){
+	Inflater *job = arg;
+	z_stream zs;
+	memset(&zs, 0, sizeof(z_stream));
+	unsigned char *in = malloc(COPY_BUFFER), *out = malloc(COPY_BUFFER);
+	if (!in || !out || inflateInit2(&zs, 15 + 16) != Z_OK){
+		printf("inflateInit2: failed\n");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(in, job->first, job->firstLength);
+	zs.next_in = in;
+	zs.avail_in = job->firstLength;
+
+	for (;;){
+		if (zs.avail_in == 0){
+			ssize_t got = read(job->in, in, COPY_BUFFER);
+			if (got == -1 && errno == EINTR){
+				continue;
+			}
+			if (got <= 0){
+				break;										//end of the stream
+			}
+			zs.next_in = in;
+			zs.avail_in = got;
+		}
+		zs.next_out = out;
+		zs.avail_out = COPY_BUFFER;
+		int ret = inflate(&zs, Z_NO_FLUSH);
+		writeAll(job->out, (char *)out, COPY_BUFFER - zs.avail_out);
+		if (ret == Z_STREAM_END){
+			inflateReset(&zs);								//the next frame is another gzip member
+		}
+		else if (ret != Z_OK && ret != Z_BUF_ERROR){
+			printf("inflate: %s\n", zs.msg ? zs.msg : "corrupt data");
+			break;
+		}
+	}
+	inflateEnd(&zs);
+	close(job->out);
+	close(job->in);
+	free(in);
+	free(out);
+	free(job);
+	return NULL;
+}
+
+/*	isFramed  -  returns size_t
+* Returns the compressed size of the -z frame starting at 'at', or 0 if there isn't one there.
+*/
+size_t isFramed(const unsigned char *at, off_t available){
+	if (available < FRAME_HEADER || at[0] != 0x1f || at[1] != 0x8b || at[2] != 8 || !(at[3] & 4) ||
+		at[10] != 12 || at[11] != 0 || at[12] != 'T' || at[13] != 'F' || at[14] != 8 || at[15] != 0){
+		return 0;
+	}
+	size_t length = at[16] | at[17] << 8 | at[18] << 16 | (uint32_t)at[19] << 24;
+	return length > FRAME_HEADER + 8 && length <= available ? length : 0;
+}
+
+/*	buildFrames  -  returns int
+* Fills in the frame table of a mapped -z archive by hopping from one frame header to the next, reading
+* nothing but the headers. Returns 0 on success, -1 if the frames don't cover the file exactly.
+*/
+int buildFrames(Reader *r, off_t fileSize){
+	const unsigned char *map = (const unsigned char *)r->map;
+	size_t capacity = 0;
+	off_t at = 0, tarSize = 0;
+	madvise((char *)r->map, fileSize, MADV_RANDOM);			//only the headers are touched
+	for (;;){
+		if (r->nframes + 1 >= capacity){
+			capacity = capacity ? capacity * 2 : 1024;
+			if (!(r->frames = realloc(r->frames, capacity * sizeof(off_t))) ||
+				!(r->frameStarts = realloc(r->frameStarts, capacity * sizeof(off_t)))){
+				perror("realloc");
+				exit(EXIT_FAILURE);
+			}
+		}
+		r->frames[r->nframes] = at;
+		r->frameStarts[r->nframes] = tarSize;
+		if (at == fileSize){
+			break;
+		}
+		size_t length = isFramed(map + at, fileSize - at);
+		if (length == 0){
+			return -1;
+		}
+		tarSize += map[at + 20] | map[at + 21] << 8 | map[at + 22] << 16 | (uint32_t)map[at + 23] << 24;
+		at += length;
+		r->nframes++;
+	}
+	r->size = tarSize;
+	r->compressed = 1;
+	madvise((char *)r->map, fileSize, MADV_SEQUENTIAL);
+	return 0;
+}
+
+/*	frameData  -  returns const char*
+* Returns the decompressed data of frame 'frame'. Each thread keeps the last frame it decompressed, so
+* reading through a frame a piece at a time only decompresses it once, and threads never share a buffer.
+*/
+const char *frameData(const Reader *r, size_t frame){
+	static __thread char *data;
+	static __thread size_t cached = SIZE_MAX;
+	static __thread uint64_t cachedId;
+	if (cached == frame && cachedId == r->id){
+		return data;
+	}
+	if (!data && !(data = malloc(WRITE_BUFFER))){
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	const unsigned char *at = (const unsigned char *)r->map + r->frames[frame];
+	size_t length = r->frames[frame + 1] - r->frames[frame];
+	size_t expected = r->frameStarts[frame + 1] - r->frameStarts[frame];
+
+	z_stream zs;
+	memset(&zs, 0, sizeof(z_stream));
+	zs.next_in = (unsigned char *)at + FRAME_HEADER;
+	zs.avail_in = length - FRAME_HEADER - 8;
+	zs.next_out = (unsigned char *)data;
+	zs.avail_out = WRITE_BUFFER;
+	if (expected > WRITE_BUFFER || inflateInit2(&zs, -15) != Z_OK || inflate(&zs, Z_FINISH) != Z_STREAM_END ||
+		zs.total_out != expected){
+		printf("Frame %zu is corrupt, tar file possibly corrupted\n", frame);
+		exit(EXIT_FAILURE);
+	}
+	inflateEnd(&zs);
+	const unsigned char *trailer = at + length - 8;
+	uint32_t crc = trailer[0] | trailer[1] << 8 | trailer[2] << 16 | (uint32_t)trailer[3] << 24;
+	if (crc != crc32(0, (unsigned char *)data, expected)){
+		printf("Frame %zu fails its crc, tar file possibly corrupted\n", frame);
+		exit(EXIT_FAILURE);
+	}
+	cached = frame;
+	cachedId = r->id;
+	return data;
+}
+
+/*	findFrame  -  returns size_t
+* Binary search for the frame holding tar offset 'offset'.
+*/
+size_t findFrame(const Reader *r, off_t offset){
+	size_t low = 0, high = r->nframes;
+	while (high - low > 1){
+		size_t middle = low + (high - low) / 2;
+		if (r->frameStarts[middle] <= offset){
+			low = middle;
+		}
+		else {
+			high = middle;
+		}
+	}
+	return low;
+}
+
+/*	readerOpen  -  returns int
+* Opens the archive at 'path' for restore, "-" for standard input, and maps it if it is a regular file. The
+* map is advised for sequential access since restore works forwards through it. A gzip archive that wasn't
+* written with -z, or any compressed stream, is decompressed by a thread into a pipe and read as a stream.
+* A stream is read through a STREAM_BUFFER, and a pipe is asked to hold that much so the writer at the other
+* end isn't held up a page at a time. Returns 0 on success, -1 with errno set.
+*/
+int readerOpen(Reader *r, const char *path){
+	static _Atomic uint64_t opened;
+	struct stat sb;
+	memset(r, 0, sizeof(Reader));
+	r->id = ++opened;
+	if (!(r->path = strdup(path))){
+		return -1;
+	}
+	r->fd = strcmp(path, "-") == 0 ? fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0) : open(path, O_RDONLY | O_CLOEXEC);
+	if (r->fd == -1 || fstat(r->fd, &sb) == -1){
+		return -1;
+	}
+	if (S_ISREG(sb.st_mode) && sb.st_size > 0){
+		void *map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, r->fd, 0);
+		if (map != MAP_FAILED){
+			const unsigned char *bytes = map;
+			r->map = map;
+			r->size = sb.st_size;
+			madvise(map, sb.st_size, MADV_SEQUENTIAL);
+			if (bytes[0] != 0x1f || bytes[1] != 0x8b || buildFrames(r, sb.st_size) == 0){
+				return 0;
+			}
+			munmap(map, sb.st_size);								//some other gzip, stream it
+			r->map = NULL;
+			r->size = 0;
+		}
+	}
+	if (S_ISFIFO(sb.st_mode)){
+		fcntl(r->fd, F_SETPIPE_SZ, STREAM_BUFFER);				//only a request, it may be over the limit
+	}
+	if (!(r->stream = malloc(STREAM_BUFFER))){
+		return -1;
+	}
+
+	r->streamEnd = readFull(r->fd, r->stream, BLOCK_SIZE);	//enough to tell whether it's compressed
+	if (r->streamEnd < 2 || (unsigned char)r->stream[0] != 0x1f || (unsigned char)r->stream[1] != 0x8b){
+		return 0;												//plain tar stream
+	}
+	int fds[2];
+	Inflater *job;
+	pthread_t thread;
+	if (pipe(fds) == -1 || !(job = malloc(sizeof(Inflater)))){
+		return -1;
+	}
+	fcntl(fds[0], F_SETPIPE_SZ, STREAM_BUFFER);
+	job->in = r->fd;
+	job->out = fds[1];
+	memcpy(job->first, r->stream, r->streamEnd);
+	job->firstLength = r->streamEnd;
+	if (pthread_create(&thread, NULL, inflateWorker, job) != 0){
+		return -1;
+	}
+	pthread_detach(thread);
+	r->fd = fds[0];
+	r->streamEnd = 0;
+	return 0;
+}
+
+/*	readerClose  -  returns void
+* Unmaps and closes an archive opened by readerOpen().
+*/
+void readerClose(Reader *r){
+	if (r->map){
+		munmap((void *)r->map, r->frames ? r->frames[r->nframes] : r->size);
+	}
+	dropFile(r->fd, 0);
+	free(r->path);
+	free(r->frames);
+	free(r->frameStarts);
+	free(r->stream);
+	close(r->fd);
+	memset(r, 0, sizeof(Reader));
+}
+
+/*	streamFill  -  returns size_t
+* Refills a streamed archive's buffer with a single read(), which on a pipe returns whatever has arrived
+* instead of waiting for the whole buffer. Only called once the buffer is used up. Returns the number of
+* bytes now buffered, 0 at the end of the archive.
+*/
+size_t streamFill(Reader *r){
+	uint64_t start = statsTimer();
+	ssize_t got;
+	while ((got = read(r->fd, r->stream, STREAM_BUFFER)) == -1 && errno == EINTR){
+	}
+	if (got == -1){
+		perror("read");
+	}
+	statsAdd(PHASE_READ, start);
+	r->streamAt = 0;
+	r->streamEnd = got > 0 ? got : 0;
+	return r->streamEnd;
+}
+
+/*	streamRead  -  returns size_t
+* readFull() for a streamed archive, out of its buffer so a header or a small member costs no read() of its
+* own. What's left of a read too big to be worth buffering goes straight into 'data'. Returns the number of
+* bytes read, short if the archive ended first.
+*/
+size_t streamRead(Reader *r, char *data, size_t length){
+	size_t total = 0;
+	while (total < length){
+		if (r->streamAt == r->streamEnd){
+			if (length - total >= STREAM_BUFFER){
+				return total + readFull(r->fd, data + total, length - total);
+			}
+			if (streamFill(r) == 0){
+				break;
+			}
+		}
+		size_t part = r->streamEnd - r->streamAt;
+		if (part > length - total){
+			part = length - total;
+		}
+		memcpy(data + total, r->stream + r->streamAt, part);
+		r->streamAt += part;
+		total += part;
+	}
+	return total;
+}
+
+/*	streamSkip  -  returns int
+* Reads past 'length' bytes of a streamed archive, through its buffer. Returns -1 if the archive ends first.
+*/
+int streamSkip(Reader *r, off_t length){
+	while (length > 0){
+		if (r->streamAt == r->streamEnd && streamFill(r) == 0){
+			return -1;
+		}
+		size_t part = r->streamEnd - r->streamAt;
+		if ((off_t)part > length){
+			part = length;
+		}
+		r->streamAt += part;
+		length -= part;
+	}
+	return 0;
+}
+
+/*	streamCopy  -  returns off_t
+* copyData() for a streamed archive. What is already buffered is written out first, then a member that still
+* has a STREAM_BUFFER or more to go is left to the kernel and a smaller one goes through the buffer. Returns
+* the number of bytes copied, short if the archive ended first.
+*/
+off_t streamCopy(Reader *r, int out, off_t length){
+	off_t total = 0;
+	while (total < length){
+		if (r->streamAt == r->streamEnd){
+			if (length - total >= STREAM_BUFFER){
+				return total + copyData(r->fd, NULL, out, length - total);
+			}
+			if (streamFill(r) == 0){
+				break;
+			}
+		}
+		size_t part = r->streamEnd - r->streamAt;
+		if ((off_t)part > length - total){
+			part = length - total;
+		}
+		writeAll(out, r->stream + r->streamAt, part);
+		r->streamAt += part;
+		total += part;
+	}
+	return total;
+}
+
+/*	headerAt  -  returns const Header*
+* Returns the header at archive offset 'index', or NULL if there isn't a whole block there. For a -z archive
+* the pointer is into the calling thread's decompressed frame and is good until it reads another frame.
+*/
+const Header *headerAt(const Reader *r, off_t index){
+	if (index < 0 || index + BLOCK_SIZE > r->size){
+		return NULL;
+	}
+	if (!r->compressed){
+		return (const Header *)(r->map + index);
+	}
+	size_t frame = findFrame(r, index);
+	if (index + BLOCK_SIZE > r->frameStarts[frame + 1]){		//frames are whole blocks, except in an
+		return NULL;											//archive that's been tampered with
+	}
+	return (const Header *)(frameData(r, frame) + (index - r->frameStarts[frame]));
+}
+
+/*	readerCopy  -  returns off_t
+* Copies 'length' bytes of member data starting at tar offset 'offset' to 'out', decompressing frames as
+* needed. A streamed archive is copied from wherever it has got to, 'offset' is ignored. Returns the number
+* of bytes copied, short if the archive ended first.
+*/
+off_t readerCopy(Reader *r, off_t offset, int out, off_t length){
+	if (!r->map){
+		return streamCopy(r, out, length);
+	}
+	if (!r->compressed){
+		return copyData(r->fd, &offset, out, length);			//positional, safe to share the fd
+	}
+	off_t total = 0;
+	while (total < length && offset < r->size){
+		size_t frame = findFrame(r, offset);
+		const char *data = frameData(r, frame);
+		off_t within = offset - r->frameStarts[frame];
+		off_t part = r->frameStarts[frame + 1] - offset;
+		if (part > length - total){
+			part = length - total;
+		}
+		writeAll(out, data + within, part);
+		offset += part;
+		total += part;
+	}
+	return total;
+}
+
+/*	readerRead  -  returns off_t
+* readerCopy() into memory, for member data the restore needs to look at itself. Returns the number of bytes
+* read, short if the archive ended first.
+*/
+off_t readerRead(Reader *r, off_t offset, char *buffer, off_t length){
+	if (!r->map){
+		return streamRead(r, buffer, length);
+	}
+	if (offset >= r->size){
+		return 0;
+	}
+	if (length > r->size - offset){
+		length = r->size - offset;
+	}
+	if (!r->compressed){
+		memcpy(buffer, r->map + offset, length);
+		return length;
+	}
+	off_t total = 0;
+	while (total < length){
+		size_t frame = findFrame(r, offset);
+		off_t part = r->frameStarts[frame + 1] - offset;
+		if (part > length - total){
+			part = length - total;
+		}
+		memcpy(buffer + total, frameData(r, frame) + (offset - r->frameStarts[frame]), part);
+		offset += part;
+		total += part;
+	}
+	return total;
+}
+
+/*	readerHash  -  returns off_t
+* Continues 'crc' over 'length' bytes of member data starting at tar offset 'offset', hashing the map or the
+* decompressed frames where they lie. A streamed archive is read from wherever it has got to. Returns the
+* number of bytes hashed, short if the archive ended first.
+*/
+off_t readerHash(Reader *r, off_t offset, off_t length, uint32_t *crc){
+	off_t total = 0;
+	if (!r->map){
+		while (total < length){								//hashed where it lies in the buffer
+			if (r->streamAt == r->streamEnd && streamFill(r) == 0){
+				break;
+			}
+			size_t part = r->streamEnd - r->streamAt;
+			if ((off_t)part > length - total){
+				part = length - total;
+			}
+			uint64_t start = statsTimer();
+			*crc = crc32c(*crc, r->stream + r->streamAt, part);
+			statsAdd(PHASE_HASH, start);
+			r->streamAt += part;
+			total += part;
+		}
+		return total;
+	}
+	if (length > r->size - offset){
+		length = offset < r->size ? r->size - offset : 0;
+	}
+	while (total < length){
+		const char *data;
+		off_t part = length - total;
+		if (!r->compressed){
+			data = r->map + offset;
+		}
+		else {
+			size_t frame = findFrame(r, offset);
+			data = frameData(r, frame) + (offset - r->frameStarts[frame]);
+			if (part > r->frameStarts[frame + 1] - offset){
+				part = r->frameStarts[frame + 1] - offset;
+			}
+		}
+		uint64_t start = statsTimer();
+		*crc = crc32c(*crc, data, part);
+		statsAdd(PHASE_HASH, start);
+		offset += part;
+		total += part;
+	}
+	return total;
+}
+
+/*	readerPut  -  returns off_t
+* readerCopy() of a mapped archive to 'outOffset' in 'out' with pwrite(), so that several threads can fill
+* in the one file at once. Returns the number of bytes copied, short if the archive ended first.
+*/
+off_t readerPut(const Reader *r, off_t offset, int out, off_t outOffset, off_t length){
+	off_t total = 0;
+	if (length > r->size - offset){
+		length = offset < r->size ? r->size - offset : 0;
+	}
+	while (total < length){
+		const char *data;
+		off_t part = length - total < CHUNK_SIZE ? length - total : CHUNK_SIZE;
+		if (!r->compressed){
+			data = r->map + offset;
+		}
+		else {
+			size_t frame = findFrame(r, offset);
+			data = frameData(r, frame) + (offset - r->frameStarts[frame]);
+			if (part > r->frameStarts[frame + 1] - offset){
+				part = r->frameStarts[frame + 1] - offset;
+			}
+		}
+		uint64_t start = statsTimer();
+		for (off_t done = 0; done < part;){
+			ssize_t put = pwrite(out, data + done, part - done, outOffset + done);
+			if (put == -1 && errno != EINTR){
+				perror("pwrite");
+				exit(EXIT_FAILURE);
+			}
+			done += put == -1 ? 0 : put;
+		}
+		statsAdd(PHASE_WRITE, start);
+		offset += part;
+		outOffset += part;
+		total += part;
+	}
+	return total;
+}
+
+/*	Struct RestoreEntry  -typedef-  Entry
+* One member of the archive as found by the header pre-scan, everything needed to restore it without going
+* back to its header.
+*/
+typedef struct RestoreEntry{
+	char *name;
+	mode_t mode;
+	uid_t uid;
+	gid_t gid;
+	time_t mtime;
+	off_t size;
+	off_t data;						//archive offset of the member's data
+	char type;						//'5' directory, '0' regular file, 'W' whiteout of a deleted file,
+									//'C' chunk list of a file archived with -d, 'S' sparse file,
+									//'1' hard link to 'link'
+	char hashed;					//'crc' was recorded by backup -c
+	uint32_t crc;					//CRC32C of the member's data as archived
+	char *link;						//target of a hard link, NULL otherwise
+	Reader *in;						//the archive, or the shard, the member is in
+}
+Entry;
+
+/*	Restore Globals
+* gl_entries		Entry		every member of the archive in archive order
+* gl_nentries		size_t		number of members
+* gl_entriesCapacity size_t	number of members gl_entries has room for
+* gl_nextEntry		size_t		next member for a restore thread to take
+* gl_restoreLock	mutex		protects gl_nextEntry
+*/
+Entry			*gl_entries;
+size_t			gl_nentries;
+size_t			gl_entriesCapacity;
+size_t			gl_nextEntry;
+pthread_mutex_t	gl_restoreLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*	Struct SplitFile  -typedef-  SplitFile
+* A big file restored by several threads at once, each filling in a SPLIT_RANGE of it.
+*/
+typedef struct SplitFile{
+	Entry *entry;
+	int file;						//-1 until the thread with the first range has created it
+	off_t claimed;					//bytes of the file handed out to threads
+	size_t rangesLeft;				//ranges not restored yet
+	uint64_t started;
+}
+SplitFile;
+
+/*	Split Globals
+* gl_splits			SplitFile	the big files of the table, in table order
+* gl_nsplits		size_t		number of big files
+* gl_nextSplit		size_t		the next one the restore threads will come to, protected by gl_restoreLock
+* gl_splitOpened	cond		signalled when a big file has been created, with gl_restoreLock
+*/
+SplitFile		*gl_splits;
+size_t			gl_nsplits;
+size_t			gl_nextSplit;
+pthread_cond_t	gl_splitOpened = PTHREAD_COND_INITIALIZER;
+
+/*	Struct DirectoryMeta  -typedef-  DirectoryMeta
+* Owner, mode and time of a restored directory, held back until nothing more will be created inside it.
+*/
+typedef struct DirectoryMeta{
+	char *name;
+	size_t order;					//position in the archive, a later copy of a directory replaces an earlier one
+	time_t mtime;
+	uid_t uid;
+	gid_t gid;
+	mode_t mode;
+}
+DirectoryMeta;
+
+/*	Directory Globals
+* gl_dirs			DirectoryMeta	directories restored from the current archive, in archive order
+* gl_ndirs			size_t			number of directories
+* gl_dirsCapacity	size_t			number of directories gl_dirs has room for
+*/
+DirectoryMeta	*gl_dirs;
+size_t			gl_ndirs;
+size_t			gl_dirsCapacity;
+
+/*	Selection Globals
+* gl_select			char		paths or glob patterns given to restore with -x
+* gl_nselect		int			number of patterns
+* gl_list			int			set by -l, list the members instead of restoring them
+* gl_index			IndexHead	the archive's index mapped into memory, NULL if it has none
+* gl_inputs			Reader		the archive being restored, or all of its shards
+* gl_ninputs		int			number of readers in gl_inputs
+* gl_in				Reader		the one of gl_inputs whose members are being read into the table
+*/
+char			**gl_select;
+int				gl_nselect;
+int				gl_list;
+const IndexHead	*gl_index;
+Reader			*gl_inputs;
+int				gl_ninputs;
+Reader			*gl_in;
+
+/*	indexLoad  -  returns const IndexHead*
+* Maps '<archive>.idx' if there is one and it matches the archive, otherwise returns NULL and the caller has
+* to fall back to reading every header.
+*
+* archivePath	char		path of the archive
+*/
+const IndexHead *indexLoad(const char *archivePath){
+	char path[PATH_MAX];
+	struct stat archiveStat, indexStat;
+	if (strcmp(archivePath, "-") == 0 || snprintf(path, PATH_MAX, "%s.idx", archivePath) >= PATH_MAX ||
+		fstat(gl_in->fd, &archiveStat) == -1){
+		return NULL;
+	}
+	int fd;
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1){
+		return NULL;
+	}
+	if (fstat(fd, &indexStat) == -1 || indexStat.st_size < sizeof(IndexHead)){
+		close(fd);
+		return NULL;
+	}
+	const IndexHead *head = mmap(NULL, indexStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (head == MAP_FAILED){
+		return NULL;
+	}
+	if (memcmp(head->magic, "TARIDX1", 8) != 0 || head->archiveSize != archiveStat.st_size ||
+		sizeof(IndexHead) + head->count * sizeof(Record) + head->namesSize != indexStat.st_size){
+		printf("Index doesn't match the archive, ignoring it: %s\n", path);
+		munmap((void *)head, indexStat.st_size);
+		return NULL;
+	}
+	return head;
+}
+
+/*	isSelected  -  returns int
+* Returns 1 if the member 'name' matches one of the -x patterns, or lies beneath a directory that does.
+*/
+int isSelected(const char *name){
+	char stripped[101];
+	snprintf(stripped, sizeof(stripped), "%s", name);
+	size_t length = strlen(stripped);
+	if (length > 1 && stripped[length - 1] == '/'){		//directories are stored with a trailing '/'
+		stripped[length - 1] = '\0';
+	}
+	for (int i = 0; i < gl_nselect; i++){
+		if (fnmatch(gl_select[i], stripped, FNM_LEADING_DIR) == 0){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*	addEntry  -  returns Entry*
+* Appends a blank entry to 'gl_entries' for a member of 'gl_in' and returns it.
+*/
+Entry *addEntry(){
+	if (gl_nentries == gl_entriesCapacity){
+		gl_entriesCapacity = gl_entriesCapacity ? gl_entriesCapacity * 2 : 1024;
+		if (!(gl_entries = realloc(gl_entries, gl_entriesCapacity * sizeof(Entry)))){
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+	Entry *entry = &gl_entries[gl_nentries++];
+	memset(entry, 0, sizeof(Entry));
+	entry->in = gl_in;
+	return entry;
+}
+
+/*	parseHeader  -  returns int
+* Decodes the 512 byte 'header' into 'entry' and checks its checksum. The fields are read where they lie,
+* names may contain spaces and fill all 100 bytes. Returns 1 for the empty block that marks the end of the
+* archive, 0 otherwise. A bad checksum is fatal.
+*
+* header	Header		the header block, in the map or in a buffer
+* entry		Entry		entry to fill in
+* index		off_t		archive offset of the header
+*/
+int parseHeader(const Header *header, Entry *entry, off_t index){
+	static const char zeros[BLOCK_SIZE];
+	if (memcmp(header, zeros, BLOCK_SIZE) == 0){
+		return 1;											//end of archive
+	}
+	uint64_t start = statsTimer();
+
+	uint64_t check = octalGet(header->checksum, sizeof(header->checksum));	//get checksum from tar header
+	if (check != headerSum(header)){						//check sum
+		printf("Checksum incorrect, tar file possibly corrupted\n");
+		exit(EXIT_FAILURE);	
+	}
+
+	if (!(entry->name = strndup(header->name, sizeof(header->name)))){
+		perror("strndup");
+		exit(EXIT_FAILURE);
+	}
+	entry->mode  = octalGet(header->mode, sizeof(header->mode));			//converts octal field into int
+	entry->uid   = octalGet(header->owner, sizeof(header->owner));
+	entry->gid   = octalGet(header->group, sizeof(header->group));
+	entry->mtime = octalGet(header->modified, sizeof(header->modified));
+	entry->type  = header->type[0];
+	entry->size  = entry->type == '5' ? 0 : octalGet(header->size, sizeof(header->size));
+	entry->data  = index + BLOCK_SIZE;
+	entry->link  = NULL;
+	if (entry->type == '1' && !(entry->link = strndup(header->link, sizeof(header->link)))){
+		perror("strndup");
+		exit(EXIT_FAILURE);
+	}
+	statsAdd(PHASE_HEADER, start);
+	return 0;
+}
+
+/*	fillEntry  -  returns void
+* Fills in an entry from the header at archive offset 'index' in the map.
+*/
+void fillEntry(Entry *entry, off_t index){
+	const Header *header = headerAt(gl_in, index);
+	if (!header || parseHeader(header, entry, index) != 0){
+		printf("Archive ended early, tar file possibly corrupted\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/*	Struct PaxRecords  -typedef-  Pax
+* What the pax extended header just before a member said about it, out of the records backup writes.
+*/
+typedef struct PaxRecords{
+	int hashed;						//'crc' was recorded by backup -c
+	uint32_t crc;
+	int whiteout;					//-g whiteout of a deleted file
+	char *sparseName;				//GNU sparse format 1.0, the file's real name
+}
+Pax;
+
+/*	readPax  -  returns int
+* Reads the records of the pax extended header member 'entry' into 'pax', replacing what it held, and looks
+* for what backup puts there for the member after it: the CRC32C of -c, the whiteout mark of -g and the name
+* of a file archived sparse. Returns 0, or -1 if the records were too big to read, which leaves them unread
+* in a stream.
+*/
+int readPax(const Entry *entry, Pax *pax){
+	free(pax->sparseName);
+	memset(pax, 0, sizeof(Pax));
+	if (entry->size > PAX_MAX){
+		return -1;
+	}
+	char *records = malloc(entry->size + 1);
+	if (!records){
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	if (readerRead(entry->in, entry->data, records, entry->size) < entry->size){
+		printf("Archive ended early, tar file possibly corrupted\n");
+		exit(EXIT_FAILURE);
+	}
+	size_t length, majorLength, minorLength;
+	const char *value = paxValue(records, entry->size, "BACKUP.crc32c", &length);
+	char hex[9];
+	if ((pax->hashed = value && length == 8)){
+		memcpy(hex, value, 8);
+		hex[8] = '\0';
+		pax->crc = strtoul(hex, NULL, 16);
+	}
+	value = paxValue(records, entry->size, "BACKUP.whiteout", &length);
+	pax->whiteout = value && length == 1 && value[0] == '1';
+	const char *major = paxValue(records, entry->size, "GNU.sparse.major", &majorLength);
+	const char *minor = paxValue(records, entry->size, "GNU.sparse.minor", &minorLength);
+	value = paxValue(records, entry->size, "GNU.sparse.name", &length);
+	if (major && majorLength == 1 && major[0] == '1' && minor && minorLength == 1 && minor[0] == '0' && value &&
+		!(pax->sparseName = strndup(value, length))){
+		perror("strndup");
+		exit(EXIT_FAILURE);
+	}
+	free(records);
+	return 0;
+}
+
+/*	paxApply  -  returns void
+* Applies the extended header before 'entry' to it and empties 'pax' for the next one. Only an empty file can
+* be a whiteout, the '.wh.' name alone never makes it one, another tar could hold a real file called that. A
+* sparse file's member is a regular file under a made up name, it gets its real name and type 'S' back.
+*/
+void paxApply(Entry *entry, Pax *pax){
+	entry->hashed = pax->hashed;
+	entry->crc = pax->crc;
+	if (pax->whiteout && entry->type == '0' && entry->size == 0){
+		entry->type = 'W';
+	}
+	if (pax->sparseName && entry->type == '0'){
+		free(entry->name);
+		entry->name = pax->sparseName;
+		entry->type = 'S';
+		pax->sparseName = NULL;
+	}
+	free(pax->sparseName);
+	memset(pax, 0, sizeof(Pax));
+}
+
+/*	compareEntries  -  returns int
+* qsort comparator, puts entries back in archive order.
+*/
+int compareEntries(const void *a, const void *b){
+	off_t x = ((const Entry *)a)->data, y = ((const Entry *)b)->data;
+	return (x > y) - (x < y);
+}
+
+/*	selectFromIndex  -  returns void
+* Fills 'gl_entries' with the members chosen by -x (or every member for a plain -l) using only the index,
+* in archive order. A plain path is found with a binary search over the sorted names, a glob is matched
+* against the names in the index. Either way the archive itself is only read at the chosen members' headers,
+* and not at all for -l. The chosen headers are all prefetched before any of them is decoded.
+*/
+void selectFromIndex(){
+	const Record *records = (const Record *)(gl_index + 1);
+	const char *names = (const char *)(records + gl_index->count);
+	size_t first = 0, last = gl_index->count;
+
+	if (gl_nselect == 1 && !strpbrk(gl_select[0], "*?[\\")){	//one plain path, only the names starting
+		const char *path = gl_select[0];						//with it can match
+		size_t length = strlen(path);
+		size_t low = 0, high = gl_index->count;
+		while (low < high){									//lower bound of 'path' in the sorted names
+			size_t middle = low + (high - low) / 2;
+			if (strcmp(names + records[middle].name, path) < 0){
+				low = middle + 1;
+			}
+			else {
+				high = middle;
+			}
+		}
+		first = last = low;
+		while (last < gl_index->count && strncmp(names + records[last].name, path, length) == 0){
+			last++;
+		}
+	}
+
+	size_t base = gl_nentries;
+	for (size_t i = first; i < last; i++){
+		const Record *record = &records[i];
+		if (gl_nselect > 0 && !isSelected(names + record->name)){
+			gl_statSkipped++;
+			continue;
+		}
+		Entry *entry = addEntry();								//everything -l prints is in the index
+		if (!(entry->name = strdup(names + record->name))){
+			perror("strdup");
+			exit(EXIT_FAILURE);
+		}
+		entry->mode  = record->mode;
+		entry->mtime = record->mtime;
+		entry->size  = record->size;
+		entry->type  = record->type;
+		entry->data  = record->offset + BLOCK_SIZE;
+		entry->hashed = record->hashed;
+		entry->crc   = record->crc;
+		if (!gl_list && !gl_in->compressed && record->offset < gl_in->size){	//start reading the header in
+			off_t page = record->offset & ~(off_t)(sysconf(_SC_PAGESIZE) - 1);
+			madvise((char *)gl_in->map + page, BLOCK_SIZE, MADV_WILLNEED);
+		}
+	}
+	qsort(gl_entries + base, gl_nentries - base, sizeof(Entry), compareEntries);	//back to archive order
+
+	for (size_t i = base; !gl_list && i < gl_nentries; i++){	//restore uses the archive's own headers
+		char *name = gl_entries[i].name, type = gl_entries[i].type;
+		fillEntry(&gl_entries[i], gl_entries[i].data - BLOCK_SIZE);
+		if (type == 'W' || type == 'S'){						//what the extended header said, which
+			free(gl_entries[i].name);							//the index already has
+			gl_entries[i].name = name;
+			gl_entries[i].type = type;
+		}
+		else {
+			free(name);
+		}
+	}
+}
+
+/*	listEntry  -  returns void
+* Prints one member in a form similar to 'ls -l'.
+*/
+void listEntry(const Entry *entry){
+	mode_t perm = entry->mode;
+	char permissions[11] = {									//creating permissions string in 'ls' form
+	entry->type == '5' ? 'd' : '-',								//ie. -rwxrwxrwx
+	(perm & S_IRUSR) ? 'r' : '-', (perm & S_IWUSR) ? 'w' : '-',
+	(perm & S_IXUSR) ? 'x' : '-', (perm & S_IRGRP) ? 'r' : '-',
+	(perm & S_IWGRP) ? 'w' : '-', (perm & S_IXGRP) ? 'x' : '-',
+	(perm & S_IROTH) ? 'r' : '-', (perm & S_IWOTH) ? 'w' : '-',
+	(perm & S_IXOTH) ? 'x' : '-', '\0'
+	};
+	char lastModified[20];
+	strftime(lastModified, 20, "%b %d %H:%M", localtime(&entry->mtime));
+	printf("  %s  %10jd  %s  %s", permissions, (intmax_t)entry->size, lastModified, entry->name);
+	if (entry->type == '1'){
+		printf(" link to %s", entry->link ? entry->link : "an earlier member");	//-l from the index
+	}
+	printf("\n");
+}
+
+/*	makeParents  -  returns void
+* Creates any missing directories above 'name', for members restored without their parent directories.
+*/
+void makeParents(const char *name){
+	char path[101];
+	snprintf(path, sizeof(path), "%s", name);
+	for (char *slash = strchr(path + 1, '/'); slash; slash = strchr(slash + 1, '/')){
+		*slash = '\0';
+		mkdir(path, 0777);									//fails harmlessly if it already exists
+		*slash = '/';
+	}
+}
+
+/*	scanArchive  -  returns size_t
+* Reads every header in the archive, hopping over the data, and fills in 'gl_entries' with the members
+* chosen by -x, or all of them. Returns the number of members kept.
+*/
+size_t scanArchive(){
+	const Header *header;
+	Pax pax = { 0 };
+	for (off_t index = 0; (header = headerAt(gl_in, index));){
+		Entry *entry = addEntry();
+		if (parseHeader(header, entry, index) != 0){		//tar file ends with 1024 null bytes
+			gl_nentries--;
+			break;
+		}
+		index += 512 + ((entry->size + 511) & ~511);		//next header is at the next multiple of 512
+		if (entry->type == 'x' || entry->type == 'g'){		//pax extended headers aren't members
+			if (entry->type == 'x'){
+				readPax(entry, &pax);
+			}
+			free(entry->name);
+			gl_nentries--;
+			continue;
+		}
+		paxApply(entry, &pax);								//from the extended header just before
+		if (gl_nselect > 0 && !isSelected(entry->name)){
+			free(entry->name);
+			free(entry->link);
+			gl_nentries--;
+			gl_statSkipped++;
+		}
+	}
+	free(pax.sparseName);
+	return gl_nentries;
+}
+
+/*	dropSuperseded  -  returns void
+* An archive appended to with backup -a can hold a name more than once, and only the last copy is current.
+* Takes the earlier copies out of the table from 'base' on, keeping archive order, so restore never has two
+* threads writing one file. The names are found again through a hash table keyed by their CRC32C.
+*/
+void dropSuperseded(size_t base){
+	size_t size = 16;
+	while (size < 2 * (gl_nentries - base)){
+		size *= 2;
+	}
+	size_t *slots;											//entry index plus one, 0 for an empty slot
+	if (!(slots = calloc(size, sizeof(size_t)))){
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	size_t dropped = 0;
+	for (size_t i = gl_nentries; i-- > base;){				//the last copy is the one seen first
+		Entry *entry = &gl_entries[i];
+		size_t slot = crc32c(0, entry->name, strlen(entry->name)) & (size - 1);
+		while (slots[slot] && strcmp(gl_entries[slots[slot] - 1].name, entry->name) != 0){
+			slot = (slot + 1) & (size - 1);
+		}
+		if (slots[slot]){
+			free(entry->name);
+			free(entry->link);
+			entry->name = NULL;
+			dropped++;
+		}
+		else {
+			slots[slot] = i + 1;
+		}
+	}
+	free(slots);
+	if (dropped == 0){
+		return;
+	}
+	size_t kept = base;
+	for (size_t i = base; i < gl_nentries; i++){
+		if (gl_entries[i].name){
+			gl_entries[kept++] = gl_entries[i];
+		}
+	}
+	gl_nentries = kept;
+}
+
+/*	restoreChunks  -  returns void
+* Rebuilds a file archived with -d by reading its chunk list from the archive and copying each chunk it
+* names out of the store into 'file' in turn.
+*/
+void restoreChunks(Entry *entry, int file){
+	if (!gl_storePath){
+		printf("%s was archived with -d, give restore the chunk store with -d\n", entry->name);
+		exit(EXIT_FAILURE);
+	}
+	char *list = malloc(entry->size + 1);
+	if (!list){
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	if (readerRead(entry->in, entry->data, list, entry->size) < entry->size){
+		printf("Archive ended early, tar file possibly corrupted\n");
+		exit(EXIT_FAILURE);
+	}
+	list[entry->size] = '\0';
+
+	char *line = list;
+	while (*line){
+		char hex[65], path[PATH_MAX];
+		size_t length;
+		int used = 0;
+		if (sscanf(line, "%64s %zu %n", hex, &length, &used) != 2 || strlen(hex) != 64 || used == 0){
+			printf("Chunk list of %s corrupted\n", entry->name);
+			exit(EXIT_FAILURE);
+		}
+		chunkPath(path, sizeof(path), hex);
+		int chunk;
+		if ((chunk = open(path, O_RDONLY | O_CLOEXEC)) == -1){
+			perror("open chunk");
+			printf("%s is missing from the store, needed by %s\n", hex, entry->name);
+			exit(EXIT_FAILURE);
+		}
+		if (copyData(chunk, NULL, file, length) < (off_t)length){
+			printf("Chunk %s is damaged, needed by %s\n", hex, entry->name);
+			exit(EXIT_FAILURE);
+		}
+		dropFile(chunk, 0);
+		close(chunk);
+		line += used;
+	}
+	free(list);
+}
+
+/*	sparseMap  -  returns char*
+* Reads the map at the start of a sparse member's data a block at a time until it is complete. Returns it
+* null terminated, for the caller to free, with the number of blocks of data it took up in 'size'.
+*/
+char *sparseMap(Entry *entry, size_t *size){
+	size_t mapSize = 0, numbers = 0, needed = 1;
+	char *map = NULL;
+	while (numbers < needed){								//first the count, then two per extent
+		if (mapSize + BLOCK_SIZE > (size_t)entry->size){
+			printf("Sparse map of %s corrupted\n", entry->name);
+			exit(EXIT_FAILURE);
+		}
+		if (!(map = realloc(map, mapSize + BLOCK_SIZE + 1))){
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+		if (readerRead(entry->in, entry->data + mapSize, map + mapSize, BLOCK_SIZE) < BLOCK_SIZE){
+			printf("Archive ended early, tar file possibly corrupted\n");
+			exit(EXIT_FAILURE);
+		}
+		for (size_t i = mapSize; i < mapSize + BLOCK_SIZE; i++){
+			if (map[i] == '\n' && ++numbers == 1){
+				needed = 1 + 2 * strtoull(map, NULL, 10);
+			}
+		}
+		mapSize += BLOCK_SIZE;
+	}
+	map[mapSize] = '\0';
+	*size = mapSize;
+	return map;
+}
+
+/*	restoreSparse  -  returns void
+* Recreates a file archived sparse, a GNU sparse 1.0 member or a type 'S' one from before them. Once the map
+* is read each extent's data is copied in at its offset, skipping over the holes, and then ftruncate() sets
+* the file's real size, which leaves the trailing hole.
+*/
+void restoreSparse(Entry *entry, int file){
+	size_t mapSize;
+	char *map = sparseMap(entry, &mapSize);
+	char *at = map;
+	size_t count = strtoull(at, &at, 10);
+	off_t offset = mapSize, realSize = 0;
+	for (size_t i = 0; i < count; i++){
+		off_t start = strtoll(at, &at, 10);
+		off_t length = strtoll(at, &at, 10);
+		if (start + length > realSize){
+			realSize = start + length;
+		}
+		if (length == 0){
+			continue;
+		}
+		if (offset + length > entry->size){
+			printf("Sparse map of %s corrupted\n", entry->name);
+			exit(EXIT_FAILURE);
+		}
+		if (lseek(file, start, SEEK_SET) == -1 ||
+			readerCopy(entry->in, entry->data + offset, file, length) < length){
+			printf("Archive ended early, tar file possibly corrupted\n");
+			exit(EXIT_FAILURE);
+		}
+		offset += length;
+	}
+	if (ftruncate(file, realSize) == -1){					//the trailing hole
+		perror("ftruncate");
+	}
+	if (offset < entry->size && !entry->in->map){
+		streamSkip(entry->in, entry->size - offset);			//keep a stream in step
+	}
+	free(map);
+}
+
+/*	restoreLink  -  returns void
+* Recreates a hard link to a file restored earlier, replacing anything already at the name.
+*/
+void restoreLink(Entry *entry){
+	unlink(entry->name);
+	if (link(entry->link, entry->name) == -1){
+		perror("link");
+		printf("%s -> %s\n", entry->name, entry->link);
+		return;
+	}
+	gl_statLinks++;
+	if (!gl_quiet){
+		printf("Successfully linked: %s\n", entry->name);
+	}
+}
+
+/*	finishFile  -  returns void
+* Owner, mode and time of a restored file once all of its data is in, then closes it.
+*/
+void finishFile(Entry *entry, int file, uint64_t started){
+	struct timespec times[2] = {							//access time now, modified time from the header
+		{ .tv_nsec = UTIME_NOW },
+		{ .tv_sec = entry->mtime }
+	};
+	uint64_t start = statsTimer();
+	fchown(file, entry->uid, entry->gid);					//change owner, then mode since chown
+	fchmod(file, entry->mode);								//clears set-user-ID
+	futimens(file, times);									//change last modified time, no more writes
+	statsAdd(PHASE_META, start);
+	dropFile(file, 1);
+	if (gl_noCache && entry->in->map && !entry->in->compressed){	//and the part of the archive it came from
+		posix_fadvise(entry->in->fd, entry->data, entry->size, POSIX_FADV_DONTNEED);
+	}
+	close(file);											//after this
+	gl_statFiles++;
+	gl_dataBytes += entry->size;
+	statsFile(entry->name, started);
+	if (!gl_quiet){
+		printf("Successfully restored: %s\n", entry->name);
+	}
+}
+
+/*	restoreFile  -  returns void
+* Creates one regular file from its entry. The data is copied with positional reads of the archive so any
+* number of threads can share the one archive descriptor. A streamed archive is read from where it is.
+*/
+void restoreFile(Entry *entry){
+	int file;
+	uint64_t started = statsTimer();
+	errno = 0;
+	file = open(entry->name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	statsAdd(PHASE_OPEN, started);
+	if (file == -1){
+		perror("open");										//create and open file with name: entry->name
+		printf("%s\n", entry->name);
+		exit(EXIT_FAILURE);
+	}
+	if (entry->type == 'C'){
+		restoreChunks(entry, file);							//rebuilt from the -d chunk store
+	}
+	else if (entry->type == 'S'){
+		restoreSparse(entry, file);							//holes stay holes
+	}
+	else if (readerCopy(entry->in, entry->data, file, entry->size) < entry->size){	//kernel copies the data
+		printf("Archive ended early, tar file possibly corrupted\n");
+		exit(EXIT_FAILURE);
+	}
+	finishFile(entry, file, started);
+}
+
+/*	restoreRange  -  returns void
+* Restores the SPLIT_RANGE of a big file starting at 'at', and finishes the file if it was the last range,
+* which closes it. The thread with the first range creates the file at its full size, the others wait for
+* it, so only the big files being restored right now are open.
+*/
+void restoreRange(SplitFile *split, off_t at){
+	Entry *entry = split->entry;
+	if (at == 0){
+		uint64_t started = statsTimer();
+		int file;
+		if ((file = open(entry->name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) == -1 ||
+			ftruncate(file, entry->size) == -1){
+			perror("open");
+			printf("%s\n", entry->name);
+			exit(EXIT_FAILURE);
+		}
+		statsAdd(PHASE_OPEN, started);
+		pthread_mutex_lock(&gl_restoreLock);
+		split->started = started;
+		split->file = file;
+		pthread_cond_broadcast(&gl_splitOpened);
+		pthread_mutex_unlock(&gl_restoreLock);
+	}
+	else {
+		pthread_mutex_lock(&gl_restoreLock);
+		while (split->file == -1){
+			pthread_cond_wait(&gl_splitOpened, &gl_restoreLock);
+		}
+		pthread_mutex_unlock(&gl_restoreLock);
+	}
+	off_t length = entry->size - at < SPLIT_RANGE ? entry->size - at : SPLIT_RANGE;
+	if (readerPut(entry->in, entry->data + at, split->file, at, length) < length){
+		printf("Archive ended early, tar file possibly corrupted\n");
+		exit(EXIT_FAILURE);
+	}
+	pthread_mutex_lock(&gl_restoreLock);
+	int last = --split->rangesLeft == 0;
+	pthread_mutex_unlock(&gl_restoreLock);
+	if (last){
+		finishFile(entry, split->file, split->started);
+	}
+}
+
+/*	splitStart  -  returns void
+* Finds the big regular files in the table, ready for restoreWorker() to hand their ranges to every thread.
+* None is opened yet, see restoreRange(). Does nothing with one thread.
+*/
+void splitStart(){
+	for (size_t i = 0; i < gl_nentries && gl_threads > 1; i++){
+		Entry *entry = &gl_entries[i];
+		if (entry->type != '0' || entry->size < SPLIT_SIZE){
+			continue;
+		}
+		if (!(gl_splits = realloc(gl_splits, (gl_nsplits + 1) * sizeof(SplitFile)))){
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+		SplitFile *split = &gl_splits[gl_nsplits++];
+		memset(split, 0, sizeof(SplitFile));
+		split->entry = entry;
+		split->file = -1;
+		split->rangesLeft = (entry->size + SPLIT_RANGE - 1) / SPLIT_RANGE;
+	}
+}
+/*	restoreDirectory  -  returns void
+* Creates one directory from its entry. It is made writable by its owner so its contents can be restored
+* and its own metadata is recorded in 'gl_dirs' for finishDirectories().
+*/
+void restoreDirectory(Entry *entry){
+	if (mkdir(entry->name, entry->mode | S_IRWXU) == -1 && errno == ENOENT){	//make directory, real
+		makeParents(entry->name);							//permissions come later. Its parent can come
+		mkdir(entry->name, entry->mode | S_IRWXU);			//after it when backup -a archived it again
+	}
+	if (gl_ndirs == gl_dirsCapacity){
+		gl_dirsCapacity = gl_dirsCapacity ? gl_dirsCapacity * 2 : 256;
+		if (!(gl_dirs = realloc(gl_dirs, gl_dirsCapacity * sizeof(DirectoryMeta)))){
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+	DirectoryMeta *dir = &gl_dirs[gl_ndirs++];
+	if (!(dir->name = strdup(entry->name))){
+		perror("strdup");
+		exit(EXIT_FAILURE);
+	}
+	dir->order = gl_ndirs - 1;
+	dir->mtime = entry->mtime;
+	dir->uid = entry->uid;
+	dir->gid = entry->gid;
+	dir->mode = entry->mode;
+	gl_statDirs++;
+	if (!gl_quiet){
+		printf("Successfully restored: %s\n", entry->name);
+	}
+}
+
+/*	compareDirectories  -  returns int
+* qsort comparator, orders directories by name, which puts every parent before its children, and copies of
+* one directory in archive order.
+*/
+int compareDirectories(const void *a, const void *b){
+	const DirectoryMeta *x = a, *y = b;
+	int order = strcmp(x->name, y->name);
+	return order ? order : (x->order > y->order) - (x->order < y->order);
+}
+
+/*	finishDirectories  -  returns void
+* Applies the owner, mode and modified time of every directory restored from this archive once all of their
+* contents are in place. Archive order doesn't always have every parent first, with shards or once backup -a
+* has added to an archive, so they are sorted by name, and going backwards is then a post order pass, each
+* directory is finished only after everything beneath it. Only the last copy of a directory is applied. Each
+* one is opened once and changed through that descriptor.
+*/
+void finishDirectories(){
+	qsort(gl_dirs, gl_ndirs, sizeof(DirectoryMeta), compareDirectories);
+	for (size_t i = gl_ndirs; i-- > 0;){
+		DirectoryMeta *dir = &gl_dirs[i];
+		if (i + 1 < gl_ndirs && strcmp(dir->name, gl_dirs[i + 1].name) == 0){
+			continue;										//an earlier copy
+		}
+		struct timespec times[2] = {
+			{ .tv_nsec = UTIME_NOW },
+			{ .tv_sec = dir->mtime }
+		};
+		int fd;
+		uint64_t start = statsTimer();
+		if ((fd = open(dir->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) != -1){
+			fchown(fd, dir->uid, dir->gid);
+			fchmod(fd, dir->mode);
+			utimensat(fd, "", times, AT_EMPTY_PATH);		//same as futimens() on the directory
+			close(fd);
+		}
+		statsAdd(PHASE_META, start);
+	}
+	for (size_t i = 0; i < gl_ndirs; i++){
+		free(gl_dirs[i].name);
+	}
+	gl_ndirs = 0;
+}
+
+/*	removeEntry  -  returns int
+* nftw() callback that deletes everything it is given, used bottom up to delete whole directories.
+*/
+int removeEntry(const char *fpath, const struct stat *sb, int tflag, struct FTW *ftwbuf){
+	if (remove(fpath) == -1){
+		perror("remove");
+		printf("%s\n", fpath);
+	}
+	return 0;
+}
+
+/*	restoreWhiteout  -  returns void
+* Applies a whiteout from an incremental archive by deleting the file or directory it names.
+*/
+void restoreWhiteout(Entry *entry){
+	char path[101];
+	const char *base = strrchr(entry->name, '/');
+	base = base ? base + 1 : entry->name;
+	snprintf(path, sizeof(path), "%.*s%s", (int)(base - entry->name), entry->name, base + 4);	//drop ".wh."
+	struct stat sb;
+	if (lstat(path, &sb) == 0){
+		nftw(path, removeEntry, 20, FTW_DEPTH | FTW_PHYS);
+		if (!gl_quiet){
+			printf("Successfully deleted: %s\n", path);
+		}
+	}
+}
+
+/*	Verify Globals
+* --verify reads every member's data back out of the archive and checks it against the CRC32C backup -c
+* recorded, --compare checks every member against the file it was archived from, relative to the current
+* directory as restore would have put it. Neither writes anything.
+*
+* gl_verify			int			set by -V
+* gl_compare		int			set by -C
+* gl_matched		uint64_t	members that verified, or compared equal
+* gl_unchecked		uint64_t	members with data but no checksum to check it against
+* gl_differ			uint64_t	members that didn't verify or that differ from the file
+*/
+int					gl_verify;
+int					gl_compare;
+_Atomic uint64_t	gl_matched;
+_Atomic uint64_t	gl_unchecked;
+_Atomic uint64_t	gl_differ;
+
+/*	hasData  -  returns int
+* Returns 1 if the member has data of its own in the archive.
+*/
+int hasData(const Entry *entry){
+	return entry->type != '5' && entry->type != 'W' && entry->type != '1';
+}
+
+/*	compareFile  -  returns const char*
+* Hashes the file a member was archived from the way backup -c hashed it and compares the result with the
+* member's CRC. A sparse member's hash covers its map, which comes from the archive, and then the file's data
+* at the extents in the map. Returns what differs, or NULL.
+*/
+const char *compareFile(Entry *entry, const struct stat *sb){
+	int fd;
+	if ((fd = open(entry->name, O_RDONLY | O_CLOEXEC)) == -1){
+		return "can't be read";
+	}
+	posix_fadvise(fd, 0, 0, gl_noCache ? POSIX_FADV_NOREUSE : POSIX_FADV_SEQUENTIAL);
+	const char *differs = NULL;
+	uint32_t crc = 0;
+	if (entry->type == 'S'){
+		size_t mapSize;
+		char *map = sparseMap(entry, &mapSize), *at = map;
+		crc = crc32c(0, map, mapSize);
+		size_t count = strtoull(at, &at, 10);
+		off_t realSize = 0;
+		for (size_t i = 0; i < count; i++){
+			off_t start = strtoll(at, &at, 10);
+			off_t length = strtoll(at, &at, 10);
+			crc = hashRange(fd, start, length, crc);
+			if (start + length > realSize){
+				realSize = start + length;
+			}
+		}
+		free(map);
+		if (realSize != sb->st_size){
+			differs = "size differs";
+		}
+	}
+	else {
+		crc = hashRange(fd, 0, entry->size, 0);
+	}
+	dropFile(fd, 0);
+	close(fd);
+	if (!differs && crc != entry->crc){
+		differs = "contents differ";
+	}
+	return differs;
+}
+
+/*	compareEntry  -  returns const char*
+* Checks one member against what is on disk now: that it exists and is the same kind of thing, its mode,
+* owner, modified time and size, and then its contents if backup -c recorded a checksum. A hard link has to
+* be the same file as its target, a whiteout's file has to be gone. Returns what differs, or NULL.
+*/
+const char *compareEntry(Entry *entry){
+	struct stat sb;
+	if (entry->type == 'W'){
+		char path[101];
+		const char *base = strrchr(entry->name, '/');
+		base = base ? base + 1 : entry->name;
+		snprintf(path, sizeof(path), "%.*s%s", (int)(base - entry->name), entry->name, base + 4);	//drop ".wh."
+		return lstat(path, &sb) == 0 ? "deleted but still there" : NULL;
+	}
+	if (stat(entry->name, &sb) == -1){						//backup follows symbolic links, so does this
+		return "missing";
+	}
+	if (entry->type == '1'){
+		struct stat target;
+		if (!entry->link || stat(entry->link, &target) == -1 || target.st_dev != sb.st_dev ||
+			target.st_ino != sb.st_ino){
+			return "not linked to its target";
+		}
+		return NULL;
+	}
+	if (entry->type == '5' ? !S_ISDIR(sb.st_mode) : !S_ISREG(sb.st_mode)){
+		return entry->type == '5' ? "not a directory" : "not a file";
+	}
+	if ((sb.st_mode & 07777) != (entry->mode & 07777)){
+		return "mode differs";
+	}
+	if (sb.st_uid != entry->uid || sb.st_gid != entry->gid){
+		return "owner differs";
+	}
+	if (sb.st_mtime != entry->mtime){
+		return "modified time differs";
+	}
+	if (entry->type == '5'){
+		return NULL;
+	}
+	if (entry->type == '0' && sb.st_size != entry->size){
+		return "size differs";
+	}
+	if (!entry->hashed || entry->type == 'C' || (entry->type == 'S' && !entry->in->map)){
+		gl_unchecked++;										//-d chunk lists, and sparse maps out of
+		return NULL;										//a stream, can't be compared
+	}
+	return compareFile(entry, &sb);
+}
+
+/*	verifyEntry  -  returns void
+* Checks one member for --verify or --compare and reports it.
 */
-typedef struct TarHeader{
-	char name[100];
-	char mode[8];
-	char owner[8];
-	char group[8];
-	char size[12];
-	char modified[12];
-	char checksum[8];
-	char type[1];
-	char link[100];
-	char padding[255];			//pad total size of this struct to 512 bytes
+void verifyEntry(Entry *entry){
+	uint64_t started = statsTimer();
+	const char *differs = NULL;
+	int checked = 1;
+	if (gl_compare){
+		differs = compareEntry(entry);
+	}
+	else if (hasData(entry)){
+		uint32_t crc = 0;
+		if (readerHash(entry->in, entry->data, entry->size, &crc) < entry->size){
+			differs = "archive ends inside it";
+		}
+		else if (!entry->hashed){
+			checked = 0;
+			gl_unchecked++;
+		}
+		else if (crc != entry->crc){
+			differs = "checksum mismatch";
+		}
+		if (gl_noCache && entry->in->map && !entry->in->compressed){
+			posix_fadvise(entry->in->fd, entry->data, entry->size, POSIX_FADV_DONTNEED);
+		}
+		gl_dataBytes += entry->size;
+	}
+	if (differs){
+		gl_differ++;
+		printf("%s: %s\n", gl_compare ? "Differs" : "Failed", entry->name);
+		printf("    %s\n", differs);
+		return;
+	}
+	if (checked){
+		gl_matched++;
+	}
+	gl_statFiles += hasData(entry);
+	statsFile(entry->name, started);
+	if (!gl_quiet){
+		printf("%s: %s\n", gl_compare ? "Same" : checked ? "Verified" : "No checksum", entry->name);
+	}
 }
-Header;
 
-/*	fpad  -  returns void
-* Pads the provided 'file' by 'amount' with null chars. Used to keep the start of the archived files and the 
-* total file size padded to a multiple of 512
-*
-* file		FILE		file to pad
-* amount	size_t		amount to pad by
+/*	verifyWorker  -  returns void*
+* --verify and --compare thread body, takes the next member from the table until there are none left.
 */
-void fpad(FILE *file, size_t amount){
-	while(amount--){
-		fputc(0, file);
+void *verifyWorker(void *arg){
+	for (;;){
+		pthread_mutex_lock(&gl_restoreLock);
+		size_t i = gl_nextEntry++;
+		pthread_mutex_unlock(&gl_restoreLock);
+
+		if (i >= gl_nentries){
+			return NULL;
+		}
+		verifyEntry(&gl_entries[i]);
 	}
 }
 
-/*	backup  -  return int
-* For every file passed to it, this function will create an appropriate .tar header and add it and the file
-* contents to the 'archive' (FILE) with tar formatting (padding to multiples of 512, and 1024 0 bytes to end)
-*
-* Code is modified from the top answer at:
-* https://stackoverflow.com/questions/29641965/creating-my-own-archive-tool-in-c 
-*
-* fpath		char		path of current file from nftw()
-* sb		stat		stat struct of the current file from nftw()
-* tflag		int			holds additional info about the current file
-* ftwbuf	FTW			holds the offset of file's filename in fpath so that you can print just the name
+/*	restoreStream  -  returns int
+* Restores an archive that can't be mapped, such as a pipe, in one pass from start to end without a seek,
+* stopping at the empty blocks that end it. There is no pre-scan or thread pool here since nothing can be
+* read out of order, but -l and -x work the same way.
 */
-int backup(const char *fpath, const struct stat *sb,
-								int tflag, struct FTW *ftwbuf){
-	/*	This first if statement skips the entire process of adding to the archive for a given file and moves
-	* onto the next on in the recursion. I've done this for two reasons, the first and more common occurence
-	* is that the last modified time of the file falls outside of the date provided by the -t switch (<= 
-	* startDate). Secondly, it skips the archive file specified by the -f switch (>= now), so that the archive
-	* file isn't included in the backup, inflating the file with data it already contains. The right hand side 
-	* of the '&&' is required because when you create the archive file, the directories last modified state
-	* updates, so without that check the parent directory of where you create the archive file will be skipped. 
-	*/
-	if ((difftime(sb->st_mtime, gl_startDate) < 0) || 
-		((difftime(sb->st_mtime, gl_now) >= 0) && !S_ISDIR(sb->st_mode))){		
-		return 0;										//continue to next file
+int restoreStream(){
+	Header header;
+	off_t index = 0;
+	Pax pax = { 0 };
+	for (;;){
+		size_t got = streamRead(gl_in, (char *)&header, BLOCK_SIZE);
+		if (got == 0){
+			finishDirectories();
+			return 1;										//no end blocks, but ended on a boundary
+		}
+		Entry entry = { .in = gl_in };
+		if (got < BLOCK_SIZE){
+			printf("Archive ended early, tar file possibly corrupted\n");
+			exit(EXIT_FAILURE);
+		}
+		if (parseHeader(&header, &entry, index) != 0){
+			finishDirectories();
+			return 1;										//tar file ends with 1024 null bytes
+		}
+		off_t padded = (entry.size + 511) & ~511;
+		index += BLOCK_SIZE + padded;
+
+		off_t skip = padded;								//bytes of the member left to read past
+		gl_archiveBytes += BLOCK_SIZE + padded;
+		if (entry.type != 'x' && entry.type != 'g'){
+			paxApply(&entry, &pax);							//from the extended header just before
+		}
+		if (entry.type == 'x' || entry.type == 'g'){		//pax extended headers aren't members
+			int found = entry.type == 'x' ? readPax(&entry, &pax) : -1;
+			skip = found == -1 ? padded : padded - entry.size;
+		}
+		else if (gl_nselect > 0 && !isSelected(entry.name)){
+			gl_statSkipped++;
+		}
+		else {
+			if (gl_list){
+				listEntry(&entry);
+			}
+			else if (gl_verify || gl_compare){
+				verifyEntry(&entry);
+				if (gl_verify && hasData(&entry)){
+					skip = padded - entry.size;				//the data has been read to hash it
+				}
+			}
+			else {
+				if (gl_nselect > 0){
+					makeParents(entry.name);				//parents that weren't selected themselves
+				}
+				if (entry.type == '5'){
+					restoreDirectory(&entry);
+				}
+				else if (entry.type == 'W'){
+					restoreWhiteout(&entry);
+				}
+				else if (entry.type == '1'){
+					restoreLink(&entry);					//its target came earlier in the stream
+				}
+				else {
+					restoreFile(&entry);
+					skip = padded - entry.size;				//just the padding is left
+				}
+			}
+		}
+		if (streamSkip(gl_in, skip) == -1){
+			printf("Archive ended early, tar file possibly corrupted\n");
+			exit(EXIT_FAILURE);
+		}
+		free(entry.name);
+		free(entry.link);
 	}
+}
 
-	FILE *input;									//I put this second because if you can't open the file
-	errno = 0;										//then there is no point writing it's header etc.
-	if (!(input = fopen(fpath, "rb"))){				//Fortunately - C specifies that fopen won't fail if you
-		perror("fopen");							//attempt to open a directory in read mode. So this won't
-		printf("file skipped: %s\n", fpath);		//skip any directories.
-		return 0;										//continue to next file
+/*	restoreWorker  -  returns void*
+* Restore thread body, takes the next regular file from the table until there are none left. Directories
+* and whiteouts have already been dealt with, hard links wait until every file is there. A big file is
+* only passed over once every range of it has been taken, so all the threads fill it in together.
+*/
+void *restoreWorker(void *arg){
+	for (;;){
+		pthread_mutex_lock(&gl_restoreLock);
+		while (gl_nextEntry < gl_nentries && (gl_entries[gl_nextEntry].type == '5' ||
+			   gl_entries[gl_nextEntry].type == 'W' || gl_entries[gl_nextEntry].type == '1')){
+			gl_nextEntry++;
+		}
+		size_t i = gl_nextEntry;
+		SplitFile *split = NULL;
+		off_t at = 0;
+		if (i < gl_nentries && gl_nextSplit < gl_nsplits && gl_splits[gl_nextSplit].entry == &gl_entries[i]){
+			split = &gl_splits[gl_nextSplit];
+			at = split->claimed;
+			split->claimed += SPLIT_RANGE;
+			if (split->claimed >= split->entry->size){
+				gl_nextSplit++;
+				gl_nextEntry++;
+			}
+		}
+		else {
+			gl_nextEntry++;
+		}
+		pthread_mutex_unlock(&gl_restoreLock);
+
+		if (i >= gl_nentries){
+			return NULL;
+		}
+		if (split){
+			restoreRange(split, at);
+		}
+		else {
+			restoreFile(&gl_entries[i]);
+		}
 	}
-	
-	Header header;											//Creation of the tar header
-	memset(&header, 0, sizeof(Header));						//512 null chars allocated
-	snprintf(header.mode, 8, "%06o", sb->st_mode);
-	snprintf(header.owner, 8, "%06o", sb->st_uid);
-	snprintf(header.group, 8, "%06o", sb->st_gid);
-	snprintf(header.size, 12, "%011o", sb->st_size);
-	snprintf(header.modified, 12, "%011o", sb->st_mtime);
-	if (S_ISDIR(sb->st_mode)){													//If DIR add trailing '/'
-		if (snprintf(header.name, 100, "%s/", fpath + gl_pathOffset) >= 100){	//If path truncated
-			printf("File path length doesn't fit in tar format, try archiving from a deeper root directory\n");
-			printf("%s\n", fpath + gl_pathOffset);
-			return 1;														//exits ntfw for post cleanup
+}
+
+/*	restoreOpen  -  returns int
+* Opens the archive at 'path' into 'gl_inputs'. If it is a manifest written by backup -s every shard it lists
+* is opened instead, a shard that isn't where the manifest says is looked for next to the manifest in case
+* they have all been moved together. Returns 0 on success, -1 with errno set.
+*/
+int restoreOpen(const char *path){
+	struct stat sb;
+	char line[PATH_MAX + 64];
+	int count = 0;
+	FILE *file = NULL;
+	int named = strcmp(path, "-") != 0;						//not standard input, which can't be peeked at
+	if (named && stat(path, &sb) == 0 && S_ISREG(sb.st_mode) && (file = fopen(path, "r"))){	//nor can a pipe
+		if (!fgets(line, sizeof(line), file) || sscanf(line, "TARSHARDS1 %d", &count) != 1){
+			count = 0;
 		}
-		header.type[0] = '5';												//type '5' indicates directory
 	}
-	else {																	//no trailing '/'
-		if (snprintf(header.name, 100, "%s", fpath + gl_pathOffset) >= 100){	
-			printf("File path length doesn't fit in tar format, try archiving from a deeper root directory\n");
-			printf("%s\n", fpath + gl_pathOffset);
-			return 1;														//exits ntfw for post cleanup
+	gl_ninputs = count > 0 ? count : 1;
+	if (!(gl_inputs = calloc(gl_ninputs, sizeof(Reader)))){
+		return -1;
+	}
+	if (count == 0){
+		if (file){
+			fclose(file);
 		}
-		header.type[0] = '0';												//type '0' indicates regular file
-	}	
-	
-	memset(header.checksum, ' ', 8);					//checksum space in header set to ' ' chars because
-	size_t checksum = 0;								//this data is included in the checksum calculation
-	const unsigned char* bytes = (char*)&header;	
-	for (int i = 0; i < sizeof(Header); ++i){			//calculate checksum
-		checksum += bytes[i];
+		return readerOpen(&gl_inputs[0], path);
 	}
-	snprintf(header.checksum, 8, "%06o", checksum);
-
-	fwrite(&header, 1, sizeof(Header), archive);		//write the header to the archive
 
-	if (!S_ISDIR(sb->st_mode)){								//if not DIR
-		while (!feof(input)){								//read file to buffer and write buffer to archive
-			char buffer[2000];
-			size_t read = fread(buffer, 1, 2000, input);
-			fwrite(buffer, 1, read, archive);
+	const char *slash = strrchr(path, '/');
+	int dirLength = slash ? slash - path + 1 : 0;
+	for (int s = 0; s < count; s++){
+		size_t members;
+		intmax_t size;
+		int used = 0;
+		if (!fgets(line, sizeof(line), file) || sscanf(line, "%zu %jd %n", &members, &size, &used) != 2 ||
+			used == 0){
+			fclose(file);
+			errno = EINVAL;
+			return -1;
 		}
-
-		size_t index = ftell(archive);						
-		size_t offset = index % 512;						//calculate how far off a multiple of 512 we are
-		if (offset != 0){									
-			fpad(archive, 512 - offset);					//pad to a multiple of 512
+		line[strcspn(line, "\n")] = '\0';
+		const char *shard = line + used;
+		if (readerOpen(&gl_inputs[s], shard) == -1){
+			char beside[PATH_MAX * 2];
+			const char *base = strrchr(shard, '/');
+			snprintf(beside, sizeof(beside), "%.*s%s", dirLength, path, base ? base + 1 : shard);
+			readerClose(&gl_inputs[s]);
+			if (readerOpen(&gl_inputs[s], beside) == -1){
+				fclose(file);
+				return -1;
+			}
 		}
+		printf("Shard opened successfully: %s, %zu members\n", gl_inputs[s].path, members);
 	}
+	fclose(file);
+	return 0;
+}
 
-	fclose(input);											//close input file
-	printf("Successfully archived: %s\n", fpath);			//console message
-	return 0;											//continue to next file
+/*	restoreClose  -  returns void
+* Closes everything restoreOpen() opened.
+*/
+void restoreClose(){
+	for (int s = 0; s < gl_ninputs; s++){
+		readerClose(&gl_inputs[s]);
+	}
+	free(gl_inputs);
+	gl_inputs = NULL;
+	gl_ninputs = 0;
 }
 
-/*	parseHeader  -  returns Header
-* parseHeader reads the data from the next 512 bytes after a provided index of the archive file and puts
-* the information into a Header stuct and returns that so that all of the data can be accessed seperately.
+/*	interleaveShards  -  returns void
+* Reorders a table built from several shards, one after the other, so that it takes a member from each
+* shard in turn. The restore threads work down the table, so this keeps every shard being read at once.
 *
-* index		long int		The index of the start of the 512 bytes of header information 
+* starts	size_t		where each shard's members start in the table, plus one for the end
 */
-Header parseHeader(long int index){
-	fseek(archive, index, SEEK_SET);						//set cursor to given index
-	Header header;
-	memset(&header, 0, sizeof(Header));
-	fscanf(archive, "%100s%8s%8s%8s%12s%12s%8s%1s", &header.name, 		//read data into Header struct
-			&header.mode, &header.owner, &header.group, &header.size, 
-			&header.modified, &header.checksum, &header.type);
-	
-	size_t check = strtol(header.checksum, NULL, 8);		//get checksum from tar header
-	memset(header.checksum, ' ', 8);						//set checksum data to ' ' chars to check properly
-	size_t sum = 0;											
-	const unsigned char* bytes = (char*)&header;			//convert header to a stream of bytes
-	for (int i = 0; i < sizeof(Header); ++i){				
-		sum += bytes[i];									//calculate sum
+void interleaveShards(const size_t *starts){
+	Entry *mixed;
+	size_t next[gl_ninputs], n = 0;
+	if (!(mixed = malloc(gl_nentries * sizeof(Entry)))){
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(next, starts, sizeof(next));
+	while (n < gl_nentries){
+		for (int s = 0; s < gl_ninputs; s++){
+			if (next[s] < starts[s + 1]){
+				mixed[n++] = gl_entries[next[s]++];
+			}
+		}
 	}
+	free(gl_entries);
+	gl_entries = mixed;
+	gl_entriesCapacity = gl_nentries;
+}
 
-	if (check != sum){										//check sum
-		printf("Checksum incorrect, tar file possibly corrupted\n");
-		exit(EXIT_FAILURE);	
+/*	freeEntries  -  returns void
+* Empties the table of members, ready for the next archive in a chain.
+*/
+void freeEntries(){
+	for (size_t i = 0; i < gl_nentries; i++){
+		free(gl_entries[i].name);
+		free(gl_entries[i].link);
 	}
-	
-	fseek(archive, index + 512, SEEK_SET);					//set cursor to end of this files header
-	return header;
+	free(gl_entries);
+	gl_entries = NULL;
+	gl_nentries = gl_entriesCapacity = gl_nextEntry = 0;
 }
 
 /*	restore  -  returns int
@@ -192,81 +5366,336 @@ Header parseHeader(long int index){
 * directory. It runs when this program is run from the symlink 'restore' instead of 'backup'. It does not
 * currently work correctly with archiving symbolic links and instead archives them as a copy of the original
 * file with all the same data in it.
+* First a table of members is built, from the archive's index if it has one or else by reading every header,
+* then all the directories are made and whiteouts applied, then the files are restored by 'gl_threads'
+* threads at once, the hard links are made and last the directories' own metadata is applied.
+* With -x only the chosen members are restored, with -l they are listed instead. Archives that can't be
+* mapped are handed to restoreStream(). A sharded backup has every shard's members in the one table, so the
+* shards are all restored at once. With --verify or --compare the table is built the same way but each member
+* is only checked, by verifyEntry() on 'gl_threads' threads.
 */
 int restore(){
-	Header header;
-	FILE *file;
-	struct utimbuf times;									//create a utimbuf for the utime() function
-	times.actime = time(NULL);								//set access time to now
-
-	fseek(archive, -1024, SEEK_END);						//tar file ends with 1024 null bytes
-	long int end = ftell(archive);							//end = cursor position of the end of the tar data
-	fseek(archive, 0, SEEK_SET);
+	if (gl_ninputs == 1 && !gl_inputs[0].map){
+		gl_in = &gl_inputs[0];
+		return restoreStream();
+	}
+	size_t starts[gl_ninputs + 1];
+	for (int s = 0; s < gl_ninputs; s++){
+		gl_in = &gl_inputs[s];
+		starts[s] = gl_nentries;
+		if (!gl_in->map){
+			printf("Shards are restored in parallel so have to be regular files: %s\n", gl_in->path);
+			return 0;
+		}
+		if ((gl_index = indexLoad(gl_in->path))){
+			if (!gl_in->compressed){
+				madvise((char *)gl_in->map, gl_in->size, MADV_RANDOM);	//only the chosen headers will be read
+			}
+			selectFromIndex();
+		}
+		else {
+			scanArchive();
+			dropSuperseded(starts[s]);							//an index never has earlier copies
+		}
+	}
+	starts[gl_ninputs] = gl_nentries;
+	if (gl_list){
+		for (size_t i = 0; i < gl_nentries; i++){
+			listEntry(&gl_entries[i]);
+		}
+		return 1;
+	}
+	for (int s = 0; s < gl_ninputs; s++){
+		gl_archiveBytes += gl_inputs[s].size;
+	}
+	for (size_t i = 0; i < gl_nentries; i++){
+		if (gl_entries[i].type != '5' && gl_entries[i].type != 'W' && gl_entries[i].type != '1'){
+			gl_totalBytes += gl_entries[i].size;			//for the progress line's ETA
+		}
+	}
+	if (gl_ninputs > 1){
+		interleaveShards(starts);
+	}
+	if (gl_threads < 1){
+		gl_threads = 1;
+	}
+	pthread_t threads[gl_threads];
 
-	while (!feof(archive)){	
-		long int index = ftell(archive);
-		if (index >= end){									//check we arent at the end of the file
-			return 1;										//end
+	if (gl_verify || gl_compare){							//every member checked, on 'gl_threads' threads
+		for (int s = 0; s < gl_ninputs; s++){
+			if (!gl_inputs[s].compressed){
+				madvise((char *)gl_inputs[s].map, gl_inputs[s].size, MADV_SEQUENTIAL);
+			}
 		}
-		
-		header = parseHeader(index);
-		mode_t mode  = strtol(header.mode, NULL, 8);		//converts octal string into int
-		uid_t uid    = strtol(header.owner, NULL, 8);
-		gid_t gid    = strtol(header.group, NULL, 8);
-		time_t mtime = strtol(header.modified, NULL, 8);
-		times.modtime = mtime;								//utimbuf modified time set to mtime from data
-
-		if (header.type[0] == '5'){						//if DIR
-			mkdir(header.name, mode);						//make directory with permissions
-			chown(header.name, uid, gid);					//change owner 
-			utime(header.name, &times);						//if there is anything in this directory the last
-		}													//modification time is overwritten to now when they
-															//are processed. Requires large workaround to fix.
-		else {											//else
-			off_t size = strtol(header.size, NULL, 8);		//size of the file
-			int blocks = size / 512;						//number of full 512 data blocks to read
-			int remainder = size % 512;						//remaining x blocks to read
-	
-			errno = 0;
-			if (!(file = fopen(header.name, "wb"))){		//create and open file with name: header.name
-				perror("fopen");
+		for (int i = 0; i < gl_threads; i++){
+			if (pthread_create(&threads[i], NULL, verifyWorker, NULL) != 0){
+				perror("pthread_create");
 				exit(EXIT_FAILURE);
 			}
-			char buffer[512];
-			for (int i = 0; i < blocks; i++){				
-				fread(buffer, 1, 512, archive);				//read 512 bytes of data into buffer
-				fwrite(buffer, 1, 512, file);				//write 512 bytes of data from buffer
-			}
-			fread(buffer, 1, remainder, archive);			//read remaining x bytes to buffer
-			fwrite(buffer, 1, remainder, file);				//write remaining x bytes from buffer
-			fclose(file);									//close file (needed for chown and chmod to work)
+		}
+		for (int i = 0; i < gl_threads; i++){
+			pthread_join(threads[i], NULL);
+		}
+		freeEntries();
+		return 1;
+	}
+
+	for (size_t i = 0; i < gl_nentries; i++){				//directories first, in archive order so every
+		Entry *entry = &gl_entries[i];						//parent exists before its children
+		if (gl_nselect > 0 || gl_ninputs > 1){
+			makeParents(entry->name);						//parents that weren't selected themselves, or
+		}													//that are in another shard
+		if (entry->type == '5'){
+			restoreDirectory(entry);
+		}
+		else if (entry->type == 'W'){
+			restoreWhiteout(entry);
+		}
+	}
 
-			int offset = 512 - remainder;
-			if (offset != 512){
-				fseek(archive, offset, SEEK_CUR);			//place cursor at next byte which is a multiple
-			}												//of 512
+	splitStart();											//big files are restored a range at a time
+	for (int i = 0; i < gl_threads; i++){
+		if (pthread_create(&threads[i], NULL, restoreWorker, NULL) != 0){
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (int i = 0; i < gl_threads; i++){
+		pthread_join(threads[i], NULL);
+	}
+	free(gl_splits);
+	gl_splits = NULL;
+	gl_nsplits = gl_nextSplit = 0;
+	for (size_t i = 0; i < gl_nentries; i++){				//hard links once their targets exist
+		if (gl_entries[i].type == '1'){
+			restoreLink(&gl_entries[i]);
+		}
+	}
+	finishDirectories();									//nothing more will go in the directories
+	freeEntries();
+	return 1;												//end
+}
+
+/*	removeArchives  -  returns void
+* Deletes corrupted or unfinished archive files and the journal silently when backup fails. An archive that
+* was being appended to is left for appendUndo(), and stdout can't be taken back.
+*/
+void removeArchives(char *const *paths, int count){
+	journalFinish();
+	for (int i = 0; i < count && !gl_append; i++){
+		if (strcmp(paths[i], "-") != 0){
+			remove(paths[i]);
+		}
+	}
+}
+
+/*	appendOpen  -  returns void
+* Gets ready to append to the archive 'path', already open on 'fd', for -a. The members it holds are taken
+* from its index or, if it doesn't have one that matches, from its headers, which only reads them and not the
+* data between. The end blocks must follow the last member, they're where writing carries on from. An empty
+* or new file is just written from the start. Anything that can't be appended to is fatal.
+*/
+void appendOpen(const char *path, int fd){
+	struct stat sb;
+	if (fstat(fd, &sb) == -1){
+		perror("fstat -a");
+		exit(EXIT_FAILURE);
+	}
+	if (sb.st_size == 0){
+		return;
+	}
+	Reader reader;
+	if (readerOpen(&reader, path) == -1){
+		perror("open -a");
+		printf("%s\n", path);
+		exit(EXIT_FAILURE);
+	}
+	if (!reader.map || reader.compressed){
+		printf("-a only appends to an uncompressed archive in a regular file: %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+	gl_in = &reader;
+	if ((gl_appendIndex = indexLoad(path))){
+		madvise((char *)reader.map, reader.size, MADV_RANDOM);	//only the end blocks will be read
+	}
+	else {
+		scanArchive();
+		dropSuperseded(0);
+		size_t namesSize = 0;
+		for (size_t i = 0; i < gl_nentries; i++){
+			namesSize += strlen(gl_entries[i].name) + 1;
+		}
+		IndexHead *head;										//laid out the same as an index file
+		if (!(head = calloc(1, sizeof(IndexHead) + gl_nentries * sizeof(Record) + namesSize))){
+			perror("calloc");
+			exit(EXIT_FAILURE);
+		}
+		Record *records = (Record *)(head + 1);
+		char *names = (char *)(records + gl_nentries);
+		head->count = gl_nentries;
+		for (size_t i = 0; i < gl_nentries; i++){
+			const Entry *entry = &gl_entries[i];
+			Record *record = &records[i];
+			record->offset = entry->data - BLOCK_SIZE;
+			record->size = entry->size;
+			record->mtime = entry->mtime;
+			record->mode = entry->mode;
+			record->type = entry->type;
+			record->hashed = entry->hashed;
+			record->crc = entry->crc;
+			record->name = head->namesSize;
+			record->nameLength = strlen(entry->name);
+			memcpy(names + head->namesSize, entry->name, record->nameLength + 1);
+			head->namesSize += record->nameLength + 1;
+		}
+		qsort_r(records, gl_nentries, sizeof(Record), compareRecords, names);
+		freeEntries();
+		gl_appendIndex = head;
+	}
 
-			chown(header.name, uid, gid);					//change owner
-			chmod(header.name, mode);						//change mode
-			utime(header.name, &times);						//change last modified time
+	const Record *records = (const Record *)(gl_appendIndex + 1);
+	for (size_t i = 0; i < gl_appendIndex->count; i++){		//the end follows the member furthest in
+		const Record *record = &records[i];
+		off_t end = record->offset + BLOCK_SIZE + ((record->size + BLOCK_SIZE - 1) & ~(off_t)(BLOCK_SIZE - 1));
+		if (end > gl_appendEnd){
+			gl_appendEnd = end;
 		}
-		printf("Successfully restored: %s\n", header.name);
+	}
+	static const char zeros[BLOCK_SIZE];
+	const Header *first = headerAt(&reader, gl_appendEnd), *second = headerAt(&reader, gl_appendEnd + BLOCK_SIZE);
+	if (!first || !second || memcmp(first, zeros, BLOCK_SIZE) != 0 || memcmp(second, zeros, BLOCK_SIZE) != 0){
+		printf("No end blocks after the last member, can't append: %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+	readerClose(&reader);
+	gl_in = NULL;
+	if (lseek(fd, gl_appendEnd, SEEK_SET) == -1){
+		perror("lseek -a");
+		exit(EXIT_FAILURE);
+	}
+	futimens(fd, NULL);					//now, so the walk passes over the archive as it does a new one
+	printf("Appending after %llu members: %s\n", (unsigned long long)gl_appendIndex->count, path);
+}
+
+/*	appendUndo  -  returns void
+* Puts an archive that -a has started appending to back the way it was, its members then the end blocks,
+* which its index still matches.
+*/
+void appendUndo(int fd){
+	static const char zeros[1024];
+	if (pwrite(fd, zeros, sizeof(zeros), gl_appendEnd) != sizeof(zeros) ||
+		ftruncate(fd, gl_appendEnd + sizeof(zeros)) == -1){
+		perror("append -a");
 	}
 }
 
 int main(int argc, char *argv[]){
-	char *path;
-	int flags = 0 | FTW_PHYS;
+	char *path = NULL;
 	int option;
-	int tflag;
-	int hflag;
-	int fflag;
-	char *targ;
+	int tflag = 0;
+	int hflag = 0;
+	int fflag = 0;
+	char *targ = NULL;
 	char *farg;
+	char **fargs = NULL;		//every -f given, restore applies them in order
+	int nfargs = 0;
 	gl_now = time(0);		//record time now to differentiate the archive from other files in backup function
+	gl_threads = sysconf(_SC_NPROCESSORS_ONLN);		//default to one walk thread per online cpu
 
-	while ((option = getopt(argc, argv, "ht:f:")) != -1){		//parsing command options
+	static const struct option longOptions[] = {
+		{ "stats", optional_argument, NULL, 'S' },		//only a long option, -S isn't accepted
+		{ "quiet", no_argument, NULL, 'q' },
+		{ "progress", no_argument, NULL, 'P' },
+		{ "no-cache", no_argument, NULL, 'n' },
+		{ "checksum", no_argument, NULL, 'c' },
+		{ "verify", no_argument, NULL, 'V' },
+		{ "compare", no_argument, NULL, 'C' },
+		{ "append", no_argument, NULL, 'a' },
+		{ "resume", no_argument, NULL, 'r' },
+		{ "exclude", required_argument, NULL, 'e' },
+		{ "include", required_argument, NULL, 'i' },
+		{ "exclude-from", required_argument, NULL, 'X' },
+		{ NULL, 0, NULL, 0 }
+	};
+	while ((option = getopt_long(argc, argv, "ht:f:j:m:lx:zg:d:qPns:cVCare:i:X:", longOptions, NULL)) != -1){	//parsing options
 		switch (option){
+			case 'S':
+				gl_statsPath = optarg ? optarg : "-";	//JSON summary, to stderr unless a file is given
+				break;
+			case 'q':
+				gl_quiet = 1;					//quiet flag
+				break;
+			case 'P':
+				gl_progress = 1;				//progress flag
+				break;
+			case 'n':
+				gl_noCache = 1;					//keep out of the page cache
+				break;
+			case 's':
+				gl_manifest = optarg;			//manifest of the shards given with -f
+				break;
+			case 'c':
+				gl_checksum = 1;				//record a CRC32C of every member
+				break;
+			case 'a':
+				gl_append = 1;					//add to the archive instead of rewriting it
+				break;
+			case 'r':
+				gl_resume = 1;					//carry on with an interrupted backup
+				break;
+			case 'e':
+			case 'i':
+				if (filterAdd(optarg, option == 'i') == -1){	//rules apply in the order given
+					printf("    -%c {pattern}\n", option);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'X':
+				if (filterLoad(optarg) == -1){				//rules from a file, in with the others
+					perror("exclude-from -X");
+					printf("%s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'V':
+				gl_verify = 1;					//check the archive against its checksums
+				break;
+			case 'C':
+				gl_compare = 1;					//check the archive against the files
+				break;
+			case 'd':
+				gl_storePath = optarg;			//chunk store for deduplication
+				break;
+			case 'g':
+				gl_catalogPath = optarg;		//catalog for incremental backups
+				break;
+			case 'z':
+				gl_compress = 1;				//compress flag
+				break;
+			case 'l':
+				gl_list = 1;					//list flag
+				break;
+			case 'x':
+				if (!(gl_select = realloc(gl_select, (gl_nselect + 1) * sizeof(char *)))){
+					perror("realloc");
+					exit(EXIT_FAILURE);
+				}
+				gl_select[gl_nselect++] = optarg;	//path or glob of members to restore
+				break;
+			case 'm':
+				gl_budget = (size_t)atol(optarg) << 20;		//read-ahead budget in MiB
+				if (gl_budget < 2 * CHUNK_SIZE){
+					printf("    -m {megabytes}  (at least %d)\n", 2 * CHUNK_SIZE >> 20);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'j':
+				gl_threads = atoi(optarg);		//number of walk threads
+				if (gl_threads < 1){
+					printf("    -j {threads}\n");				//reminder how to use -j
+					exit(EXIT_FAILURE);
+				}
+				break;
 			case 't':
 				tflag = 1;					//time flag
 				targ = optarg;					//targ = dateString or filename
@@ -277,6 +5706,11 @@ int main(int argc, char *argv[]){
 			case 'f':
 				fflag = 1;					//file flag
 				farg = optarg;					//farg = archive filename
+				if (!(fargs = realloc(fargs, (nfargs + 1) * sizeof(char *)))){
+					perror("realloc");
+					exit(EXIT_FAILURE);
+				}
+				fargs[nfargs++] = optarg;
 			case '?':
 				if (optopt == 't'){
 					printf("    -t {<filename>, <date>}\n");	//reminder how to use -t
@@ -285,6 +5719,38 @@ int main(int argc, char *argv[]){
 				if (optopt == 'f'){
 					printf("    -f {filename}\n");				//reminder how to use -f
 					exit(EXIT_FAILURE);
+				}
+				if (optopt == 'j'){
+					printf("    -j {threads}\n");				//reminder how to use -j
+					exit(EXIT_FAILURE);
+				}
+				if (optopt == 'm'){
+					printf("    -m {megabytes}\n");				//reminder how to use -m
+					exit(EXIT_FAILURE);
+				}
+				if (optopt == 'x'){
+					printf("    -x {<path>, <glob>}\n");		//reminder how to use -x
+					exit(EXIT_FAILURE);
+				}
+				if (optopt == 'g'){
+					printf("    -g {catalog}\n");				//reminder how to use -g
+					exit(EXIT_FAILURE);
+				}
+				if (optopt == 'd'){
+					printf("    -d {store}\n");				//reminder how to use -d
+					exit(EXIT_FAILURE);
+				}
+				if (optopt == 's'){
+					printf("    -s {manifest}\n");			//reminder how to use -s
+					exit(EXIT_FAILURE);
+				}
+				if (optopt == 'e' || optopt == 'i'){
+					printf("    -%c {pattern}\n", optopt);	//reminder how to use -e and -i
+					exit(EXIT_FAILURE);
+				}
+				if (optopt == 'X'){
+					printf("    -X {file}\n");				//reminder how to use -X
+					exit(EXIT_FAILURE);
 				}		
 				break;
 			default:
@@ -304,15 +5770,90 @@ int main(int argc, char *argv[]){
 			"    Backup requires one argument and has 3 optional switches to modify the way it runs.\n"
 			"    The only required argument is the path of directory where you want the recursive file\n"
 			"    walk to begin, this should always be the final argument.\n" 
-			"    The 3 switches are -t, -f and -h.\n" 
+			"    The 19 switches are -t, -f, -j, -m, -z, -g, -d, -s, -c, -a, -r, -e, -i, -X, -q, -P, -n,\n"
+			"    --stats and -h.\n"
 			"    -t {<filename>, <date>}  -  Specify starting time from which files will be archived\n"
 			"        filename: Relative path to a file\n"
 			"        date    : A date in the format 'YYYY-MM-DD hh:mm:ss'\n"
 			"        path    : A path to the directory where the function will start\n"
 			"    -f {filename}            -  Specify the file the program will archive to\n"
 			"        filename: New or existing file in the current directory(recommended to end with .tar)\n"
+			"                  or '-' to write the archive to stdout, without an index. Messages go to\n"
+			"                  stderr instead. Not with -a or -s\n"
+			"    -j {threads}             -  Number of threads used to walk the tree and to read files.\n"
+			"                                Files of 64MiB or more are read, and restored, by all of them\n"
+			"                                at once, 16MiB each at a time\n"
+			"        threads : Defaults to the number of online cpus\n"
+			"    -m {megabytes}           -  Memory budget for files read ahead of the archive writer\n"
+			"        megabytes: Defaults to 64, at least 2\n"
+			"    -z                       -  Compress the archive, 1MiB at a time on -j threads. The result\n"
+			"                                is a normal .tar.gz that restore can also read out of order\n"
+			"    -g {catalog}             -  Incremental backup. Only files that are new or changed since\n"
+			"                                the catalog was written are archived, deleted files are\n"
+			"                                recorded as '.wh.{name}' whiteouts, then the catalog is updated.\n"
+			"        catalog : A file that doesn't exist yet makes a full backup and starts the catalog\n"
+			"    -d {store}               -  Deduplicate. Files are cut into content defined chunks, each\n"
+			"                                new chunk is kept once in the store and the archive only\n"
+			"                                holds the list of chunks each file is made of\n"
+			"        store   : A directory, created if needed, that can be shared by many backups\n"
+			"    -s {manifest}            -  Split the archive into shards, one for each -f given, written\n"
+			"                                at once. Each shard is a complete tar with its own index and\n"
+			"                                the manifest lists them, give it to restore -f to restore them\n"
+			"                                all at once\n"
+			"    -c, --checksum           -  Record a CRC32C of every member's data, in a pax extended header\n"
+			"                                before it and in the index, for restore --verify and --compare.\n"
+			"                                Files over 1MiB are read twice, the second time mostly from cache\n"
+			"    -a, --append             -  Add to the -f archive instead of rewriting it. Only files it\n"
+			"                                doesn't have, or whose type, mode, time or size has changed, are\n"
+			"                                written, after its last member, and its index is updated. Restore\n"
+			"                                keeps the last copy of a name. Not for -z archives or with -s\n"
+			"    -r, --resume             -  Carry on with a backup to the -f archive that was killed or\n"
+			"                                crashed, from the last checkpoint in '{filename}.journal'. The\n"
+			"                                archive is cut back to there, then appended to as with -a, and\n"
+			"                                finished directories aren't read again. Give the same switches\n"
+			"                                and path as the interrupted backup\n"
+			"    -e, --exclude {pattern}  -  Leave out what matches, a directory with everything in it, which\n"
+			"                                the walk then never reads. Can be used more than once\n"
+			"        pattern : A name or shell pattern such as 'node_modules' or '*.o', matched at any depth,\n"
+			"                  or with a '/' a path below the start directory such as 'build/cache'.\n"
+			"                  Ending in '/' only matches directories\n"
+			"    -i, --include {pattern}  -  Keep what matches even if a later -e would leave it out, the\n"
+			"                                first rule that matches decides. A path also keeps the\n"
+			"                                directories leading to it, so '-i src/keep -e \"*\"' works\n"
+			"    -X, --exclude-from {file}-  Rules from a file, one to a line: '- {pattern}' or just the\n"
+			"                                pattern to exclude, '+ {pattern}' to include, '#' comments\n"
+			"    -q, --quiet              -  No line for every file archived or restored\n"
+			"    -P, --progress           -  Files, throughput and time left on stderr every second\n"
+			"    --stats[={file}]         -  Write a JSON summary of the run when it ends, with counters and\n"
+			"                                timers for each phase and the slowest files. To stderr unless a\n"
+			"                                file is given\n"
+			"    -n, --no-cache           -  Leave the page cache as it was. The archive is written with\n"
+			"                                O_DIRECT where the file system allows it and every file is\n"
+			"                                dropped from the cache once read. Restore writes each file\n"
+			"                                back to disk before dropping it, which is slower\n"
 			"    -h                       -  Help message\n\n"
-			"    Restore only uses the -f switch to select the archive to unpack and -h for help\n\n");
+			"    Restore only uses the -f switch to select the archive to unpack (compressed or not), -j to\n"
+			"    set how many files are restored at once, -d, -q, -P, -n, --stats and -h as above, plus\n"
+			"    four switches of its own.\n"
+			"    -l                       -  List the members of the archive instead of restoring them\n"
+			"    -x {<path>, <glob>}      -  Only restore (or list) these members, can be used more than once\n"
+			"        path    : A member as listed by -l, directories include everything beneath them\n"
+			"        glob    : A shell pattern such as 'src/*.conf'\n"
+			"    -V, --verify             -  Check every member's data against the checksum backup -c\n"
+			"                                recorded, on -j threads, without writing anything\n"
+			"    -C, --compare            -  Check every member against the file it was archived from, found\n"
+			"                                relative to the current directory as restore would write it:\n"
+			"                                type, mode, owner, time, size and, with backup -c, contents.\n"
+			"                                Contents of files archived with -d aren't compared\n"
+			"    Backup writes an index next to the archive, '{filename}.idx', which lets -l and -x\n"
+			"    find members without reading the whole archive. While it runs, a backup to one\n"
+			"    uncompressed archive file checkpoints every 5 seconds in '{filename}.journal' for -r,\n"
+			"    which is removed when the backup finishes. Give -f more than once to restore a full\n"
+			"    backup followed by its -g incrementals, in order, '-f -' reads the archive from stdin\n"
+			"    so 'backup -f - {path} | ssh {host} restore -f -' needs no copy on disk. An archive\n"
+			"    made with -d needs restore -d with the same store. A manifest written by -s can be\n"
+			"    given to -f in place of an archive, shards that have been moved are looked for next to\n"
+			"    the manifest.\n\n");
 		exit(EXIT_SUCCESS);
 	}
 
@@ -322,17 +5863,36 @@ int main(int argc, char *argv[]){
 			exit(EXIT_FAILURE);
 		}
 
+		else if (filterActive()){
+			printf("-e, -i and -X switches are only used by backup, restore chooses members with -x\n");
+		}
+		else if (gl_verify && gl_compare){
+			printf("Use one of -V and -C at a time, use -h for help\n");
+		}
 		else if (fflag == 1){
-			if (!(archive = fopen(farg, "rb"))){
-				perror("fopen -f");
-				printf("%s\n", farg);
-				exit(EXIT_FAILURE);
+			statsStart();
+			for (int i = 0; i < nfargs; i++){					//a full backup then its incrementals
+				if (restoreOpen(fargs[i]) == -1){				//an archive, or a manifest of shards
+					perror("open -f");
+					printf("%s\n", fargs[i]);
+					exit(EXIT_FAILURE);
+				}
+				printf("Archive opened successfully: %s\n", fargs[i]);
+				if (restore() != 1){							//if restore doesn't run successfully
+					exit(EXIT_FAILURE);
+				}
+				restoreClose();
 			}
-			printf("Archive opened successfully: %s\n", farg);
-			if (restore() == 1){								//if restore runs successfully
-				printf("Done\n");
-				exit(EXIT_SUCCESS);
+			statsFinish(gl_verify ? "verify" : gl_compare ? "compare" : "restore");
+			if (gl_verify || gl_compare){
+				printf("%llu members %s, %llu with data but no checksum, %llu %s\n",
+					(unsigned long long)gl_matched, gl_verify ? "verified" : "the same",
+					(unsigned long long)gl_unchecked, (unsigned long long)gl_differ,
+					gl_verify ? "failed" : "different");
+				exit(gl_differ ? EXIT_FAILURE : EXIT_SUCCESS);
 			}
+			printf("Done\n");
+			exit(EXIT_SUCCESS);
 		}
 		else {
 			printf("No archive file specified with -f switch, use -h for help\n");
@@ -341,6 +5901,55 @@ int main(int argc, char *argv[]){
 		exit(EXIT_FAILURE);	
 	}
 
+	if (gl_list || gl_nselect > 0 || gl_verify || gl_compare){
+		printf("-l, -x, -V and -C switches are only used by restore, use -h for help\n");
+		exit(EXIT_FAILURE);
+	}
+	if (nfargs > 1 && !gl_manifest){
+		printf("Backup writes to one archive, only use -f once unless splitting it into shards with -s\n");
+		exit(EXIT_FAILURE);
+	}
+	if (gl_manifest && nfargs == 0){
+		printf("-s needs the shards to write given with -f, use -h for help\n");
+		exit(EXIT_FAILURE);
+	}
+	if (gl_resume && (nfargs != 1 || gl_manifest || gl_compress || strcmp(fargs[0], "-") == 0)){
+		printf("-r resumes the one uncompressed archive file given with -f, not with -s or -z, use -h for help\n");
+		exit(EXIT_FAILURE);
+	}
+	gl_append |= gl_resume;						//what follows the journal's member is appended
+	if (gl_append && (nfargs != 1 || gl_manifest || gl_compress)){
+		printf("-a appends to the one uncompressed archive given with -f, not with -s or -z, use -h for help\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < nfargs; i++){
+		if (strcmp(fargs[i], "-") == 0 && (gl_manifest || gl_append)){
+			printf("-f - writes one archive to stdout, not shards with -s or to append to with -a\n");
+			exit(EXIT_FAILURE);
+		}
+		if (strcmp(fargs[i], "-") == 0 && isatty(STDOUT_FILENO)){
+			printf("Not writing an archive to a terminal, redirect stdout or pipe it somewhere\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (gl_storePath && storeStart() == -1){
+		perror("store -d");
+		printf("%s\n", gl_storePath);
+		exit(EXIT_FAILURE);
+	}
+	if (gl_storePath){
+		int fd = open(gl_storePath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd != -1){
+			ownAdd(fd);							//chunks written during the walk aren't backed up again
+			close(fd);
+		}
+	}
+	if (gl_catalogPath && catalogLoad(gl_catalogPath) == -1){
+		perror("catalog -g");
+		printf("%s is not a catalog written by backup -g\n", gl_catalogPath);
+		exit(EXIT_FAILURE);
+	}
+
 	if (argv[optind] != NULL){					//checks if there is a final argument and treats it as the last
 		errno = 0;
 		if (path = realpath(argv[optind], path), path == NULL){
@@ -367,28 +5976,52 @@ int main(int argc, char *argv[]){
 	}
 		
 	/*	fflag active
-	* Opens or creates and opens a file to archive the selected files in.
+	* Opens or creates and opens a file to archive the selected files in, or with -s every shard.
 	* If '-f' isn't used in the command line a default file is created called backup_{date}
 	*/
+	int fds[nfargs > 0 ? nfargs : 1];
+	char defName[40];
 	if (fflag == 1){
-		if (!(archive = fopen(farg, "wb"))){			//if file creation unsuccessful
-			perror("fopen -f");
-			printf("%s\n", farg);
-			exit(EXIT_FAILURE);
+		for (int i = 0; i < nfargs; i++){
+			int flags = gl_append ? O_RDWR | O_CREAT | O_CLOEXEC : O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+			if (strcmp(fargs[i], "-") == 0){
+				if ((fds[i] = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0)) == -1 ||		//the archive takes
+					dup2(STDERR_FILENO, STDOUT_FILENO) == -1){							//stdout and every
+					perror("stdout -f");												//message goes to
+					exit(EXIT_FAILURE);													//stderr instead
+				}
+				fcntl(fds[i], F_SETPIPE_SZ, WRITE_BUFFER);		//a whole buffer per write, if it's a pipe
+			}
+			else if ((fds[i] = open(fargs[i], flags, 0666)) == -1){						//if file
+				perror("fopen -f");														//creation unsuccessful
+				printf("%s\n", fargs[i]);
+				exit(EXIT_FAILURE);
+			}
+			printf("File opened successfully: %s\n", fargs[i]);
+		}
+		for (int i = 0; i < nfargs; i++){
+			ownAdd(fds[i]);								//so the walk doesn't archive the archive
+		}
+		if (gl_resume){
+			resumeOpen(fargs[0], fds[0]);				//cut the archive back to the last checkpoint
+		}
+		if (gl_append){
+			appendOpen(fargs[0], fds[0]);				//find the end blocks and what's already archived
 		}
-		printf("File opened successfully: %s\n", farg);
 	}
 	else {												//create a default file name and opens it
 		struct tm *tmNow = localtime(&gl_now);
-		char defName[40];
 		strftime(defName, 40, "backup_%Y-%m-%d_%H-%M-%S.tar", tmNow);	//name is in this format with that date
-		if (!(archive = fopen(defName, "wb"))){
+		if ((fds[0] = open(defName, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)) == -1){
 			perror("fopen");
 			printf("An internal error occurred, please specify a filename with -f or retry\n");
 			exit(EXIT_FAILURE);
 		}
+		ownAdd(fds[0]);
 		farg = &defName[0];								//make farg = default archive file name for easier
-		printf("Default file used: ./%s\n", defName);	//cleanup ( remove(farg); )
+		fargs = &farg;									//cleanup ( remove(farg); )
+		nfargs = 1;
+		printf("Default file used: ./%s\n", defName);
 	}
 
 	/*	tflag active
@@ -401,7 +6034,7 @@ int main(int argc, char *argv[]){
 			struct tm tm;
 			if (strptime(targ, "%Y-%m-%d %H:%M:%S", &tm) == NULL){
 				printf("strptime: Date format not recognised\n");
-				remove(farg);					//delete corrupted or unfinished archive file silently
+				removeArchives(fargs, nfargs);
 				exit(EXIT_FAILURE);
 			}
 			gl_startDate = mktime(&tm);			//sets global variable gl_startDate
@@ -411,25 +6044,49 @@ int main(int argc, char *argv[]){
 			if (stat(targ, &sb) == -1){			//this will fail if the file doesn't exist, this also means
 				perror("stat -t");				//that it catches when the date format is slightly wrong
 				printf("%s\n", targ);
-				remove(farg);					//delete corrupted or unfinished archive file silently
+				removeArchives(fargs, nfargs);
 				exit(EXIT_FAILURE);
 			}
 			gl_startDate = sb.st_mtime;			//sets global variable time_t for use in 'backup' function
 		}	
 	}
 
-	if (nftw(path, backup, 20, 0) == 0){	//start file tree walk, running the backup function for every file
+	if (nfargs == 1 && !gl_manifest && !gl_compress && strcmp(fargs[0], "-") != 0){
+		journalStart(fargs[0]);					//checkpoints for -r if the backup is interrupted
+		if (gl_journalFd != -1){
+			ownAdd(gl_journalFd);
+		}
+	}
+	statsStart();
+	pipeStart(fds, fargs, nfargs, gl_threads);	//start the reader and writer threads
+	if (walk(path, backup) == 0){			//start file tree walk, running the backup function for every file
+		if (gl_catalogPath){
+			queueDeletions();				//whiteouts for whatever has gone since the last catalog
+		}
+		pipeFinish();						//wait for the last members to be written and the archives finished
+		journalFinish();
 		printf("Done\n");
 	}
 	else {
-		perror("ntfw");
+		perror("walk");
 		printf("%s\n", argv[optind]);
-		remove(farg);					//delete corrupted or unfinished archive file silently
+		if (gl_append){
+			appendUndo(fds[0]);			//an archive that was appended to goes back the way it was
+		}
+		removeArchives(fargs, nfargs);
 		exit(EXIT_FAILURE);
 	}
 
-	fpad(archive, 1024);					//pad the archive with two tar headers worth of empty space
-	fclose(archive);
+	if (gl_manifest && manifestWrite(gl_manifest) == 0){
+		printf("Manifest written: %s\n", gl_manifest);
+	}
+	for (int i = 0; i < nfargs; i++){
+		close(fds[i]);
+	}
+	if (gl_catalogPath && catalogWrite(gl_catalogPath) == 0){	//only once the archive is complete
+		printf("Catalog written: %s\n", gl_catalogPath);
+	}
+	statsFinish("backup");
 	free(path);								//realpath() function allocates memory that needs to be freed
 	exit(EXIT_SUCCESS);
 }
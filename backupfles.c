@@ -6,8 +6,7 @@
 *					a last modified time of a file or a specified date as a string
 */
 
-#define _XOPEN_SOURCE 500		//implementing POSIX 1995
-#include <ftw.h>
+#define _GNU_SOURCE			//POSIX plus statx()
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,6 +15,10 @@
 #include <pwd.h>
 #include <time.h>
 #include <grp.h>
+#include "idcache.h"
+#include "scan.h"
+#include "filter.h"
+#include "rollup.h"
 #include <unistd.h>
 
 /* GLOBAL VARIABLES
@@ -23,10 +26,10 @@
 */
 time_t gl_backup;
 
-static int to_backup(const char *fpath, const struct stat *sb,
-								int tflag, struct FTW *ftwbuf){	
-	if (difftime(sb->st_mtime, gl_backup) > 0){
-		mode_t perm = sb->st_mode;
+static int to_backup(const ScanEntry *entry){
+	const struct statx *stx = entry->stx;
+	if (difftime(stx->stx_mtime.tv_sec, gl_backup) > 0){
+		mode_t perm = stx->stx_mode;
 		char permissions[11] = {									//creating permissions string in 'ls' form
 		(perm & S_IFREG) ? '-' : (perm & S_IFDIR) ? 'd' : '?',		//ie. -rwxrwxrwx
 		(perm & S_IRUSR) ? 'r' : '-', (perm & S_IWUSR) ? 'w' : '-',
@@ -36,41 +39,54 @@ static int to_backup(const char *fpath, const struct stat *sb,
 		(perm & S_IXOTH) ? 'x' : '-', '\0'
 		};
 
-		struct passwd *pw;	
-		if (pw = getpwuid(sb->st_uid), pw  == NULL){				//passwd struct to get owner name
-			perror("getpwuid");
-			exit(EXIT_FAILURE);
-		}
-
-		struct group *gr;											//group struct to get group name
-		if (gr = getgrgid(sb->st_gid), gr == NULL){
-			perror("getgrgid");
-			exit(EXIT_FAILURE);
-		}
-
 		char lastModified[20];
-		strftime(lastModified, 20, "%b %d %H:%M", localtime(&sb->st_mtime));	//date string of last modified
-																				//date of current file
-		printf("  %s  %2d  %8s  %10s  %6jd  %s  %-16s\n", permissions, (int)sb->st_nlink, 
-			pw->pw_name, gr->gr_name, (intmax_t)sb->st_size, lastModified, fpath + ftwbuf->base);
+		formatTime(stx->stx_mtime.tv_sec, lastModified);			//date string of last modified
+																	//date of current file
+		outPrintf("  %s  %2d  %8s  %10s  %6jd  %s  %-16s\n", permissions, (int)stx->stx_nlink, 
+			uidName(stx->stx_uid), gidName(stx->stx_gid), (intmax_t)stx->stx_size, lastModified,
+			entry->path + entry->base);
 	}
 	return 0;				//continue to next file
 }
 
 int main(int argc, char *argv[]){
 	char *path;
-	int flags = 0 | FTW_PHYS ;
 	int option;
-	int tflag;
-	int hflag;
+	int tflag = 0;
+	int hflag = 0;
 	char *targ;
+	size_t top = 0;
+	int key = ROLLUP_CHANGED;
 
-	while ((option = getopt(argc, argv, "ht:")) != -1){
+	while ((option = getopt(argc, argv, "ht:e:i:X:d:k:")) != -1){
 		switch (option){
 			case 't':
 				tflag = 1;				//set tflag
 				targ = optarg;			
 				break;
+			case 'e':
+			case 'i':
+				if (filterAdd(optarg, option == 'i') == -1){	//rules apply in the order given
+					printf("    -%c {pattern}\n", option);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'X':
+				if (filterLoad(optarg) == -1){
+					perror("-X");
+					printf("%s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'd':
+				top = strtoul(optarg, NULL, 10);	//totals for the top directories instead
+				break;
+			case 'k':
+				if ((key = rollupKey(optarg)) == -1){
+					printf("    -k {size, files, changed}\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
 			case 'h':
 				hflag = 1;				//set hflag
 				break;
@@ -79,6 +95,18 @@ int main(int argc, char *argv[]){
 					printf("    -t {<filename>, <date>}\n");	//-t usage reminder
 					exit(EXIT_FAILURE);
 				}
+				if (optopt == 'e' || optopt == 'i'){
+					printf("    -%c {pattern}\n", optopt);		//-e and -i usage reminder
+					exit(EXIT_FAILURE);
+				}
+				if (optopt == 'X'){
+					printf("    -X {file}\n");					//-X usage reminder
+					exit(EXIT_FAILURE);
+				}
+				if (optopt == 'd' || optopt == 'k'){
+					printf("    -d {directories} -k {size, files, changed}\n");	//-d and -k usage reminder
+					exit(EXIT_FAILURE);
+				}
 				break;
 			default:
 				printf("fatal error\n");		//shouldnt ever reach here just a catch
@@ -96,7 +124,14 @@ int main(int argc, char *argv[]){
 			"    -t {<filename>, <date>} {path}\n"
 			"        filename: Relative path to a file\n"
 			"        date    : A date in the format 'YYYY-MM-DD hh:mm:ss'\n"
-			"        path    : A path to the directory where the function will start\n\n");
+			"        path    : A path to the directory where the function will start\n"
+			"    -e {pattern}, -i {pattern}, -X {file}\n"
+			"        Leave out (-e) or keep (-i) what matches, or read rules from a file (-X), the\n"
+			"        same rules as backup. Directories left out aren't looked inside at all\n"
+			"    -d {directories}, -k {size, files, changed}\n"
+			"        Instead of a line for every file, print the directories with the most changed\n"
+			"        bytes beneath them, or the most bytes or files with -k. Each line has the\n"
+			"        bytes and files beneath the directory and how many of them changed since -t\n\n");
 		exit(EXIT_SUCCESS);
 	}
 		
@@ -127,10 +162,25 @@ int main(int argc, char *argv[]){
 		exit(EXIT_FAILURE);
 	}
 		
-	if (nftw(path, to_backup, 20, 0) == -1){
-		perror("ntfw");
+	if (filterActive()){
+		scanPrune(filterExcluded);				//excluded entries are never stat'd or descended into
+	}
+	if (top > 0){
+		rollupStart(1, gl_backup);				//one pass, totals for every directory
+		if (scanTree(path, STATX_MODE | STATX_SIZE | STATX_MTIME, rollupAdd) == -1){
+			perror("scanTree");
+			exit(EXIT_FAILURE);
+		}
+		rollupPrint(top, key);
+		outFlush();
+		exit(EXIT_SUCCESS);
+	}
+	unsigned int fields = STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID | STATX_SIZE | STATX_MTIME;
+	if (scanTree(path, fields, to_backup) == -1){		//every field is printed, so nothing can skip the stat
+		perror("scanTree");
 		exit(EXIT_FAILURE);
 	}
+	outFlush();
 	
 	exit(EXIT_SUCCESS);
 }
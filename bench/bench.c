@@ -0,0 +1,236 @@
+/*
+*	Name		:	bench.c
+*	Description	:	Benchmark harness. Runs backup, restore, listfiles and backupfles on a tree (such as one
+*					made by gentree) and reports files/sec, MB/s, peak RSS and syscall counts for each,
+*					taking the fastest of several runs.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ftw.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+/*	Struct RunResult  -typedef-  Result
+* What one run of a program cost.
+*/
+typedef struct RunResult{
+	double seconds;					//wall clock
+	long maxRss;					//peak resident set in KiB, from wait4()
+	long long readCalls;			//read family syscalls, 'syscr' in /proc/{pid}/io
+	long long writeCalls;			//write family syscalls, 'syscw' in /proc/{pid}/io
+	int status;						//exit status as returned by wait4()
+}
+Result;
+
+/*	Global Variables
+* gl_files			long long	regular files in the tree
+* gl_bytes			long long	bytes in those files
+* gl_dirs			long long	directories in the tree
+*/
+long long	gl_files;
+long long	gl_bytes;
+long long	gl_dirs;
+
+/*	countTree  -  returns int
+* nftw() callback that adds up the tree so throughput can be worked out.
+*/
+int countTree(const char *fpath, const struct stat *sb, int tflag, struct FTW *ftwbuf){
+	if (tflag == FTW_F && S_ISREG(sb->st_mode)){
+		gl_files++;
+		gl_bytes += sb->st_size;
+	}
+	else if (tflag == FTW_D){
+		gl_dirs++;
+	}
+	return 0;
+}
+
+/*	removeTree  -  returns int
+* nftw() callback run bottom up to delete a restored tree between runs.
+*/
+int removeTree(const char *fpath, const struct stat *sb, int tflag, struct FTW *ftwbuf){
+	if (tflag == FTW_DP){
+		chmod(fpath, 0700);									//restore may have made it read-only
+	}
+	remove(fpath);
+	return 0;
+}
+
+/*	readIo  -  returns void
+* Reads the syscall counters of a finished child that hasn't been reaped yet.
+*/
+void readIo(pid_t pid, Result *result){
+	char path[64], line[256];
+	snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+	FILE *io = fopen(path, "r");
+	if (!io){
+		result->readCalls = result->writeCalls = -1;
+		return;
+	}
+	while (fgets(line, sizeof(line), io)){
+		sscanf(line, "syscr: %lld", &result->readCalls);
+		sscanf(line, "syscw: %lld", &result->writeCalls);
+	}
+	fclose(io);
+}
+
+/*	run  -  returns Result
+* Runs 'argv' in directory 'dir' with its output thrown away and measures it. The child is waited for with
+* WNOWAIT first so its /proc entry, and the counters in it, are still there to read.
+*/
+Result run(char *const argv[], const char *dir){
+	Result result;
+	memset(&result, 0, sizeof(result));
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pid_t pid = fork();
+	if (pid == -1){
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+	if (pid == 0){
+		int null = open("/dev/null", O_WRONLY);
+		dup2(null, STDOUT_FILENO);
+		if (dir && chdir(dir) == -1){
+			perror("chdir");
+			_exit(127);
+		}
+		execv(argv[0], argv);
+		perror("execv");
+		_exit(127);
+	}
+	siginfo_t info;
+	waitid(P_PID, pid, &info, WEXITED | WNOWAIT);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	readIo(pid, &result);
+	struct rusage usage;
+	wait4(pid, &result.status, 0, &usage);
+	result.seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	result.maxRss = usage.ru_maxrss;
+	return result;
+}
+
+/*	report  -  returns void
+* Prints one line of the results table.
+*/
+void report(const char *name, const Result *best, long long files, long long bytes){
+	if (!WIFEXITED(best->status) || WEXITSTATUS(best->status) != 0){
+		printf("  %-12s  failed, exit status %d\n", name, WIFEXITED(best->status) ? WEXITSTATUS(best->status) : -1);
+		return;
+	}
+	printf("  %-12s  %9.3f  %12.0f  %9.1f  %9.1f  %12lld  %12lld\n", name, best->seconds,
+		files / best->seconds, bytes / best->seconds / (1 << 20), best->maxRss / 1024.0,
+		best->readCalls, best->writeCalls);
+}
+
+int main(int argc, char *argv[]){
+	int option;
+	int hflag = 0;
+	int runs = 3;
+	char *binDir = ".";
+	char *workDir = "/tmp";
+	while ((option = getopt(argc, argv, "hr:b:o:")) != -1){
+		switch (option){
+			case 'r':
+				runs = atoi(optarg);
+				break;
+			case 'b':
+				binDir = optarg;
+				break;
+			case 'o':
+				workDir = optarg;
+				break;
+			case 'h':
+				hflag = 1;
+				break;
+			default:
+				printf("use -h for help\n");
+				exit(EXIT_FAILURE);
+		}
+	}
+	if (hflag || argv[optind] == NULL){
+		printf("\nUse of bench/bench\n"
+			"    bench [switches] {tree}\n"
+			"    -r {runs}            -  Runs of each program, the fastest is reported, default 3\n"
+			"    -b {directory}       -  Where the built programs are, default .\n"
+			"    -o {directory}       -  Where the archive and the restored tree go, default /tmp\n\n");
+		exit(hflag ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	if (runs < 1){
+		runs = 1;
+	}
+
+	char tree[PATH_MAX], bin[PATH_MAX], work[PATH_MAX];
+	if (!realpath(argv[optind], tree) || !realpath(binDir, bin) || (mkdir(workDir, 0755) == -1 && errno != EEXIST) ||
+		!realpath(workDir, work)){
+		perror("realpath");
+		exit(EXIT_FAILURE);
+	}
+	if (nftw(tree, countTree, 20, FTW_PHYS) == -1){
+		perror("nftw");
+		exit(EXIT_FAILURE);
+	}
+
+	char backupPath[PATH_MAX + 16], restorePath[PATH_MAX + 16], listPath[PATH_MAX + 16], filesPath[PATH_MAX + 16];
+	char archive[PATH_MAX + 16], restoreDir[PATH_MAX + 16];
+	snprintf(backupPath, sizeof(backupPath), "%s/backup", bin);
+	snprintf(restorePath, sizeof(restorePath), "%s/restore", bin);
+	snprintf(listPath, sizeof(listPath), "%s/listfiles", bin);
+	snprintf(filesPath, sizeof(filesPath), "%s/backupfles", bin);
+	snprintf(archive, sizeof(archive), "%s/bench.tar", work);
+	snprintf(restoreDir, sizeof(restoreDir), "%s/restored", work);
+
+	char *backupArgs[] = { backupPath, "-f", archive, tree, NULL };
+	char *restoreArgs[] = { restorePath, "-f", archive, NULL };
+	char *listArgs[] = { listPath, NULL };
+	char *filesArgs[] = { filesPath, "-t", "1970-01-02 00:00:00", tree, NULL };
+	struct {
+		const char *name;
+		char **argv;
+		const char *dir;
+	} programs[] = {
+		{ "backup", backupArgs, NULL },
+		{ "restore", restoreArgs, restoreDir },
+		{ "listfiles", listArgs, tree },
+		{ "backupfles", filesArgs, NULL },
+	};
+
+	printf("\n%lld files, %lld directories, %.1f MiB in %s, best of %d runs\n\n", gl_files, gl_dirs,
+		gl_bytes / (double)(1 << 20), tree, runs);
+	printf("  %-12s  %9s  %12s  %9s  %9s  %12s  %12s\n", "program", "seconds", "files/sec", "MB/s",
+		"RSS MiB", "read calls", "write calls");
+	for (size_t p = 0; p < sizeof(programs) / sizeof(programs[0]); p++){
+		Result best;
+		for (int i = 0; i < runs; i++){
+			if (programs[p].dir == restoreDir){
+				nftw(restoreDir, removeTree, 20, FTW_DEPTH | FTW_PHYS);
+				mkdir(restoreDir, 0755);
+			}
+			sync();											//start every run from the same writeback state
+			Result result = run(programs[p].argv, programs[p].dir);
+			if (i == 0 || result.status != 0 || (best.status == 0 && result.seconds < best.seconds)){
+				best = result;
+			}
+		}
+		report(programs[p].name, &best, gl_files + gl_dirs, gl_bytes);
+	}
+	printf("\n  files/sec counts directories as well as files, read and write calls are the kernel's\n"
+		"  syscr and syscw counters, which cover the read and write families of syscalls.\n\n");
+
+	nftw(restoreDir, removeTree, 20, FTW_DEPTH | FTW_PHYS);
+	remove(archive);
+	char index[PATH_MAX + 32];
+	snprintf(index, sizeof(index), "%s.idx", archive);
+	remove(index);
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,208 @@
+/*
+*	Name		:	gentree.c
+*	Description	:	Generates a synthetic directory tree to benchmark backup, restore, listfiles and backupfles
+*					on. The same options and seed always produce the same tree, file names, sizes and
+*					contents included, so runs on different builds or machines can be compared.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <ftw.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#define SPARSE_SEGMENT	(64 << 10)		//a sparse file has data in one of every 8 of these
+#define TREE_TIME		1577836800		//2020-01-01, every file and directory gets this mtime so backup
+										//doesn't take them for its own archive
+
+/*	Global Variables
+* gl_files			long		number of files to generate, set with -n
+* gl_minSize		long		smallest file size, set with -s
+* gl_maxSize		long		largest file size, set with -s
+* gl_depth			int			number of directory levels above the files, set with -d
+* gl_width			int			subdirectories per directory, set with -w
+* gl_sparse			int			percentage of files made sparse, set with -p
+* gl_seed			uint64_t	seed for everything random, set with -S
+*/
+long		gl_files = 10000;
+long		gl_minSize = 0;
+long		gl_maxSize = 1 << 20;
+int			gl_depth = 3;
+int			gl_width = 8;
+int			gl_sparse = 0;
+uint64_t	gl_seed = 1;
+
+/*	mix  -  returns uint64_t
+* splitmix64 finaliser, turns a counter into a well mixed random value.
+*/
+uint64_t mix(uint64_t z){
+	z += 0x9e3779b97f4a7c15ULL;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/*	fileSize  -  returns long
+* Size of file 'i', log-uniform between gl_minSize and gl_maxSize so that there are many small files and a few
+* big ones, as in most real trees.
+*/
+long fileSize(long i){
+	double unit = (mix(gl_seed ^ mix(i * 4 + 1)) >> 11) * (1.0 / 9007199254740992.0);	//[0, 1)
+	double low = log((double)gl_minSize + 1), high = log((double)gl_maxSize + 1);
+	return (long)(exp(low + unit * (high - low)) - 1);
+}
+
+/*	fillData  -  returns void
+* Fills 'length' bytes with pseudo random data that depends on the file and the offset, so that nothing
+* compresses or deduplicates by accident.
+*/
+void fillData(char *data, size_t length, long file, off_t offset){
+	uint64_t state = mix(gl_seed ^ mix(file * 4 + 2) ^ (uint64_t)offset);
+	for (size_t i = 0; i < length; i += 8){
+		uint64_t word = (state = mix(state));
+		memcpy(data + i, &word, length - i < 8 ? length - i : 8);
+	}
+}
+
+/*	makeDirectories  -  returns int
+* Creates every missing directory along 'path', like mkdir -p.
+*/
+int makeDirectories(char *path){
+	for (char *slash = strchr(path + 1, '/'); slash; slash = strchr(slash + 1, '/')){
+		*slash = '\0';
+		if (mkdir(path, 0755) == -1 && errno != EEXIST){
+			perror("mkdir");
+			printf("%s\n", path);
+			return -1;
+		}
+		*slash = '/';
+	}
+	return 0;
+}
+
+/*	writeFile  -  returns int
+* Creates file number 'i' at 'path'. A sparse file is sized with ftruncate() and only every 8th segment is
+* written, the rest is left as holes.
+*/
+int writeFile(const char *path, long i){
+	static char buffer[SPARSE_SEGMENT];
+	long size = fileSize(i);
+	int sparse = (long)(mix(gl_seed ^ mix(i * 4 + 3)) % 100) < gl_sparse;
+	int fd;
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1){
+		perror("open");
+		printf("%s\n", path);
+		return -1;
+	}
+	if (sparse && ftruncate(fd, size) == -1){
+		perror("ftruncate");
+		close(fd);
+		return -1;
+	}
+	for (off_t at = 0; at < size; at += SPARSE_SEGMENT){
+		size_t length = size - at < SPARSE_SEGMENT ? size - at : SPARSE_SEGMENT;
+		if (sparse && (at / SPARSE_SEGMENT) % 8 != 0){
+			continue;										//left as a hole
+		}
+		fillData(buffer, length, i, at);
+		if (pwrite(fd, buffer, length, at) != (ssize_t)length){
+			perror("write");
+			close(fd);
+			return -1;
+		}
+	}
+	struct timespec times[2] = {{ .tv_sec = TREE_TIME }, { .tv_sec = TREE_TIME }};
+	futimens(fd, times);
+	close(fd);
+	return 0;
+}
+
+/*	setTime  -  returns int
+* nftw() callback run bottom up once every file exists, gives the directories their fixed mtime too.
+*/
+int setTime(const char *fpath, const struct stat *sb, int tflag, struct FTW *ftwbuf){
+	struct timespec times[2] = {{ .tv_sec = TREE_TIME }, { .tv_sec = TREE_TIME }};
+	utimensat(AT_FDCWD, fpath, times, AT_SYMLINK_NOFOLLOW);
+	return 0;
+}
+
+int main(int argc, char *argv[]){
+	int option;
+	int hflag = 0;
+	while ((option = getopt(argc, argv, "hn:s:d:w:p:S:")) != -1){
+		switch (option){
+			case 'n':
+				gl_files = atol(optarg);
+				break;
+			case 's':
+				if (sscanf(optarg, "%ld:%ld", &gl_minSize, &gl_maxSize) != 2 || gl_minSize < 0 ||
+					gl_maxSize < gl_minSize){
+					printf("    -s {min}:{max}\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'd':
+				gl_depth = atoi(optarg);
+				break;
+			case 'w':
+				gl_width = atoi(optarg);
+				break;
+			case 'p':
+				gl_sparse = atoi(optarg);
+				break;
+			case 'S':
+				gl_seed = strtoull(optarg, NULL, 10);
+				break;
+			case 'h':
+				hflag = 1;
+				break;
+			default:
+				printf("use -h for help\n");
+				exit(EXIT_FAILURE);
+		}
+	}
+	if (hflag || argv[optind] == NULL){
+		printf("\nUse of bench/gentree\n"
+			"    gentree [switches] {directory}\n"
+			"    -n {files}           -  Number of files, default 10000\n"
+			"    -s {min}:{max}       -  File sizes in bytes, log-uniform between the two, default 0:1048576\n"
+			"    -d {depth}           -  Directory levels above the files, default 3\n"
+			"    -w {width}           -  Subdirectories per directory, default 8\n"
+			"    -p {percent}         -  Percentage of files that are sparse, default 0\n"
+			"    -S {seed}            -  Seed, the same seed and switches make the same tree, default 1\n\n");
+		exit(hflag ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	if (gl_width < 1 || gl_depth < 0){
+		printf("-w must be at least 1 and -d at least 0\n");
+		exit(EXIT_FAILURE);
+	}
+
+	const char *root = argv[optind];
+	char path[PATH_MAX];
+	long long bytes = 0;
+	for (long i = 0; i < gl_files; i++){
+		int length = snprintf(path, sizeof(path), "%s/", root);
+		for (int level = 0; level < gl_depth; level++){		//each file lands in a random leaf directory
+			long dir = mix(gl_seed ^ mix(i * 4) ^ level) % gl_width;
+			length += snprintf(path + length, sizeof(path) - length, "d%ld/", dir);
+		}
+		snprintf(path + length, sizeof(path) - length, "f%ld", i);
+		if (makeDirectories(path) == -1 || writeFile(path, i) == -1){
+			exit(EXIT_FAILURE);
+		}
+		bytes += fileSize(i);
+	}
+	if (nftw(root, setTime, 20, FTW_DEPTH | FTW_PHYS) == -1){
+		perror("nftw");
+		exit(EXIT_FAILURE);
+	}
+	printf("%ld files, %lld bytes in %s\n", gl_files, bytes, root);
+	exit(EXIT_SUCCESS);
+}
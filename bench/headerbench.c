@@ -0,0 +1,401 @@
+/*
+*	Name		:	headerbench.c
+*	Description	:	Benchmark and cross-check of the tar header codec in header.c. Checks the codec against
+*					snprintf(), a digit at a time decoder and a byte at a time checksum on random fields,
+*					then against real GNU tar output, then times encoding and decoding headers both ways.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ftw.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "header.h"
+
+/*	Global Variables
+* gl_seed			uint64_t	seed for everything random, set with -S
+* gl_failures		long		mismatches found by the checks
+* gl_sink			uint64_t	everything timed is added in here so the compiler can't drop it
+*/
+uint64_t			gl_seed = 1;
+long				gl_failures;
+volatile uint64_t	gl_sink;
+
+/*	mix  -  returns uint64_t
+* splitmix64 finaliser, turns a counter into a well mixed random value.
+*/
+uint64_t mix(uint64_t z){
+	z += 0x9e3779b97f4a7c15ULL;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/*	now  -  returns double
+* Monotonic clock in seconds.
+*/
+double now(void){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/*	slowGet  -  returns uint64_t
+* The decoder the codec replaced, one digit at a time.
+*/
+uint64_t slowGet(const char *field, size_t width){
+	uint64_t value = 0;
+	size_t i = 0;
+	while (i < width && field[i] == ' '){
+		i++;
+	}
+	for (; i < width && field[i] >= '0' && field[i] <= '7'; i++){
+		value = (value << 3) | (field[i] - '0');
+	}
+	return value;
+}
+
+/*	slowSum  -  returns unsigned int
+* The checksum the codec replaced, one byte at a time.
+*/
+unsigned int slowSum(const Header *header){
+	const unsigned char *bytes = (const unsigned char *)header;
+	unsigned int sum = 8 * ' ';
+	for (size_t i = 0; i < sizeof(Header); i++){
+		sum += bytes[i];
+	}
+	for (size_t i = 0; i < sizeof(header->checksum); i++){
+		sum -= (unsigned char)header->checksum[i];
+	}
+	return sum;
+}
+
+/*	slowEncode  -  returns void
+* Fills in a header's numeric fields and checksum the way backup did before the codec.
+*/
+void slowEncode(Header *header, const uint64_t *values){
+	snprintf(header->mode, 8, "%06o", (unsigned int)values[0]);
+	snprintf(header->owner, 8, "%06o", (unsigned int)values[1]);
+	snprintf(header->group, 8, "%06o", (unsigned int)values[2]);
+	snprintf(header->size, 12, "%011lo", (unsigned long)values[3]);
+	snprintf(header->modified, 12, "%011lo", (unsigned long)values[4]);
+	memset(header->checksum, ' ', 8);
+	snprintf(header->checksum, 8, "%06o", slowSum(header));
+}
+
+/*	fastEncode  -  returns void
+* The same with the codec.
+*/
+void fastEncode(Header *header, const uint64_t *values){
+	octalPut(header->mode, 6, values[0]);
+	octalPut(header->owner, 6, values[1]);
+	octalPut(header->group, 6, values[2]);
+	octalPut(header->size, 11, values[3]);
+	octalPut(header->modified, 11, values[4]);
+	headerChecksum(header);
+}
+
+/*	fail  -  returns void
+* Reports one mismatch.
+*/
+void fail(const char *what, const char *field, size_t width){
+	printf("  mismatch in %s: '%.*s'\n", what, (int)width, field);
+	gl_failures++;
+}
+
+/*	checkRandom  -  returns void
+* Compares the codec with the code it replaced on 'count' random fields and headers. Fields are random
+* values of every width, padded with spaces, nulls or junk, and random bytes that are mostly not octal.
+*/
+void checkRandom(long count){
+	char field[16], expect[16];
+	for (long i = 0; i < count; i++){
+		uint64_t r = mix(gl_seed ^ mix(i));
+		int digits = 1 + r % 11;
+		uint64_t value = mix(r) & ((1ULL << (3 * digits)) - 1);
+		memset(field, 'x', sizeof(field));
+		octalPut(field, digits, value);
+		snprintf(expect, sizeof(expect), "%0*lo", digits, (unsigned long)value);
+		if (memcmp(field, expect, digits + 1) != 0){
+			fail("octalPut", field, digits + 1);
+		}
+
+		size_t width = 1 + (r >> 8) % 12;
+		for (size_t j = 0; j < width; j++){
+			uint64_t b = mix(r + j + 1);
+			switch (b % 4){
+				case 0:
+					field[j] = ' ';
+					break;
+				case 1:
+					field[j] = "\0 x8/"[b / 4 % 5];
+					break;
+				default:
+					field[j] = '0' + b / 4 % 8;
+			}
+		}
+		if (octalGet(field, width) != slowGet(field, width)){
+			fail("octalGet", field, width);
+		}
+		memset(field, ' ', sizeof(field));
+		octalPut(field + (r >> 16) % (12 - digits), digits, value);		//space padded, null or no end
+		if (octalGet(field, 12) != value){
+			fail("octalGet", field, 12);
+		}
+
+		Header header;
+		unsigned char *bytes = (unsigned char *)&header;
+		for (size_t j = 0; j < sizeof(Header); j += 8){
+			uint64_t b = mix(r ^ j);
+			memcpy(bytes + j, &b, 8);
+		}
+		if (headerSum(&header) != slowSum(&header)){
+			fail("headerSum", header.checksum, sizeof(header.checksum));
+		}
+	}
+}
+
+/*	makeFile  -  returns void
+* Creates file 'i' of the GNU tar check with random mode, size and modification time.
+*/
+void makeFile(const char *dir, long i){
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/f%ld", dir, i);
+	uint64_t r = mix(gl_seed ^ mix(i + (1ULL << 40)));
+	int file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (file == -1 || ftruncate(file, r % (1 << 20)) == -1){
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	close(file);
+	struct timespec times[2] = { { 0, 0 }, { (r >> 20) % 077777777777, 0 } };
+	if (chmod(path, 0400 | ((r >> 56) & 0777)) == -1 || utimensat(AT_FDCWD, path, times, 0) == -1){
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/*	checkGnu  -  returns void
+* Archives a directory of random files with GNU tar in ustar format and checks every header it wrote: the
+* codec decodes its fields to what stat() says, its checksum verifies, and encoding the same values gives
+* back the same bytes GNU tar wrote for the size, time, mode and checksum fields.
+*/
+void checkGnu(const char *tar, long count){
+	char dir[] = "/tmp/headerbench.XXXXXX";
+	if (!mkdtemp(dir)){
+		perror("mkdtemp");
+		exit(EXIT_FAILURE);
+	}
+	char tree[PATH_MAX], archive[PATH_MAX];
+	snprintf(tree, sizeof(tree), "%s/tree", dir);
+	snprintf(archive, sizeof(archive), "%s/gnu.tar", dir);
+	mkdir(tree, 0755);
+	for (long i = 0; i < count; i++){
+		makeFile(tree, i);
+	}
+
+	pid_t pid = fork();
+	if (pid == 0){
+		int null = open("/dev/null", O_WRONLY);
+		dup2(null, STDERR_FILENO);
+		execlp(tar, tar, "--format=ustar", "-cf", archive, "-C", tree, ".", (char *)NULL);
+		_exit(127);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+		printf("  %s didn't run, GNU tar check skipped\n", tar);
+	}
+	else {
+		FILE *in = fopen(archive, "r");
+		Header header;
+		long checked = 0;
+		while (in && fread(&header, sizeof(Header), 1, in) == 1 && header.name[0]){
+			if (octalGet(header.checksum, sizeof(header.checksum)) != headerSum(&header)){
+				fail("GNU tar checksum", header.checksum, sizeof(header.checksum));
+			}
+			Header copy = header;
+			headerChecksum(&copy);
+			if (memcmp(copy.checksum, header.checksum, sizeof(header.checksum)) != 0){
+				fail("headerChecksum", copy.checksum, sizeof(copy.checksum));
+			}
+
+			char path[PATH_MAX + 128];
+			struct stat sb;
+			snprintf(path, sizeof(path), "%s/%.100s", tree, header.name);
+			if (lstat(path, &sb) == -1){
+				perror(path);
+				exit(EXIT_FAILURE);
+			}
+			uint64_t size = octalGet(header.size, sizeof(header.size));
+			if (octalGet(header.mode, sizeof(header.mode)) != (sb.st_mode & 07777) ||
+				octalGet(header.owner, sizeof(header.owner)) != sb.st_uid ||
+				octalGet(header.group, sizeof(header.group)) != sb.st_gid ||
+				octalGet(header.modified, sizeof(header.modified)) != (uint64_t)sb.st_mtime ||
+				(S_ISREG(sb.st_mode) && size != (uint64_t)sb.st_size)){
+				fail("GNU tar fields", header.name, sizeof(header.name));
+			}
+			octalPut(copy.mode, 7, sb.st_mode & 07777);
+			octalPut(copy.size, 11, size);
+			octalPut(copy.modified, 11, sb.st_mtime);
+			if (memcmp(copy.mode, header.mode, sizeof(header.mode)) != 0 ||
+				memcmp(copy.size, header.size, sizeof(header.size)) != 0 ||
+				memcmp(copy.modified, header.modified, sizeof(header.modified)) != 0){
+				fail("octalPut against GNU tar", header.name, sizeof(header.name));
+			}
+			checked++;
+			fseeko(in, (size + sizeof(Header) - 1) / sizeof(Header) * sizeof(Header), SEEK_CUR);
+		}
+		if (in){
+			fclose(in);
+		}
+		printf("  %ld GNU tar headers checked\n", checked);
+	}
+
+	char command[PATH_MAX + 16];
+	snprintf(command, sizeof(command), "rm -rf %s", dir);
+	if (system(command) != 0){
+		printf("  couldn't remove %s\n", dir);
+	}
+}
+
+/*	timeCodec  -  returns void
+* Times encoding and decoding 'count' headers, 'runs' times each, with the old code and with the codec.
+*/
+void timeCodec(long count, int runs){
+	Header *headers = calloc(count, sizeof(Header));
+	uint64_t *values = malloc(count * 5 * sizeof(uint64_t));
+	if (!headers || !values){
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	for (long i = 0; i < count; i++){
+		uint64_t r = mix(gl_seed ^ mix(i + (2ULL << 40)));
+		values[i * 5 + 0] = 0100000 | (r & 0777);
+		values[i * 5 + 1] = (r >> 9) & 0xFFFF;
+		values[i * 5 + 2] = (r >> 25) & 0xFFFF;
+		values[i * 5 + 3] = mix(r) % (1ULL << (mix(r + 1) % 33));			//many small sizes, a few big
+		values[i * 5 + 4] = 1500000000 + (r >> 41);
+		snprintf(headers[i].name, 100, "dir%lu/file%ld", (unsigned long)(r % 100), i);
+		memcpy(headers[i].magic, "ustar", 6);
+		memcpy(headers[i].version, "00", 2);
+	}
+
+	double best[4] = { 1e9, 1e9, 1e9, 1e9 };
+	for (int run = 0; run < runs; run++){
+		double start = now();
+		for (long i = 0; i < count; i++){
+			slowEncode(&headers[i], &values[i * 5]);
+		}
+		double slowPut = now() - start;
+		start = now();
+		for (long i = 0; i < count; i++){
+			fastEncode(&headers[i], &values[i * 5]);
+		}
+		double fastPut = now() - start;
+
+		uint64_t total = 0;
+		start = now();
+		for (long i = 0; i < count; i++){
+			const Header *h = &headers[i];
+			total += slowGet(h->mode, 8) + slowGet(h->owner, 8) + slowGet(h->group, 8) +
+				slowGet(h->size, 12) + slowGet(h->modified, 12) + (slowGet(h->checksum, 8) == slowSum(h));
+		}
+		double slowDecode = now() - start;
+		start = now();
+		for (long i = 0; i < count; i++){
+			const Header *h = &headers[i];
+			total -= octalGet(h->mode, 8) + octalGet(h->owner, 8) + octalGet(h->group, 8) +
+				octalGet(h->size, 12) + octalGet(h->modified, 12) + (octalGet(h->checksum, 8) == headerSum(h));
+		}
+		double fastDecode = now() - start;
+		if (total != 0){
+			printf("  decoders disagree\n");
+			gl_failures++;
+		}
+		gl_sink += total;
+
+		double times[4] = { slowPut, fastPut, slowDecode, fastDecode };
+		for (int i = 0; i < 4; i++){
+			if (times[i] < best[i]){
+				best[i] = times[i];
+			}
+		}
+	}
+
+	printf("\n  %-8s  %14s  %14s  %8s\n", "", "snprintf/loop", "codec", "speedup");
+	printf("  %-8s  %11.1f ns  %11.1f ns  %7.2fx\n", "encode", best[0] / count * 1e9, best[1] / count * 1e9,
+		best[0] / best[1]);
+	printf("  %-8s  %11.1f ns  %11.1f ns  %7.2fx\n", "decode", best[2] / count * 1e9, best[3] / count * 1e9,
+		best[2] / best[3]);
+	printf("\n  per header, five numeric fields and the checksum, best of %d runs over %ld headers\n\n", runs, count);
+	free(headers);
+	free(values);
+}
+
+int main(int argc, char *argv[]){
+	int option;
+	int hflag = 0;
+	long count = 1000000;
+	long files = 200;
+	int runs = 5;
+	char *tar = "tar";
+	while ((option = getopt(argc, argv, "hn:f:r:t:S:")) != -1){
+		switch (option){
+			case 'n':
+				count = atol(optarg);
+				break;
+			case 'f':
+				files = atol(optarg);
+				break;
+			case 'r':
+				runs = atoi(optarg);
+				break;
+			case 't':
+				tar = optarg;
+				break;
+			case 'S':
+				gl_seed = strtoull(optarg, NULL, 0);
+				break;
+			case 'h':
+				hflag = 1;
+				break;
+			default:
+				printf("use -h for help\n");
+				exit(EXIT_FAILURE);
+		}
+	}
+	if (hflag){
+		printf("\nUse of bench/headerbench\n"
+			"    headerbench [switches]\n"
+			"    -n {headers}         -  Headers timed and random fields checked, default 1000000\n"
+			"    -f {files}           -  Files archived with GNU tar for the cross-check, 0 skips it, default 200\n"
+			"    -r {runs}            -  Timing runs, the fastest is reported, default 5\n"
+			"    -t {program}         -  GNU tar to cross-check against, default tar\n"
+			"    -S {seed}            -  Seed for the random fields and files, default 1\n\n");
+		exit(EXIT_SUCCESS);
+	}
+	if (count < 1){
+		count = 1;
+	}
+	if (runs < 1){
+		runs = 1;
+	}
+
+	printf("\nchecking the codec\n");
+	checkRandom(count);
+	if (files > 0){
+		checkGnu(tar, files);
+	}
+	printf("  %ld mismatches\n", gl_failures);
+	timeCodec(count, runs);
+	exit(gl_failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
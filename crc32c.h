@@ -0,0 +1,34 @@
+/*
+*	Name		:	crc32c.h
+*	Description	:	CRC32C (Castagnoli) of member data, recorded by backup -c and checked by restore --verify
+*					and --compare. Uses the SSE4.2 or ARMv8 crc32c instructions where the cpu has them, and
+*					a slicing by 8 table otherwise.
+*/
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*	crc32c  -  returns uint32_t
+* Continues 'crc' over 'length' more bytes, the way zlib's crc32() does: start with 0 and pass the result of
+* one call to the next, crc32c(crc32c(0, a), b) is the CRC of a followed by b.
+*
+* crc		uint32_t	CRC of everything before 'data', 0 to start
+* data		void		the bytes to add
+* length	size_t		number of bytes
+*/
+uint32_t crc32c(uint32_t crc, const void *data, size_t length);
+
+/*	crc32cCombine  -  returns uint32_t
+* CRC of two pieces one after the other from the CRCs of each, so that the pieces of a big file can be
+* hashed by different threads. crc32cCombine(crc32c(0, a), crc32c(0, b), length of b) is crc32c(0, ab).
+*
+* first		uint32_t	CRC of the first piece
+* second	uint32_t	CRC of the second piece
+* length	uint64_t	length of the second piece
+*/
+uint32_t crc32cCombine(uint32_t first, uint32_t second, uint64_t length);
+
+#endif
@@ -0,0 +1,225 @@
+/*
+*	Name		:	filter.c
+*	Description	:	Exclude and include rules, see filter.h. Each pattern is looked at once when it's added and
+*					the common shapes, a plain name, '*.ext', 'name*' and a plain path, are compared with
+*					memcmp() instead of fnmatch(), which is only left for real wildcards. The walk asks about
+*					every entry it finds so this is on the same path as readdir() and stat().
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+#include "filter.h"
+
+#define RULE_LITERAL	0				//no wildcards, the whole name or path
+#define RULE_SUFFIX		1				//'*' then no wildcards, the end of the name
+#define RULE_PREFIX		2				//no wildcards then '*', the start of the name
+#define RULE_GLOB		3				//anything else, fnmatch()
+
+/*	Struct FilterRule  -typedef-  FilterRule
+* One compiled rule.
+*/
+typedef struct FilterRule{
+	char *pattern;					//without the leading and trailing '/'
+	size_t length;
+	int include;
+	int dirOnly;					//the pattern ended in '/'
+	int onPath;						//matched against the path below the start directory, not the name
+	int kind;						//RULE_*
+	char **leading;					//an include on a path, the pattern cut after each of its first
+	size_t nleading;				//'nleading' components, for the directories on the way down to it
+}
+FilterRule;
+
+/*	Filter Globals
+* gl_rules			FilterRule	the rules in the order they were given
+* gl_nrules			size_t		number of rules
+*/
+static FilterRule	*gl_rules;
+static size_t		gl_nrules;
+
+/*	hasWildcards  -  returns int
+* Returns 1 if 'text' has any of the characters fnmatch() treats specially.
+*/
+static int hasWildcards(const char *text, size_t length){
+	for (size_t i = 0; i < length; i++){
+		if (text[i] == '*' || text[i] == '?' || text[i] == '[' || text[i] == '\\'){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int filterAdd(const char *pattern, int include){
+	while (*pattern == '/'){
+		pattern++;											//anchored, which a '/' inside makes it anyway
+	}
+	size_t length = strlen(pattern);
+	int dirOnly = 0;
+	while (length > 0 && pattern[length - 1] == '/'){
+		length--;
+		dirOnly = 1;
+	}
+	if (length == 0){
+		return -1;
+	}
+	if (!(gl_rules = realloc(gl_rules, (gl_nrules + 1) * sizeof(FilterRule)))){
+		perror("realloc");
+		exit(EXIT_FAILURE);
+	}
+	FilterRule *rule = &gl_rules[gl_nrules++];
+	memset(rule, 0, sizeof(FilterRule));
+	if (!(rule->pattern = strndup(pattern, length))){
+		perror("strndup");
+		exit(EXIT_FAILURE);
+	}
+	rule->length = length;
+	rule->include = include;
+	rule->dirOnly = dirOnly;
+	rule->onPath = memchr(rule->pattern, '/', length) != NULL;
+	rule->kind = RULE_GLOB;
+	if (!hasWildcards(rule->pattern, length)){
+		rule->kind = RULE_LITERAL;
+	}
+	else if (!rule->onPath && rule->pattern[0] == '*' && !hasWildcards(rule->pattern + 1, length - 1)){
+		rule->kind = RULE_SUFFIX;
+	}
+	else if (!rule->onPath && rule->pattern[length - 1] == '*' && !hasWildcards(rule->pattern, length - 1)){
+		rule->kind = RULE_PREFIX;
+	}
+
+	if (include && rule->onPath){
+		for (size_t i = 0; i < length; i++){
+			if (rule->pattern[i] != '/'){
+				continue;
+			}
+			if (!(rule->leading = realloc(rule->leading, (rule->nleading + 1) * sizeof(char *))) ||
+				!(rule->leading[rule->nleading] = strndup(rule->pattern, i))){
+				perror("malloc");
+				exit(EXIT_FAILURE);
+			}
+			rule->nleading++;
+		}
+	}
+	return 0;
+}
+
+int filterLoad(const char *path){
+	FILE *file;
+	if (!(file = fopen(path, "r"))){
+		return -1;
+	}
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t length;
+	while ((length = getline(&line, &size, file)) != -1){
+		while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')){
+			line[--length] = '\0';
+		}
+		if (length == 0 || line[0] == '#'){
+			continue;
+		}
+		if ((line[0] == '+' || line[0] == '-') && line[1] == ' '){
+			filterAdd(line + 2, line[0] == '+');
+		}
+		else {
+			filterAdd(line, 0);
+		}
+	}
+	free(line);
+	fclose(file);
+	return 0;
+}
+
+int filterActive(void){
+	return gl_nrules > 0;
+}
+
+/*	ruleMatches  -  returns int
+* Returns 1 if 'rule' applies to the entry.
+*
+* path		char		path below the start directory
+* pathLength	size_t	its length
+* base		size_t		offset of the name in 'path'
+* isDir		int			non-zero for a directory
+*/
+static int ruleMatches(const FilterRule *rule, const char *path, size_t pathLength, size_t base, int isDir){
+	if (!rule->onPath){
+		if (rule->dirOnly && !isDir){
+			return 0;
+		}
+		const char *name = path + base;
+		size_t nameLength = pathLength - base;
+		switch (rule->kind){
+			case RULE_LITERAL:
+				return nameLength == rule->length && memcmp(name, rule->pattern, nameLength) == 0;
+			case RULE_SUFFIX:
+				return nameLength >= rule->length - 1 &&
+					memcmp(name + nameLength - (rule->length - 1), rule->pattern + 1, rule->length - 1) == 0;
+			case RULE_PREFIX:
+				return nameLength >= rule->length - 1 && memcmp(name, rule->pattern, rule->length - 1) == 0;
+			default:
+				return fnmatch(rule->pattern, name, 0) == 0;
+		}
+	}
+
+	if (rule->kind == RULE_LITERAL){
+		if (pathLength == rule->length && memcmp(path, rule->pattern, pathLength) == 0){
+			return isDir || !rule->dirOnly;
+		}
+		if (pathLength > rule->length && path[rule->length] == '/' && memcmp(path, rule->pattern, rule->length) == 0){
+			return 1;											//beneath it
+		}
+	}
+	else {
+		if (fnmatch(rule->pattern, path, FNM_PATHNAME) == 0){
+			return isDir || !rule->dirOnly;
+		}
+		if (fnmatch(rule->pattern, path, FNM_PATHNAME | FNM_LEADING_DIR) == 0){
+			return 1;
+		}
+	}
+	if (rule->nleading > 0 && isDir){							//on the way down to an include
+		size_t components = 1;
+		for (size_t i = 0; i < pathLength; i++){
+			components += path[i] == '/';
+		}
+		if (components <= rule->nleading){
+			return fnmatch(rule->leading[components - 1], path, FNM_PATHNAME) == 0;
+		}
+	}
+	return 0;
+}
+
+int filterExcluded(const char *path, size_t base, int isDir){
+	size_t pathLength = strlen(path);
+	for (size_t i = 0; i < gl_nrules; i++){
+		if (ruleMatches(&gl_rules[i], path, pathLength, base, isDir)){
+			return !gl_rules[i].include;
+		}
+	}
+	return 0;
+}
+
+int filterBeneath(const char *path, int isDir){
+	char *parent;
+	if (!(parent = strdup(path))){
+		perror("strdup");
+		exit(EXIT_FAILURE);
+	}
+	size_t base = 0;
+	for (char *slash = strchr(parent, '/'); slash; slash = strchr(slash + 1, '/')){
+		*slash = '\0';
+		int excluded = filterExcluded(parent, base, 1);
+		*slash = '/';
+		if (excluded){
+			free(parent);
+			return 1;
+		}
+		base = slash + 1 - parent;
+	}
+	free(parent);
+	return filterExcluded(path, base, isDir);
+}
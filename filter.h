@@ -0,0 +1,58 @@
+/*
+*	Name		:	filter.h
+*	Description	:	Exclude and include rules shared by backup and backupfles. Rules are compiled once as they
+*					are added and then checked against every entry the walk finds, before it is stat'd where
+*					the directory entry gives its type, so an excluded directory is never opened and nothing
+*					beneath it is looked at.
+*/
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stddef.h>
+
+/*	filterAdd  -  returns int
+* Adds a rule after the ones already added, the first rule an entry matches decides whether it's left out and
+* an entry that matches none is kept. A pattern without a '/' is matched against the entry's name at any
+* depth, one with a '/' against its path below the start directory, and also matches everything beneath
+* that path. A leading '/' only anchors the pattern, a trailing '/' makes it match directories only. Shell
+* wildcards (*, ?, [...]) can be used, '*' doesn't match across a '/'. An include with a '/' also lets
+* through the directories leading down to it, so '-i src/keep -e *' works. Returns -1 for an empty pattern.
+*
+* pattern	char		the pattern, copied
+* include	int			non-zero to keep what matches, zero to leave it out
+*/
+int filterAdd(const char *pattern, int include);
+
+/*	filterLoad  -  returns int
+* Adds the rules in the file 'path', one to a line in the order given. A line starting "- " is an exclude
+* and "+ " an include, any other line is an exclude pattern. Blank lines and lines starting '#' are ignored.
+* Returns -1 if the file can't be read.
+*/
+int filterLoad(const char *path);
+
+/*	filterActive  -  returns int
+* Returns 1 if any rules have been added.
+*/
+int filterActive(void);
+
+/*	filterExcluded  -  returns int
+* Returns 1 if the entry is left out by the rules. Safe to call from any number of threads once every rule
+* has been added.
+*
+* path		char		the entry's path below the start directory, without a leading '/'
+* base		size_t		offset of the entry's name in 'path'
+* isDir		int			non-zero for a directory
+*/
+int filterExcluded(const char *path, size_t base, int isDir);
+
+/*	filterBeneath  -  returns int
+* Returns 1 if 'path' is left out itself or lies beneath a directory that is, for entries the walk didn't
+* visit.
+*
+* path		char		path below the start directory
+* isDir		int			non-zero for a directory
+*/
+int filterBeneath(const char *path, int isDir);
+
+#endif
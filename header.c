@@ -0,0 +1,184 @@
+/*
+*	Name		:	header.c
+*	Description	:	Tar header codec used by backup and restore, see header.h. Every member costs five numeric
+*					fields and a checksum each way, which with snprintf() and a byte at a time loop was a
+*					noticeable part of archiving many small files. The pax record functions are only used
+*					for the few records backup writes itself, they aren't a general pax reader.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "header.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*	Octal Globals
+* gl_octalPairs		char		the two octal digits of 0 to 63, so octalPut() writes two digits per lookup
+*/
+static const char gl_octalPairs[128] =
+	"0001020304050607101112131415161720212223242526273031323334353637"
+	"4041424344454647505152535455565760616263646566677071727374757677";
+
+/*	octalPut  -  returns void
+* Fills the field from the right two digits at a time, an odd leading digit is done on its own.
+*/
+void octalPut(char *field, int digits, uint64_t value){
+	field[digits] = '\0';
+	int i = digits;
+	for (; i >= 2; i -= 2){
+		memcpy(field + i - 2, gl_octalPairs + 2 * (value & 63), 2);
+		value >>= 6;
+	}
+	if (i == 1){
+		field[0] = '0' + (value & 7);
+	}
+}
+
+/*	numberPut  -  returns void
+* Octal covers 3 bits a digit, so a value fits if nothing is left above the top digit.
+*/
+void numberPut(char *field, size_t width, uint64_t value){
+	if (width > 22 || value >> (3 * (width - 1)) == 0){
+		octalPut(field, width - 1, value);
+		return;
+	}
+	for (size_t i = width - 1; i > 0; i--){
+		field[i] = value & 0xFF;
+		value >>= 8;
+	}
+	field[0] = (char)0x80;
+}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+/*	octalEight  -  returns uint64_t
+* Value of eight octal digits loaded as one little endian word, the first digit in the lowest byte. Neighbouring
+* digits are merged pairwise, then the pairs and then the quads, a shift, an add and a mask each time. No lane
+* can carry into the next since 8 * 7 + 7, 64 * 63 + 63 and 4096 * 4095 + 4095 all fit in theirs.
+*/
+static inline uint64_t octalEight(uint64_t x){
+	x -= 0x3030303030303030ULL;
+	x = ((x << 3) + (x >> 8)) & 0x00FF00FF00FF00FFULL;
+	x = ((x << 6) + (x >> 16)) & 0x0000FFFF0000FFFFULL;
+	return ((x << 12) + (x >> 32)) & 0xFFFFFFFFULL;
+}
+#endif
+
+/*	octalGet  -  returns uint64_t
+* Runs of eight digits are converted a word at a time, whatever is left over one digit at a time.
+*/
+uint64_t octalGet(const char *field, size_t width){
+	uint64_t value = 0;
+	size_t i = 0;
+	if ((unsigned char)field[0] == 0x80){					//base-256, positive values only
+		for (i = 1; i < width; i++){
+			value = (value << 8) | (unsigned char)field[i];
+		}
+		return value;
+	}
+	while (i < width && field[i] == ' '){
+		i++;
+	}
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (i + 8 <= width){
+		uint64_t x;
+		memcpy(&x, field + i, 8);
+		if ((x & 0xF8F8F8F8F8F8F8F8ULL) != 0x3030303030303030ULL){
+			break;											//not eight octal digits in a row
+		}
+		value = (value << 24) | octalEight(x);
+		i += 8;
+	}
+#endif
+	for (; i < width && (unsigned char)(field[i] - '0') < 8; i++){
+		value = (value << 3) | (field[i] - '0');
+	}
+	return value;
+}
+
+/*	headerSum  -  returns unsigned int
+* With SSE2 each 16 bytes are summed by one psadbw against zero, into two 64 bit halves added up at the end.
+*/
+unsigned int headerSum(const Header *header){
+	const unsigned char *bytes = (const unsigned char *)header;
+	unsigned int sum = 0;
+#ifdef __SSE2__
+	__m128i total = _mm_setzero_si128();
+	for (size_t i = 0; i < sizeof(Header); i += 16){
+		__m128i block = _mm_loadu_si128((const __m128i *)(bytes + i));
+		total = _mm_add_epi64(total, _mm_sad_epu8(block, _mm_setzero_si128()));
+	}
+	sum = _mm_cvtsi128_si32(total) + _mm_cvtsi128_si32(_mm_srli_si128(total, 8));
+#else
+	for (size_t i = 0; i < sizeof(Header); i++){
+		sum += bytes[i];
+	}
+#endif
+	for (size_t i = 0; i < sizeof(header->checksum); i++){
+		sum -= (unsigned char)header->checksum[i];				//the checksum field counts as ' ' chars
+	}
+	return sum + 8 * ' ';
+}
+
+/*	headerChecksum  -  returns void
+* Six digits, a null and a space, the same bytes snprintf("%06o") into a field of spaces gave.
+*/
+void headerChecksum(Header *header){
+	memset(header->checksum, ' ', sizeof(header->checksum));
+	octalPut(header->checksum, 6, headerSum(header));
+}
+
+/*	paxRecord  -  returns size_t
+* The length field counts itself, so try the length without it and add digits until it's consistent.
+*/
+size_t paxRecord(char *out, size_t size, const char *keyword, const char *value){
+	size_t body = strlen(keyword) + strlen(value) + 3;		//' ', '=' and '\n'
+	size_t digits = 1;
+	for (size_t limit = 10; body + digits >= limit; limit *= 10){
+		digits++;
+	}
+	size_t length = body + digits;
+	if (length > size){
+		return 0;
+	}
+	char text[24];
+	snprintf(text, sizeof(text), "%zu", length);
+	memcpy(out, text, digits);
+	out[digits] = ' ';
+	char *at = out + digits + 1;
+	size_t keywordLength = strlen(keyword), valueLength = strlen(value);
+	memcpy(at, keyword, keywordLength);
+	at[keywordLength] = '=';
+	memcpy(at + keywordLength + 1, value, valueLength);
+	at[keywordLength + 1 + valueLength] = '\n';
+	return length;
+}
+
+/*	paxValue  -  returns const char*
+* Walks the records by their length fields, a null where a record should start is taken as padding.
+*/
+const char *paxValue(const char *records, size_t length, const char *keyword, size_t *valueLength){
+	const char *found = NULL;
+	size_t keywordLength = strlen(keyword);
+	size_t at = 0;
+	while (at < length && records[at] != '\0'){
+		size_t recordLength = 0, i = at;
+		while (i < length && records[i] >= '0' && records[i] <= '9'){
+			recordLength = recordLength * 10 + (records[i++] - '0');
+		}
+		if (i == at || i >= length || records[i] != ' ' || recordLength > length - at ||
+			at + recordLength <= i + 1 || records[at + recordLength - 1] != '\n'){
+			return NULL;											//damaged
+		}
+		const char *key = records + i + 1;
+		size_t rest = at + recordLength - 1 - (i + 1);				//keyword=value, without the newline
+		if (rest > keywordLength && memcmp(key, keyword, keywordLength) == 0 && key[keywordLength] == '='){
+			found = key + keywordLength + 1;
+			*valueLength = rest - keywordLength - 1;
+		}
+		at += recordLength;
+	}
+	return found;
+}
@@ -0,0 +1,105 @@
+/*
+*	Name		:	header.h
+*	Description	:	Tar header codec used by backup and restore. Numeric fields are written with a table of
+*					octal digit pairs and read eight digits at a time, the checksum is summed sixteen bytes
+*					at a time with SSE2 where there is SSE2. Everything works on the 512 byte block where it
+*					lies, in a buffer or in the mapped archive, nothing is copied out first. Also writes and
+*					reads the records of pax extended headers.
+*/
+
+#ifndef HEADER_H
+#define HEADER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*	Struct TarHeader  -typedef-  Header
+* Contains all the information to store about each entry in our tar archive in a neat 512 byte block.
+*/
+typedef struct TarHeader{
+	char name[100];
+	char mode[8];
+	char owner[8];
+	char group[8];
+	char size[12];
+	char modified[12];
+	char checksum[8];
+	char type[1];
+	char link[100];
+	char magic[6];				//"ustar", these fields are POSIX ustar, the ones above are the original tar
+	char version[2];			//"00"
+	char ownerName[32];
+	char groupName[32];
+	char deviceMajor[8];
+	char deviceMinor[8];
+	char prefix[155];
+	char padding[12];			//pad total size of this struct to 512 bytes
+}
+Header;
+
+/*	octalPut  -  returns void
+* Writes 'value' into 'field' as exactly 'digits' octal digits, zero padded, followed by a null, the way
+* snprintf("%0{digits}o") would for a value that fits. The field needs 'digits' + 1 bytes.
+*
+* field		char		start of the field
+* digits	int			number of digits to write
+* value		uint64_t	value to write, only its low 3 * 'digits' bits are used
+*/
+void octalPut(char *field, int digits, uint64_t value);
+
+/*	numberPut  -  returns void
+* Writes 'value' into a 'width' byte field, as octalPut() does with 'width' - 1 digits if it fits, otherwise
+* in the base-256 form GNU tar and bsdtar use: 0x80 in the first byte then the value big endian in the rest.
+* This is how a member of 8GiB or more gets its size into the 12 byte size field.
+*
+* field		char		start of the field
+* width		size_t		size of the field
+* value		uint64_t	value to write
+*/
+void numberPut(char *field, size_t width, uint64_t value);
+
+/*	octalGet  -  returns uint64_t
+* Decodes a numeric field in place. Leading spaces are skipped and decoding stops at the first character that
+* isn't an octal digit or at the end of the field, so fields don't need to be null terminated. A field
+* starting with the byte 0x80 is read as base-256, see numberPut().
+*
+* field		char		start of the field
+* width		size_t		size of the field
+*/
+uint64_t octalGet(const char *field, size_t width);
+
+/*	headerSum  -  returns unsigned int
+* Sum of the header's bytes with the checksum field counted as eight spaces, which is what the checksum
+* field should hold.
+*/
+unsigned int headerSum(const Header *header);
+
+/*	headerChecksum  -  returns void
+* Fills in the checksum of a header whose other fields are all set.
+*/
+void headerChecksum(Header *header);
+
+/*	paxRecord  -  returns size_t
+* Writes one pax extended header record, "{length} {keyword}={value}\n" where the length counts its own digits,
+* into 'out'. Returns the record's length, or 0 if it needs more than 'size' bytes.
+*
+* out		char		where the record goes, it isn't null terminated
+* size		size_t		room at 'out'
+* keyword	char		such as "path" or "BACKUP.crc32c"
+* value		char		the value, no newline needed
+*/
+size_t paxRecord(char *out, size_t size, const char *keyword, const char *value);
+
+/*	paxValue  -  returns const char*
+* Finds 'keyword' in the records of a pax extended header and returns where its value starts, with the value's
+* length in 'valueLength'. Returns NULL if it isn't there or the records are damaged. When a keyword appears
+* more than once the last one counts, as POSIX says.
+*
+* records		char		the extended header's data
+* length		size_t		size of the data, padding excluded or not
+* keyword		char		the keyword to look for
+* valueLength	size_t		gets the length of the value, without the newline
+*/
+const char *paxValue(const char *records, size_t length, const char *keyword, size_t *valueLength);
+
+#endif
@@ -0,0 +1,133 @@
+/*
+*	Name		:	idcache.c
+*	Description	:	User and group name lookups shared by listfiles, backupfles and backup, see idcache.h.
+*					With LDAP or sssd behind NSS every getpwuid() can be a network round trip, so each id
+*					is resolved once and kept in a small hash table, one for users and one for groups.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pwd.h>
+#include <grp.h>
+#include <errno.h>
+#include <pthread.h>
+#include "idcache.h"
+
+/*	Struct IdName  -typedef-  IdName
+* One resolved id.
+*/
+typedef struct IdName{
+	uint32_t id;
+	char *name;						//NULL in an empty slot
+}
+IdName;
+
+/*	Struct IdTable  -typedef-  IdTable
+* Open addressed hash table of resolved ids.
+*/
+typedef struct IdTable{
+	IdName *slots;
+	size_t size;					//always a power of 2
+	size_t used;
+}
+IdTable;
+
+/*	Cache Globals
+* gl_users			IdTable		user names by uid
+* gl_groups			IdTable		group names by gid
+* gl_idLock			mutex		protects both tables, backup looks names up from more than one thread
+*/
+static IdTable			gl_users;
+static IdTable			gl_groups;
+static pthread_mutex_t	gl_idLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*	idSlot  -  returns IdName*
+* Finds the slot for 'id', either the one holding it or the empty one it goes in.
+*/
+static IdName *idSlot(IdTable *table, uint32_t id){
+	size_t i = (id * 0x9e3779b9u) & (table->size - 1);
+	while (table->slots[i].name && table->slots[i].id != id){
+		i = (i + 1) & (table->size - 1);
+	}
+	return &table->slots[i];
+}
+
+/*	idAdd  -  returns const char*
+* Remembers 'name' for 'id', growing the table when it's half full, and returns the copy kept.
+*/
+static const char *idAdd(IdTable *table, uint32_t id, const char *name){
+	if (table->used * 2 >= table->size){
+		IdTable old = *table;
+		table->size = old.size ? old.size * 2 : 64;
+		if (!(table->slots = calloc(table->size, sizeof(IdName)))){
+			perror("calloc");
+			exit(EXIT_FAILURE);
+		}
+		for (size_t i = 0; i < old.size; i++){
+			if (old.slots[i].name){
+				*idSlot(table, old.slots[i].id) = old.slots[i];
+			}
+		}
+		free(old.slots);
+	}
+	IdName *slot = idSlot(table, id);
+	slot->id = id;
+	if (!(slot->name = strdup(name))){
+		perror("strdup");
+		exit(EXIT_FAILURE);
+	}
+	table->used++;
+	return slot->name;
+}
+
+/*	idFind  -  returns const char*
+* Returns the cached name of 'id', or NULL if it hasn't been looked up yet.
+*/
+static const char *idFind(IdTable *table, uint32_t id){
+	return table->size ? idSlot(table, id)->name : NULL;
+}
+
+const char *uidName(uid_t uid){
+	pthread_mutex_lock(&gl_idLock);
+	const char *name = idFind(&gl_users, uid);
+	if (!name){
+		struct passwd entry, *pw = NULL;
+		char *buffer = NULL, number[16];
+		for (size_t size = 1024; size <= (1 << 20); size *= 4){		//ERANGE means a bigger buffer is needed
+			if (!(buffer = realloc(buffer, size)) || getpwuid_r(uid, &entry, buffer, size, &pw) != ERANGE){
+				break;
+			}
+		}
+		if (!pw){												//unknown ids and errors both fall back to
+			snprintf(number, sizeof(number), "%u", (unsigned)uid);	//the number
+		}
+		name = idAdd(&gl_users, uid, pw ? pw->pw_name : number);
+		free(buffer);
+	}
+	pthread_mutex_unlock(&gl_idLock);
+	return name;
+}
+
+const char *gidName(gid_t gid){
+	pthread_mutex_lock(&gl_idLock);
+	const char *name = idFind(&gl_groups, gid);
+	if (!name){
+		struct group entry, *gr = NULL;
+		char *buffer = NULL, number[16];
+		for (size_t size = 1024; size <= (1 << 20); size *= 4){		//groups with many members need more
+			if (!(buffer = realloc(buffer, size)) || getgrgid_r(gid, &entry, buffer, size, &gr) != ERANGE){
+				break;
+			}
+		}
+		if (!gr){
+			snprintf(number, sizeof(number), "%u", (unsigned)gid);
+		}
+		name = idAdd(&gl_groups, gid, gr ? gr->gr_name : number);
+		free(buffer);
+	}
+	pthread_mutex_unlock(&gl_idLock);
+	return name;
+}
@@ -0,0 +1,22 @@
+/*
+*	Name		:	idcache.h
+*	Description	:	User and group name lookups shared by listfiles, backupfles and backup. Each id is looked
+*					up through NSS once and remembered, ids with no name come back as their number.
+*/
+
+#ifndef IDCACHE_H
+#define IDCACHE_H
+
+#include <sys/types.h>
+
+/*	uidName  -  returns const char*
+* Name of the user 'uid', or its number if it has none. The string stays valid until the program exits.
+*/
+const char *uidName(uid_t uid);
+
+/*	gidName  -  returns const char*
+* Name of the group 'gid', or its number if it has none. The string stays valid until the program exits.
+*/
+const char *gidName(gid_t gid);
+
+#endif
@@ -3,11 +3,10 @@
 *	Author		:	Rory Pinkney
 *	Last Updated:	13 Dec 2018
 *	Description	:	Recursivley lists all the files and directories, descending from the current working
-*					directory
+*					directory, or with -d the directories with the most beneath them
 */
 
-#define _XOPEN_SOURCE 500
-#include <ftw.h>
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,10 +15,13 @@
 #include <pwd.h>
 #include <time.h>
 #include <grp.h>
+#include <unistd.h>
+#include "idcache.h"
+#include "scan.h"
+#include "rollup.h"
 
-static int display_info(const char *fpath, const struct stat *sb,
-								int tflag, struct FTW *ftwbuf){	
-	mode_t perm = sb->st_mode;
+static int display_info(const ScanEntry *entry){
+	mode_t perm = entry->stx->stx_mode;
 	char permissions[11] = {											//creating permission string in 'ls'
 		(perm & S_IFREG) ? '-' : (perm & S_IFDIR) ? 'd' : '?',			//format ->  '-rwxrwxrwx'
 		(perm & S_IRUSR) ? 'r' : '-', (perm & S_IWUSR) ? 'w' : '-',
@@ -29,35 +31,52 @@ static int display_info(const char *fpath, const struct stat *sb,
        	(perm & S_IXOTH) ? 'x' : '-', '\0'
 	};
 
-	struct passwd *pw;													//passwd struct to get owner name
-	if (pw = getpwuid(sb->st_uid), pw == NULL){
-		perror("getpwuid");
-		exit(EXIT_FAILURE);
-	}
-
-	struct group *gr;													//group struct to get group name
-	if (gr = getgrgid(sb->st_gid), gr == NULL){
-		perror("getpwuid");
-		exit(EXIT_FAILURE);
-	}
-
 	char lastModified[20];
-	strftime(lastModified, 20, "%b %d %H:%M", localtime(&sb->st_mtime));	//date string of last modified
+	formatTime(entry->stx->stx_mtime.tv_sec, lastModified);				//date string of last modified
 																			//date
-	printf("  %s  %2d  %s  %10s  %6jd  %s  %-16s\n", permissions, (int)sb->st_nlink, 
-			pw->pw_name, gr->gr_name, (intmax_t)sb->st_size, lastModified, fpath + ftwbuf->base);
+	outPrintf("  %s  %2d  %s  %10s  %6jd  %s  %-16s\n", permissions, (int)entry->stx->stx_nlink, 
+			uidName(entry->stx->stx_uid), gidName(entry->stx->stx_gid), (intmax_t)entry->stx->stx_size,
+			lastModified, entry->path + entry->base);
 
 	return 0;
 }
 
 int main(int argc, char *argv[]){
-	int flags = 0;
-	flags |= FTW_PHYS;												//do not follow symbolic links
-	
-	if (nftw(".", display_info, 20, 0) == -1){						//start file walk from current directory
-		perror("ntfw");
+	unsigned int fields = STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID | STATX_SIZE | STATX_MTIME;
+	size_t top = 0;
+	int key = ROLLUP_SIZE;
+	int option;
+
+	while ((option = getopt(argc, argv, "d:k:")) != -1){
+		switch (option){
+			case 'd':
+				top = strtoul(optarg, NULL, 10);				//directories with the most in them instead
+				break;
+			case 'k':
+				if ((key = rollupKey(optarg)) == -1 || key == ROLLUP_CHANGED){
+					printf("    -k {size, files}\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
+			default:
+				printf("    listfiles [-d {directories} [-k {size, files}]]\n");
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	if (top > 0){
+		rollupStart(0, 0);
+		if (scanTree(".", STATX_MODE | STATX_SIZE | STATX_MTIME, rollupAdd) == -1){
+			perror("scanTree");
+			exit(EXIT_FAILURE);
+		}
+		rollupPrint(top, key);
+	}
+	else if (scanTree(".", fields, display_info) == -1){			//start file walk from current directory
+		perror("scanTree");
 		exit(EXIT_FAILURE);
 	}
 
+	outFlush();
 	exit(EXIT_SUCCESS);
 }
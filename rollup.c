@@ -0,0 +1,338 @@
+/*
+*	Name		:	rollup.c
+*	Description	:	Per-directory totals, see rollup.h. The table is a struct of arrays, each total in an array
+*					of its own, so folding a directory into its parent or choosing the top N only touches the
+*					column it needs. Names are interned, a directory called 'src' or '.git' is stored once
+*					however many there are, and a row only holds the offset of its name and its parent's row.
+*					The scan reports a directory's whole subtree before it moves on, so a directory is
+*					finished, and folded into its parent, as soon as an entry at its level or above arrives.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <dirent.h>
+#include "rollup.h"
+
+#define NO_PARENT		UINT32_MAX		//parent of the root's row
+#define NAME_SLOTS		4096			//first size of the interned name hash table, a power of 2
+
+/*	Struct RollupTable  -typedef-  RollupTable
+* One row for each directory in the order the scan found them, so a parent's row always comes before its
+* children's.
+*/
+typedef struct RollupTable{
+	uint32_t *parent;				//row of the directory above, NO_PARENT for the root
+	uint32_t *name;					//offset of the interned name in gl_names
+	uint64_t *bytes;				//ROLLUP_SIZE
+	uint64_t *files;				//ROLLUP_FILES
+	uint64_t *changedBytes;			//ROLLUP_CHANGED
+	uint64_t *changedFiles;
+	size_t count;
+	size_t capacity;
+}
+RollupTable;
+
+/*	Rollup Globals
+* gl_table			RollupTable	a row for each directory
+* gl_open			uint32_t	rows of the directories the scan is inside, indexed by level
+* gl_depth			size_t		number of them
+* gl_openCapacity	size_t		size of gl_open
+* gl_names			char		every distinct name, null terminated
+* gl_namesSize		size_t		bytes used in gl_names
+* gl_namesCapacity	size_t		size of gl_names
+* gl_nameSlots		uint32_t	open addressed hash set of names, offset + 1 into gl_names, 0 for empty
+* gl_nslots			size_t		number of slots, always a power of 2
+* gl_nnames			size_t		slots in use
+* gl_changes		int			set by rollupStart(), changed files are totalled
+* gl_since			time_t		files modified after this have changed
+*/
+static RollupTable	gl_table;
+static uint32_t		*gl_open;
+static size_t		gl_depth;
+static size_t		gl_openCapacity;
+static char			*gl_names;
+static size_t		gl_namesSize;
+static size_t		gl_namesCapacity;
+static uint32_t		*gl_nameSlots;
+static size_t		gl_nslots;
+static size_t		gl_nnames;
+static int			gl_changes;
+static time_t		gl_since;
+
+void rollupStart(int changes, time_t since){
+	gl_changes = changes;
+	gl_since = since;
+	gl_nslots = NAME_SLOTS;
+	if (!(gl_nameSlots = calloc(gl_nslots, sizeof(uint32_t)))){
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/*	nameHash  -  returns uint64_t
+* FNV-1a of 'length' bytes of 'name'.
+*/
+static uint64_t nameHash(const char *name, size_t length){
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < length; i++){
+		hash = (hash ^ (unsigned char)name[i]) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+/*	nameIntern  -  returns uint32_t
+* Returns the offset of 'name' in gl_names, adding it the first time it's seen. The hash set is doubled
+* when it's half full.
+*/
+static uint32_t nameIntern(const char *name){
+	size_t length = strlen(name);
+	if (2 * (gl_nnames + 1) > gl_nslots){
+		size_t nslots = gl_nslots * 2;
+		uint32_t *slots;
+		if (!(slots = calloc(nslots, sizeof(uint32_t)))){
+			perror("calloc");
+			exit(EXIT_FAILURE);
+		}
+		for (size_t i = 0; i < gl_nslots; i++){
+			if (gl_nameSlots[i]){
+				const char *old = gl_names + gl_nameSlots[i] - 1;
+				size_t at = nameHash(old, strlen(old)) & (nslots - 1);
+				while (slots[at]){
+					at = (at + 1) & (nslots - 1);
+				}
+				slots[at] = gl_nameSlots[i];
+			}
+		}
+		free(gl_nameSlots);
+		gl_nameSlots = slots;
+		gl_nslots = nslots;
+	}
+
+	size_t at = nameHash(name, length) & (gl_nslots - 1);
+	for (; gl_nameSlots[at]; at = (at + 1) & (gl_nslots - 1)){
+		if (strcmp(gl_names + gl_nameSlots[at] - 1, name) == 0){
+			return gl_nameSlots[at] - 1;
+		}
+	}
+	if (gl_namesSize + length + 1 >= UINT32_MAX){
+		printf("Too many different names to total\n");
+		exit(EXIT_FAILURE);
+	}
+	if (gl_namesSize + length + 1 > gl_namesCapacity){
+		gl_namesCapacity = gl_namesCapacity ? gl_namesCapacity * 2 : 1 << 16;
+		while (gl_namesSize + length + 1 > gl_namesCapacity){
+			gl_namesCapacity *= 2;
+		}
+		if (!(gl_names = realloc(gl_names, gl_namesCapacity))){
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+	uint32_t offset = gl_namesSize;
+	memcpy(gl_names + offset, name, length + 1);
+	gl_namesSize += length + 1;
+	gl_nameSlots[at] = offset + 1;
+	gl_nnames++;
+	return offset;
+}
+
+/*	growColumn  -  returns void
+* Resizes one column of the table to 'capacity' rows of 'size' bytes.
+*/
+static void growColumn(void **column, size_t capacity, size_t size){
+	if (!(*column = realloc(*column, capacity * size))){
+		perror("realloc");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/*	addRow  -  returns uint32_t
+* Appends a row for a directory with everything zero and returns it.
+*/
+static uint32_t addRow(uint32_t parent, uint32_t name){
+	RollupTable *t = &gl_table;
+	if (t->count == UINT32_MAX){
+		printf("Too many directories to total\n");
+		exit(EXIT_FAILURE);
+	}
+	if (t->count == t->capacity){
+		t->capacity = t->capacity ? t->capacity * 2 : 1024;
+		growColumn((void **)&t->parent, t->capacity, sizeof(uint32_t));
+		growColumn((void **)&t->name, t->capacity, sizeof(uint32_t));
+		growColumn((void **)&t->bytes, t->capacity, sizeof(uint64_t));
+		growColumn((void **)&t->files, t->capacity, sizeof(uint64_t));
+		growColumn((void **)&t->changedBytes, t->capacity, sizeof(uint64_t));
+		growColumn((void **)&t->changedFiles, t->capacity, sizeof(uint64_t));
+	}
+	uint32_t row = t->count++;
+	t->parent[row] = parent;
+	t->name[row] = name;
+	t->bytes[row] = t->files[row] = t->changedBytes[row] = t->changedFiles[row] = 0;
+	return row;
+}
+
+/*	closeTo  -  returns void
+* Finishes the open directories deeper than 'level', deepest first, adding each one's totals to its parent.
+*/
+static void closeTo(size_t level){
+	RollupTable *t = &gl_table;
+	while (gl_depth > level){
+		uint32_t row = gl_open[--gl_depth];
+		uint32_t parent = t->parent[row];
+		if (parent != NO_PARENT){
+			t->bytes[parent] += t->bytes[row];
+			t->files[parent] += t->files[row];
+			t->changedBytes[parent] += t->changedBytes[row];
+			t->changedFiles[parent] += t->changedFiles[row];
+		}
+	}
+}
+
+int rollupAdd(const ScanEntry *entry){
+	size_t level = entry->level;
+	closeTo(level);											//anything deeper is behind the scan now
+	if (entry->type == DT_DIR){
+		if (level != gl_depth){
+			return 0;										//no row for the directory it's in
+		}
+		uint32_t parent = level ? gl_open[level - 1] : NO_PARENT;
+		uint32_t row = addRow(parent, nameIntern(level ? entry->path + entry->base : entry->path));
+		if (gl_depth == gl_openCapacity){
+			gl_openCapacity = gl_openCapacity ? gl_openCapacity * 2 : 64;
+			growColumn((void **)&gl_open, gl_openCapacity, sizeof(uint32_t));
+		}
+		gl_open[gl_depth++] = row;
+		return 0;
+	}
+	if (level == 0 || level != gl_depth){
+		return 0;											//the root itself is a file
+	}
+	RollupTable *t = &gl_table;
+	uint32_t row = gl_open[level - 1];
+	uint64_t size = entry->stx->stx_size;
+	t->bytes[row] += size;
+	t->files[row]++;
+	if (gl_changes && entry->stx->stx_mtime.tv_sec > gl_since){
+		t->changedBytes[row] += size;
+		t->changedFiles[row]++;
+	}
+	return 0;
+}
+
+int rollupKey(const char *name){
+	if (strcmp(name, "size") == 0){
+		return ROLLUP_SIZE;
+	}
+	if (strcmp(name, "files") == 0){
+		return ROLLUP_FILES;
+	}
+	if (strcmp(name, "changed") == 0){
+		return ROLLUP_CHANGED;
+	}
+	return -1;
+}
+
+/*	rowBelow  -  returns int
+* Order of the top N heap, by 'values' then later rows first, so of two that tie the one found first stays.
+*/
+static int rowBelow(const uint64_t *values, uint32_t a, uint32_t b){
+	return values[a] < values[b] || (values[a] == values[b] && a > b);
+}
+
+/*	heapDown  -  returns void
+* Moves the row at 'at' down the min heap 'heap' of 'count' rows until both children are above it.
+*/
+static void heapDown(const uint64_t *values, uint32_t *heap, size_t count, size_t at){
+	for (;;){
+		size_t low = at, left = 2 * at + 1, right = left + 1;
+		if (left < count && rowBelow(values, heap[left], heap[low])){
+			low = left;
+		}
+		if (right < count && rowBelow(values, heap[right], heap[low])){
+			low = right;
+		}
+		if (low == at){
+			return;
+		}
+		uint32_t swap = heap[at];
+		heap[at] = heap[low];
+		heap[low] = swap;
+		at = low;
+	}
+}
+
+/*	rowPath  -  returns void
+* Puts the path of 'row' into 'out', its names from the root down joined by '/'. A path longer than 'size'
+* is cut short.
+*/
+static void rowPath(uint32_t row, char *out, size_t size){
+	uint32_t chain[PATH_MAX / 2];
+	size_t depth = 0;
+	for (; row != NO_PARENT && depth < sizeof(chain) / sizeof(chain[0]); row = gl_table.parent[row]){
+		chain[depth++] = row;
+	}
+	size_t used = 0;
+	out[0] = '\0';
+	while (depth > 0 && used < size){
+		used += snprintf(out + used, size - used, "%s%s", used ? "/" : "", gl_names + gl_table.name[chain[--depth]]);
+	}
+}
+
+void rollupPrint(size_t top, int key){
+	closeTo(0);
+	RollupTable *t = &gl_table;
+	const uint64_t *values = key == ROLLUP_FILES ? t->files : key == ROLLUP_CHANGED ? t->changedBytes : t->bytes;
+	if (top > t->count){
+		top = t->count;
+	}
+	uint32_t *heap;
+	if (!(heap = malloc((top ? top : 1) * sizeof(uint32_t)))){
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	size_t count = 0;
+	for (uint32_t row = 0; top > 0 && row < t->count; row++){
+		if (count < top){
+			heap[count++] = row;
+			if (count == top){
+				for (size_t i = top / 2; i-- > 0;){
+					heapDown(values, heap, count, i);
+				}
+			}
+		}
+		else if (rowBelow(values, heap[0], row)){
+			heap[0] = row;											//beats the least of the top N so far
+			heapDown(values, heap, count, 0);
+		}
+	}
+	for (size_t end = count; end > 1; end--){					//take the least off the top each time,
+		uint32_t swap = heap[0];								//leaving the rest most first
+		heap[0] = heap[end - 1];
+		heap[end - 1] = swap;
+		heapDown(values, heap, end - 1, 0);
+	}
+
+	if (gl_changes){
+		outPrintf("  %14s  %10s  %14s  %10s  %s\n", "bytes", "files", "changed bytes", "changed", "directory");
+	}
+	else {
+		outPrintf("  %14s  %10s  %s\n", "bytes", "files", "directory");
+	}
+	char path[PATH_MAX];
+	for (size_t i = 0; i < count; i++){
+		uint32_t row = heap[i];
+		rowPath(row, path, sizeof(path));
+		if (gl_changes){
+			outPrintf("  %14ju  %10ju  %14ju  %10ju  %s\n", (uintmax_t)t->bytes[row], (uintmax_t)t->files[row],
+				(uintmax_t)t->changedBytes[row], (uintmax_t)t->changedFiles[row], path);
+		}
+		else {
+			outPrintf("  %14ju  %10ju  %s\n", (uintmax_t)t->bytes[row], (uintmax_t)t->files[row], path);
+		}
+	}
+	free(heap);
+}
@@ -0,0 +1,48 @@
+/*
+*	Name		:	rollup.h
+*	Description	:	Per-directory totals for listfiles and backupfles -d. Entries are folded into a table with a
+*					row for each directory as the scan reports them, nothing is kept for a file, so one pass
+*					over tens of millions of files needs memory in proportion to the directories only. Each
+*					directory's totals include everything beneath it.
+*/
+
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include <stddef.h>
+#include <time.h>
+#include "scan.h"
+
+#define ROLLUP_SIZE		0				//bytes of files beneath the directory
+#define ROLLUP_FILES	1				//number of files beneath it
+#define ROLLUP_CHANGED	2				//bytes of files beneath it modified since the cut off
+
+/*	rollupStart  -  returns void
+* Starts an empty table.
+*
+* changes	int			non-zero to total the files modified after 'since' as well
+* since		time_t		the cut off, files modified after it have changed
+*/
+void rollupStart(int changes, time_t since);
+
+/*	rollupAdd  -  returns int
+* scanTree() callback that adds one entry to the table. The scan must ask for STATX_MODE, STATX_SIZE and
+* STATX_MTIME. Always returns 0.
+*/
+int rollupAdd(const ScanEntry *entry);
+
+/*	rollupKey  -  returns int
+* Returns the ROLLUP_* key named 'name', "size", "files" or "changed", or -1 if it isn't one of them.
+*/
+int rollupKey(const char *name);
+
+/*	rollupPrint  -  returns void
+* Prints the 'top' directories with the most of 'key', most first, with outPrintf(). Directories that tie
+* are printed in the order the scan found them.
+*
+* top		size_t		number of directories to print
+* key		int			ROLLUP_* to sort by
+*/
+void rollupPrint(size_t top, int key);
+
+#endif
@@ -0,0 +1,495 @@
+/*
+*	Name		:	scan.c
+*	Description	:	Directory scan engine shared by listfiles and backupfles, see scan.h. Each directory is
+*					read in full, then every entry that needs a stat gets a statx() request in one io_uring
+*					submission and the results are reaped together, so a cold cache or network filesystem
+*					serves a whole directory's worth of lookups at once instead of one at a time. Without
+*					io_uring (old kernels, or blocked by seccomp) the same batches are done with statx().
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sysmacros.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "scan.h"
+
+#define SCAN_RING		256				//statx requests submitted to the ring at once
+#define OUT_BUFFER		(1 << 20)		//output collected before each write() to stdout
+#define TIME_SLOTS		256				//quarter hours whose UTC offset is remembered
+
+/*	Struct StatRing  -typedef-  StatRing
+* The parts of an io_uring mapped into this process, only what's needed to submit statx requests and reap
+* their completions.
+*/
+typedef struct StatRing{
+	int fd;
+	unsigned entries;				//size of the submission queue
+	unsigned *sqHead;
+	unsigned *sqTail;
+	unsigned *sqMask;
+	unsigned *sqArray;
+	struct io_uring_sqe *sqes;
+	unsigned *cqHead;
+	unsigned *cqTail;
+	unsigned *cqMask;
+	struct io_uring_cqe *cqes;
+}
+StatRing;
+
+/*	Struct VisitedDir  -typedef-  VisitedDir
+* A directory the scan has already been into.
+*/
+typedef struct VisitedDir{
+	dev_t dev;
+	ino_t ino;
+	int used;
+}
+VisitedDir;
+
+/*	Struct HourOffset  -typedef-  HourOffset
+* The UTC offset that applies to one quarter hour.
+*/
+typedef struct HourOffset{
+	long long quarter;				//time / 900
+	long offset;					//seconds east of UTC
+	int valid;
+}
+HourOffset;
+
+/*	Scan Globals
+* gl_ring			StatRing	the io_uring, if there is one
+* gl_ringState		int			0 not set up yet, 1 in use, -1 unavailable so statx() is called directly
+* gl_visited		VisitedDir	open addressed hash set of directories already scanned
+* gl_visitedSize	size_t		number of slots, always a power of 2
+* gl_nvisited		size_t		slots in use
+* gl_path			char		path of the entry being reported, built up as the scan descends
+* gl_rootLength		size_t		length of the root in gl_path, the path below it is what scanPrune() sees
+* gl_prune			function	set by scanPrune(), NULL to report everything
+* gl_outBuffer		char		output waiting to be written to stdout
+* gl_outUsed		size_t		bytes in gl_outBuffer
+* gl_offsets		HourOffset	cache of UTC offsets for formatTime()
+*/
+static StatRing		gl_ring;
+static int			gl_ringState;
+static VisitedDir	*gl_visited;
+static size_t		gl_visitedSize;
+static size_t		gl_nvisited;
+static char			gl_path[PATH_MAX];
+static size_t		gl_rootLength;
+static int			(*gl_prune)(const char *, size_t, int);
+static char			gl_outBuffer[OUT_BUFFER];
+static size_t		gl_outUsed;
+static HourOffset	gl_offsets[TIME_SLOTS];
+
+/*	ringSetup  -  returns int
+* Creates the io_uring and maps its queues. Returns -1 if io_uring isn't available.
+*/
+static int ringSetup(){
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	int fd = syscall(__NR_io_uring_setup, SCAN_RING, &params);
+	if (fd == -1){
+		return -1;
+	}
+	size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	int single = params.features & IORING_FEAT_SINGLE_MMAP;			//both rings in one mapping
+	if (single){
+		sqSize = cqSize = sqSize > cqSize ? sqSize : cqSize;
+	}
+	char *sq = mmap(NULL, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	char *cq = single ? sq : mmap(NULL, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+								  IORING_OFF_CQ_RING);
+	void *sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+					  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED){
+		close(fd);
+		return -1;
+	}
+	gl_ring.fd = fd;
+	gl_ring.entries = params.sq_entries;
+	gl_ring.sqHead = (unsigned *)(sq + params.sq_off.head);
+	gl_ring.sqTail = (unsigned *)(sq + params.sq_off.tail);
+	gl_ring.sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+	gl_ring.sqArray = (unsigned *)(sq + params.sq_off.array);
+	gl_ring.sqes = sqes;
+	gl_ring.cqHead = (unsigned *)(cq + params.cq_off.head);
+	gl_ring.cqTail = (unsigned *)(cq + params.cq_off.tail);
+	gl_ring.cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+	gl_ring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+	return 0;
+}
+
+/*	ringEnter  -  returns int
+* io_uring_enter(), retried after interrupts.
+*/
+static int ringEnter(unsigned submit, unsigned wait){
+	int done;
+	do {
+		done = syscall(__NR_io_uring_enter, gl_ring.fd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	} while (done == -1 && errno == EINTR);
+	return done;
+}
+
+/*	statBatch  -  returns void
+* Stats 'count' entries of the directory open on 'dirFd', filling in 'stx' and 'result' (0 or -errno) for
+* each. Up to SCAN_RING requests are in flight at once. A symbolic link whose target is gone is stat'd itself,
+* the way nftw() reports one, instead of being dropped.
+*
+* dirFd		int			the directory
+* names		char		entry names, relative to the directory
+* count		size_t		number of entries
+* mask		unsigned	STATX_* fields wanted
+* stx		statx		results
+* result	int			0 or a negative errno for each entry
+*/
+static void statBatch(int dirFd, char **names, size_t count, unsigned int mask, struct statx *stx, int *result){
+	if (gl_ringState == 0){
+		gl_ringState = ringSetup() == 0 ? 1 : -1;
+	}
+	size_t next = 0;
+	while (gl_ringState == 1 && next < count){
+		unsigned tail = *gl_ring.sqTail;					//only this thread touches the tail
+		unsigned batch = 0;
+		for (; next + batch < count && batch < gl_ring.entries; batch++){
+			size_t i = next + batch;
+			unsigned index = tail & *gl_ring.sqMask;
+			struct io_uring_sqe *sqe = &gl_ring.sqes[index];
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = IORING_OP_STATX;
+			sqe->fd = dirFd;
+			sqe->addr = (uintptr_t)names[i];
+			sqe->len = mask;
+			sqe->off = (uintptr_t)&stx[i];
+			sqe->user_data = i;
+			gl_ring.sqArray[index] = index;
+			tail++;
+		}
+		__atomic_store_n(gl_ring.sqTail, tail, __ATOMIC_RELEASE);
+
+		unsigned submitted = 0, reaped = 0;
+		while (reaped < (gl_ringState == 1 ? batch : submitted)){
+			int done = ringEnter(gl_ringState == 1 ? batch - submitted : 0, 1);
+			if (done == -1 && gl_ringState == 1){
+				gl_ringState = -1;							//give up on the ring and finish with statx(),
+			}												//once the requests already submitted have
+			else if (done == -1){							//stopped writing into 'stx'
+				sched_yield();
+			}
+			else {
+				submitted += done;
+			}
+			unsigned head = *gl_ring.cqHead;
+			while (head != __atomic_load_n(gl_ring.cqTail, __ATOMIC_ACQUIRE)){
+				struct io_uring_cqe *cqe = &gl_ring.cqes[head & *gl_ring.cqMask];
+				result[cqe->user_data] = cqe->res;
+				head++;
+				reaped++;
+			}
+			__atomic_store_n(gl_ring.cqHead, head, __ATOMIC_RELEASE);
+		}
+		if (gl_ringState != 1){
+			break;
+		}
+		for (unsigned i = 0; i < batch; i++){
+			if (result[next + i] == -EINVAL){				//kernel older than 5.6, no IORING_OP_STATX
+				gl_ringState = -1;
+				break;
+			}
+		}
+		if (gl_ringState == 1){
+			next += batch;
+		}
+	}
+	for (; next < count; next++){
+		result[next] = statx(dirFd, names[next], 0, mask, &stx[next]) == 0 ? 0 : -errno;
+	}
+	for (size_t i = 0; i < count; i++){
+		if (result[i] == -ENOENT){							//dangling link, or gone since readdir()
+			result[i] = statx(dirFd, names[i], AT_SYMLINK_NOFOLLOW, mask, &stx[i]) == 0 ? 0 : -errno;
+		}
+	}
+}
+
+/*	visitDir  -  returns int
+* Adds a directory to the visited set. Returns 0 if it was already there.
+*/
+static int visitDir(dev_t dev, ino_t ino){
+	if (gl_nvisited * 2 >= gl_visitedSize){
+		VisitedDir *old = gl_visited;
+		size_t oldSize = gl_visitedSize;
+		gl_visitedSize = oldSize ? oldSize * 2 : 1024;
+		if (!(gl_visited = calloc(gl_visitedSize, sizeof(VisitedDir)))){
+			perror("calloc");
+			exit(EXIT_FAILURE);
+		}
+		gl_nvisited = 0;
+		for (size_t i = 0; i < oldSize; i++){
+			if (old[i].used){
+				visitDir(old[i].dev, old[i].ino);
+			}
+		}
+		free(old);
+	}
+	size_t i = ((uint64_t)ino * 0x9e3779b97f4a7c15ULL ^ (uint64_t)dev) & (gl_visitedSize - 1);
+	while (gl_visited[i].used){
+		if (gl_visited[i].ino == ino && gl_visited[i].dev == dev){
+			return 0;
+		}
+		i = (i + 1) & (gl_visitedSize - 1);
+	}
+	gl_visited[i].dev = dev;
+	gl_visited[i].ino = ino;
+	gl_visited[i].used = 1;
+	gl_nvisited++;
+	return 1;
+}
+
+/*	scanDirectory  -  returns int
+* Reports every entry of the directory at 'gl_path', descending into subdirectories as they come up so the
+* order is the same as nftw()'s.
+*
+* length	size_t		length of the directory's path in gl_path
+* level		int			depth of the directory
+*/
+static int scanDirectory(size_t length, int level, unsigned int mask, int (*fn)(const ScanEntry *)){
+	int fd;
+	DIR *dir = NULL;
+	if ((fd = open(gl_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1 || !(dir = fdopendir(fd))){
+		fprintf(stderr, "opendir: %s: %s\n", gl_path, strerror(errno));
+		if (fd != -1){
+			close(fd);
+		}
+		return 0;
+	}
+
+	size_t count = 0, capacity = 64, namesUsed = 0, namesSize = 4096;
+	size_t *nameAt = malloc(capacity * sizeof(size_t));
+	unsigned char *types = malloc(capacity);
+	char *names = malloc(namesSize);
+	if (!nameAt || !types || !names){
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	struct dirent *entry;
+	while ((entry = readdir(dir))){							//the whole directory first
+		const char *name = entry->d_name;
+		if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))){
+			continue;
+		}
+		size_t nameLength = strlen(name) + 1;
+		if (count == capacity){
+			capacity *= 2;
+			nameAt = realloc(nameAt, capacity * sizeof(size_t));
+			types = realloc(types, capacity);
+		}
+		while (namesUsed + nameLength > namesSize){
+			namesSize *= 2;
+			names = realloc(names, namesSize);
+		}
+		if (!nameAt || !types || !names){
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+		memcpy(names + namesUsed, name, nameLength);
+		nameAt[count] = namesUsed;
+		types[count++] = entry->d_type;
+		namesUsed += nameLength;
+	}
+
+	struct statx *stx = malloc((count ? count : 1) * sizeof(struct statx));
+	int *result = malloc((count ? count : 1) * sizeof(int));
+	char **statNames = malloc((count ? count : 1) * sizeof(char *));
+	size_t *statIndex = malloc((count ? count : 1) * sizeof(size_t));
+	if (!stx || !result || !statNames || !statIndex){
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	unsigned char *pruned = calloc(count ? count : 1, 1);	//1 kept, 2 left out, 0 not asked yet
+	if (!pruned){
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	size_t nstat = 0;
+	for (size_t i = 0; i < count; i++){
+		if (gl_prune && types[i] != DT_UNKNOWN && types[i] != DT_LNK){
+			const char *name = names + nameAt[i];			//the type is known, ask before any stat
+			size_t nameLength = strlen(name);
+			if (length + 1 + nameLength < sizeof(gl_path)){
+				gl_path[length] = '/';
+				memcpy(gl_path + length + 1, name, nameLength + 1);
+				pruned[i] = gl_prune(gl_path + gl_rootLength + 1, length - gl_rootLength, types[i] == DT_DIR) ? 2 : 1;
+				gl_path[length] = '\0';
+			}
+		}
+		if (pruned[i] == 2){
+			statIndex[i] = SIZE_MAX;
+		}
+		else if (mask || types[i] == DT_UNKNOWN || types[i] == DT_LNK || types[i] == DT_DIR){
+			statNames[nstat] = names + nameAt[i];			//directories and links are always stat'd, to
+			statIndex[i] = nstat++;							//follow them
+		}
+		else {
+			statIndex[i] = SIZE_MAX;						//d_type is all the caller needs
+		}
+	}
+	statBatch(fd, statNames, nstat, mask | STATX_TYPE | STATX_INO, stx, result);
+
+	int stop = 0;
+	for (size_t i = 0; i < count && !stop; i++){
+		const char *name = names + nameAt[i];
+		size_t nameLength = strlen(name);
+		if (pruned[i] == 2){
+			continue;
+		}
+		if (length + 1 + nameLength >= sizeof(gl_path)){
+			fprintf(stderr, "path too long: %s/%s\n", gl_path, name);
+			continue;
+		}
+		gl_path[length] = '/';
+		memcpy(gl_path + length + 1, name, nameLength + 1);
+
+		ScanEntry scanned = { gl_path, length + 1, level + 1, types[i], NULL };
+		size_t s = statIndex[i];
+		if (s != SIZE_MAX){
+			if (result[s] != 0){
+				fprintf(stderr, "statx: %s: %s\n", gl_path, strerror(-result[s]));
+				gl_path[length] = '\0';
+				continue;
+			}
+			scanned.stx = &stx[s];
+			scanned.type = IFTODT(stx[s].stx_mode);
+		}
+		if (gl_prune && pruned[i] == 0 && gl_prune(gl_path + gl_rootLength + 1, length - gl_rootLength,
+												   scanned.type == DT_DIR)){
+			gl_path[length] = '\0';							//only known once it was stat'd
+			continue;
+		}
+		if (scanned.type == DT_DIR && s != SIZE_MAX &&
+			!visitDir(makedev(stx[s].stx_dev_major, stx[s].stx_dev_minor), stx[s].stx_ino)){
+			gl_path[length] = '\0';						//already been in it, as nftw() does it isn't
+			continue;										//reported again either
+		}
+		if ((stop = fn(&scanned))){
+			break;
+		}
+		if (scanned.type == DT_DIR){
+			stop = scanDirectory(length + 1 + nameLength, level + 1, mask, fn);
+		}
+		gl_path[length] = '\0';
+	}
+	gl_path[length] = '\0';
+
+	closedir(dir);
+	free(nameAt);
+	free(types);
+	free(names);
+	free(stx);
+	free(result);
+	free(statNames);
+	free(statIndex);
+	free(pruned);
+	return stop;
+}
+
+int scanTree(const char *root, unsigned int mask, int (*fn)(const ScanEntry *entry)){
+	struct statx stx;
+	if (strlen(root) >= sizeof(gl_path)){
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if (statx(AT_FDCWD, root, 0, mask | STATX_TYPE | STATX_INO, &stx) == -1){
+		return -1;
+	}
+	strcpy(gl_path, root);
+	size_t length = strlen(gl_path);
+	while (length > 1 && gl_path[length - 1] == '/'){
+		gl_path[--length] = '\0';
+	}
+	gl_rootLength = length;
+	const char *slash = strrchr(gl_path, '/');
+	ScanEntry scanned = { gl_path, slash && slash[1] ? slash + 1 - gl_path : 0, 0, IFTODT(stx.stx_mode), &stx };
+	if (scanned.type == DT_DIR){
+		visitDir(makedev(stx.stx_dev_major, stx.stx_dev_minor), stx.stx_ino);
+	}
+	int stop = fn(&scanned);
+	if (!stop && scanned.type == DT_DIR){
+		stop = scanDirectory(length, 0, mask, fn);
+	}
+	return stop;
+}
+
+void scanPrune(int (*prune)(const char *path, size_t base, int isDir)){
+	gl_prune = prune;
+}
+
+void outFlush(void){
+	size_t done = 0;
+	while (done < gl_outUsed){
+		ssize_t wrote = write(STDOUT_FILENO, gl_outBuffer + done, gl_outUsed - done);
+		if (wrote == -1 && errno == EINTR){
+			continue;
+		}
+		if (wrote == -1){
+			perror("write");
+			exit(EXIT_FAILURE);
+		}
+		done += wrote;
+	}
+	gl_outUsed = 0;
+}
+
+void outPrintf(const char *format, ...){
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(gl_outBuffer + gl_outUsed, OUT_BUFFER - gl_outUsed, format, args);
+	va_end(args);
+	if (length < 0 || gl_outUsed + length < OUT_BUFFER){
+		gl_outUsed += length > 0 ? length : 0;
+		return;
+	}
+	outFlush();												//didn't fit, flush and format it again
+	va_start(args, format);
+	length = vsnprintf(gl_outBuffer, OUT_BUFFER, format, args);
+	va_end(args);
+	gl_outUsed = length < OUT_BUFFER ? length : OUT_BUFFER - 1;
+}
+
+void formatTime(time_t t, char *out){
+	static const char *months[12] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+									  "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+	long long quarter = t >= 0 ? t / 900 : (t - 899) / 900;	//offsets only change on quarter hours
+	HourOffset *slot = &gl_offsets[(unsigned long long)quarter % TIME_SLOTS];
+	if (!slot->valid || slot->quarter != quarter){
+		struct tm tm;
+		localtime_r(&t, &tm);
+		slot->quarter = quarter;
+		slot->offset = tm.tm_gmtoff;
+		slot->valid = 1;
+	}
+
+	long long local = (long long)t + slot->offset;
+	long long days = local >= 0 ? local / 86400 : (local - 86399) / 86400;
+	long long seconds = local - days * 86400;
+	days += 719468;											//civil date from days since the epoch, see
+	long long era = (days >= 0 ? days : days - 146096) / 146097;	//Howard Hinnant's date algorithms
+	long long dayOfEra = days - era * 146097;
+	long long yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+	long long dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+	long long monthIndex = (5 * dayOfYear + 2) / 153;
+	int day = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+	int month = monthIndex < 10 ? monthIndex + 3 : monthIndex - 9;
+	snprintf(out, 13, "%s %02d %02d:%02d", months[month - 1], day, (int)(seconds / 3600), (int)(seconds / 60 % 60));
+}
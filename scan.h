@@ -0,0 +1,65 @@
+/*
+*	Name		:	scan.h
+*	Description	:	Directory scan engine shared by listfiles and backupfles. Walks a tree in the same order
+*					nftw() does, but stats each directory's entries as one batch of statx() requests through
+*					io_uring, asking only for the fields the caller needs. Also has the buffered output and
+*					the cached time formatting both programs print their lines with.
+*/
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/stat.h>
+
+/*	Struct ScanEntry  -typedef-  ScanEntry
+* What the scan passes to its callback for each file or directory.
+*/
+typedef struct ScanEntry{
+	const char *path;				//full path, as nftw() would have passed it
+	int base;						//offset of the file name within path
+	int level;						//0 for the root
+	unsigned char type;				//DT_DIR, DT_REG and so on, of the target for a symbolic link
+	const struct statx *stx;		//NULL if no fields were asked for and d_type was enough
+}
+ScanEntry;
+
+/*	scanTree  -  returns int
+* Calls 'fn' for 'root' and everything beneath it, parents before children. Symbolic links are followed but
+* no directory is visited twice. 'mask' is the STATX_* fields 'fn' needs, with 0 files whose type is known
+* from the directory entry aren't stat'd at all. Entries that can't be stat'd are reported on stderr and
+* skipped. Returns -1 if 'root' can't be stat'd, or whatever non-zero value 'fn' stopped the scan with.
+*
+* root		char		where to start
+* mask		unsigned	STATX_* fields needed
+* fn		function	called for every entry, returning non-zero stops the scan
+*/
+int scanTree(const char *root, unsigned int mask, int (*fn)(const ScanEntry *entry));
+
+/*	scanPrune  -  returns void
+* Sets a function the scan asks about every entry below the root, before it is stat'd if the directory entry
+* gives its type. Entries it returns non-zero for aren't reported, stat'd or descended into.
+*
+* prune		function	given the entry's path below the root, the offset of its name in that path and
+*						whether it's a directory. NULL to report everything
+*/
+void scanPrune(int (*prune)(const char *path, size_t base, int isDir));
+
+/*	outPrintf  -  returns void
+* printf() into a large output buffer that goes to stdout in big writes.
+*/
+void outPrintf(const char *format, ...);
+
+/*	outFlush  -  returns void
+* Writes out whatever is in the output buffer.
+*/
+void outFlush(void);
+
+/*	formatTime  -  returns void
+* Formats 't' like strftime("%b %d %H:%M") with localtime(), into 'out' which needs 13 bytes. The offset from
+* UTC is only looked up once per quarter hour of time seen so most calls never touch the timezone code.
+*/
+void formatTime(time_t t, char *out);
+
+#endif